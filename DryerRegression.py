@@ -4,6 +4,8 @@ from sklearn import linear_model
 
 import paho.mqtt.client as mqtt
 import socket
+import time
+import telemetry_frame
 
 #importing data
 data = pandas.read_csv("Book1.csv")
@@ -15,6 +17,14 @@ y = numpy.arange(0,1,1/dataLen)
 regr = linear_model.LinearRegression()
 regr.fit(X,y)
 
+#exporting the model for the native predictor (RT-App-Development/HostTools/dryness_predictor)
+def exportModel(path):
+    with open(path, 'w') as f:
+        f.write('# intercept, then coefficients for xa ya za (mg) xr yr zr (dps)\n')
+        f.write(' '.join(repr(float(v)) for v in [regr.intercept_] + list(regr.coef_)) + '\n')
+
+exportModel('dryness_model.txt')
+
 
 #prediction code
 X_predict = [[-992.592041,195.56601,18.300001,1.19,-0.28,-1.68],[-998.082031,164.822006,-11.834001,1.47,0.28,-0.56], [2.074,-13.908,1010.892029,-0.7,2.17,-5.04]]
@@ -38,24 +48,23 @@ def on_connect(client, userdata, flags, rc):
 def on_message(client, userdata, msg):
     # print(msg.topic+" "+str(msg.payload))
     listifiedData = listifyData((msg.payload))
+    if len(listifiedData) == 0:
+        return
     print(listifiedData)
     # print(predictClothes(listifiedData))
-    client.publish("arf/microsoft/output", str(1.0-predictClothes(listifiedData)))
+    client.publish("arf/microsoft/output", str(1.0-numpy.mean(predictClothes(listifiedData))))
 
 #==============================Parse Data and Predict===========================
 def listifyData(message):
-    inputData = message.split(b',')
-    # print(inputData)
-    inputData.pop(0)
-    # inputData.pop(6)
-    # map(float, inputData)
-    floats=[]
-    floats = [list([float(x) for x in inputData])]
-    # numpyData = numpy.array(inputDataRaw)
-    # inputData = numpyData.astype(numpy.float64)
-    # print(floats)
-    # inputData=list(message)
-    
+    # Each frame carries one or more raw samples, convert all of them so they are predicted in one call
+    frame = telemetry_frame.decode(message)
+    if frame is None:
+        return []
+    header, samples = frame
+    if header['type'] != telemetry_frame.FRAME_SAMPLES:
+        return []
+    floats = [telemetry_frame.toEngineering(header, sample) for sample in samples]
+
     return floats
 
 def predictClothes(X_predict):
@@ -81,9 +90,9 @@ client.loop_start()
 # Publish a message to the "test/topic" topic
 # client.publish("test/topic", "Hello, world!")
 
-# Wait for messages to be received
+# Wait for messages to be received, the network loop runs on its own thread
 while True:
-    pass
+    time.sleep(1)
 
 # Stop the MQTT client's network loop
 client.loop_stop()
@@ -0,0 +1,84 @@
+#pragma once
+
+// LSM6DSO on the starter kit's ISU2 I2C bus.  400 kHz keeps one 12 byte output read under 0.4 ms.
+// The high-level app owns ISU2 in the default build: to sample here, move "$AVNET_MT3620_SK_ISU2_I2C"
+// from HighLevelApp/app_manifest.json to an "I2cMaster" capability in app_manifest.json (see
+// LSM6DSO_ON_RT_CORE in HighLevelApp/build_options.h).
+#define LSM6DSO_I2C_UNIT MT3620_UNIT_ISU2
+#define LSM6DSO_I2C_ADDRESS 0x6A
+#define LSM6DSO_I2C_BUS_SPEED I2C_BUS_SPEED_FAST
+
+// External LSM6DSO on ISU0 SPI instead (click socket 1, chip select B on click socket 2), driven by
+// DMA at up to 10 MHz.  Uncomment LSM6DSO_SPI to sample it at the full 6.66 kHz through its FIFO, and
+// add "SpiMaster": [ "$AVNET_MT3620_SK_ISU0_SPI" ] to the capabilities in app_manifest.json with it;
+// ISU0 is left free for click socket 1 otherwise.
+// #define LSM6DSO_SPI
+#define LSM6DSO_SPI_UNIT MT3620_UNIT_ISU0
+#define LSM6DSO_SPI_CS 1
+#define LSM6DSO_SPI_BUS_SPEED 8000000
+
+#ifdef LSM6DSO_SPI
+// Both sensors batch into the FIFO at 6.66 kHz, and every SAMPLER_PERIOD_US the timer interrupt
+// starts a drain of everything in it: 16 samples, 32 FIFO words, per period.  The timer still
+// comes from GPT3 at 1 MHz, the sample times are the sensor's.
+#define SAMPLER_PERIOD_US 2400
+#define SAMPLER_XL_ODR LSM6DSO_XL_ODR_6667Hz
+#define SAMPLER_GY_ODR LSM6DSO_GY_ODR_6667Hz
+#define SAMPLER_SAMPLE_PERIOD_NS 149993
+#else
+// Sample period, timed by GPT3 at 1 MHz.  Every period one gyroscope + accelerometer read is
+// started from the timer interrupt, so the read times do not depend on what runs on the A7.
+// The sensor runs at twice the read rate, so the registers are never more than half a period old.
+#define SAMPLER_PERIOD_US 2400
+#define SAMPLER_XL_ODR LSM6DSO_XL_ODR_833Hz
+#define SAMPLER_GY_ODR LSM6DSO_GY_ODR_833Hz
+#define SAMPLER_SAMPLE_PERIOD_NS (SAMPLER_PERIOD_US * 1000)
+#endif
+
+// Full scale, must match one of the settings in the full scale tables in main.c
+#define SAMPLER_ACCEL_FULL_SCALE_G 4
+#define SAMPLER_GYRO_FULL_SCALE_DPS 2000
+
+// Samples per telemetry frame sent to the high-level app, and the number of frames that can wait for
+// the main loop before the interrupt has to drop samples
+#define SAMPLER_BATCH_SAMPLES 32
+#define SAMPLER_BATCH_QUEUE 4
+
+// Component ID of the high-level app (HighLevelApp/app_manifest.json) the frames are sent to
+#define HIGH_LEVEL_APP_COMPONENT_ID { 0x685f13af, 0x25a5, 0x40b2, { 0x8d, 0xd8, 0x8c, 0xbc, 0x25, 0x3e, 0xcb, 0xd8 } }
+
+// Analog inputs (current clamp, thermistor, humidity) captured continuously next to the IMU.  The ADC
+// scans ADC_CAPTURE_CHANNELS (bit n = ADC channel n) ADC_CAPTURE_SCAN_HZ times per second in periodic
+// mode and DMA moves the readings into a ring in SYSRAM, so the CPU only runs when the DMA interrupt
+// hands over three quarters of the ring.  Every ADC_CAPTURE_DECIMATION scans are averaged into one
+// row, and blocks of ADC_CAPTURE_BLOCK_ROWS rows are sent to the high-level app.  At 8 kHz with a
+// decimation of 8 that is 1 kHz per channel and one message every 32 ms.  Comment out
+// ADC_CAPTURE_ENABLE to leave the ADC alone.
+#define ADC_CAPTURE_ENABLE
+#define ADC_CAPTURE_CHANNELS 0x07
+#define ADC_CAPTURE_SCAN_HZ 8000
+#define ADC_CAPTURE_DECIMATION 8
+#define ADC_CAPTURE_BLOCK_ROWS 32
+#define ADC_CAPTURE_VREF_MV 2500
+
+// Entries in the DMA ring, a power of two.  The interrupt comes every 3/4 of it: 192 entries, or 8 ms
+// of three channels at 8 kHz.
+#define ADC_CAPTURE_DMA_ENTRIES 256
+
+// Profiling.  The sampler interrupts, the ADC callback and the main loop record spans and counters,
+// timestamped from GPT4 free-running at the CPU clock, into a RAM ring (int/trace.h).  Every
+// TRACE_REPORT_PERIOD_MS the main loop sends the min/mean/max of every trace point and the newest
+// TRACE_REPORT_EVENTS events to the high-level app, which logs them.  Comment out TRACE_ENABLE to
+// compile the trace points out.
+#define TRACE_ENABLE
+#define TRACE_RING_EVENTS 256
+#define TRACE_REPORT_EVENTS 32
+#define TRACE_REPORT_PERIOD_MS 1000
+
+// Log on the real-time core's debug UART.  Call sites only queue a format ID and up to four raw
+// arguments (int/uart_log.h), the main loop sends the records as binary when the UART is idle and
+// RT-App-Development/rt_log_decode.py turns them back into text.  Comment out UART_LOG_ENABLE to
+// compile the log calls out.
+#define UART_LOG_ENABLE
+#define UART_LOG_BAUD 115200
+#define UART_LOG_RING_ENTRIES 64
@@ -0,0 +1,172 @@
+#include "adc_capture.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ADC.h"
+
+#include "../build_options.h"
+#include "intercore.h"
+#include "intercore_message.h"
+#include "trace.h"
+#include "uart_log.h"
+
+// The MT3620 ADC has 8 channels, which sizes the rows
+#define ADC_CHANNELS_MAX 8
+
+// Blocks: one filled by the interrupt while the main loop sends the other
+#define ADC_CAPTURE_QUEUE 2
+
+#if (ADC_CAPTURE_DMA_ENTRIES & (ADC_CAPTURE_DMA_ENTRIES - 1)) != 0
+#error "ADC_CAPTURE_DMA_ENTRIES must be a power of two"
+#endif
+
+typedef struct {
+    uint32_t firstIndex;
+    uint16_t count;
+    uint8_t payload[INTERCORE_ADC_BLOCK_SIZE(ADC_CAPTURE_BLOCK_ROWS, ADC_CHANNELS_MAX)];
+} AdcBlock;
+
+// The DMA cannot reach TCM
+static uint32_t dmaRing[ADC_CAPTURE_DMA_ENTRIES] __attribute__((section(".sysram")));
+static ADC_Data readings[ADC_CAPTURE_DMA_ENTRIES];
+
+static AdcContext *adc = NULL;
+static uint8_t channelCount = 0;
+static int8_t columns[16];      // position of each channel in a row, -1 if not captured
+static uint8_t lastChannel = 0; // highest channel, its reading ends a scan
+
+// Running sums of the current row, written by the DMA interrupt only
+static uint32_t sums[ADC_CHANNELS_MAX];
+static uint16_t counts[ADC_CHANNELS_MAX];
+static uint16_t scans = 0;
+static uint32_t rowIndex = 0;
+
+// Same single producer single consumer scheme as the IMU batches in main.c
+static AdcBlock blocks[ADC_CAPTURE_QUEUE];
+static volatile uint32_t blockHead = 0;
+static volatile uint32_t blockTail = 0;
+static bool filling = false;
+static volatile uint32_t droppedRows = 0;
+
+/* helpers */
+static void PutLe16(uint8_t *p, uint16_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static void AddRow(void)
+{
+    uint32_t index = rowIndex++;
+
+    AdcBlock *block = &blocks[blockHead % ADC_CAPTURE_QUEUE];
+    if (!filling) {
+        if (blockHead - blockTail == ADC_CAPTURE_QUEUE) {
+            // The row index still advances, the high-level app sees the gap
+            droppedRows++;
+            return;
+        }
+        block->firstIndex = index;
+        block->count = 0;
+        filling = true;
+    }
+
+    // Mean in 1/16 LSB, written straight into the message payload
+    uint8_t *row = &block->payload[INTERCORE_ADC_BLOCK_SIZE(block->count, channelCount)];
+    for (int column = 0; column < channelCount; column++) {
+        uint16_t mean = counts[column] == 0 ? 0 : (uint16_t)((sums[column] * 16 + counts[column] / 2) / counts[column]);
+        PutLe16(&row[2 * column], mean);
+    }
+
+    if (++block->count == ADC_CAPTURE_BLOCK_ROWS) {
+        __sync_synchronize();
+        blockHead = blockHead + 1;
+        filling = false;
+    }
+}
+
+static void OnAdcData(int32_t count)
+{
+    uint32_t start = Trace_Now();
+    Trace_Count(INTERCORE_TRACE_ADC_READINGS, (uint32_t)count);
+
+    for (int32_t i = 0; i < count; i++) {
+        uint32_t channel = readings[i].channel & 0xF;
+        int8_t column = columns[channel];
+        if (column < 0) {
+            continue;
+        }
+        sums[column] += readings[i].value;
+        counts[column]++;
+
+        if (channel != lastChannel || ++scans < ADC_CAPTURE_DECIMATION) {
+            continue;
+        }
+
+        AddRow();
+        for (int c = 0; c < channelCount; c++) {
+            sums[c] = 0;
+            counts[c] = 0;
+        }
+        scans = 0;
+    }
+    Trace_Span(INTERCORE_TRACE_ADC_DMA, start);
+}
+
+/* declarations */
+int AdcCapture_Start(void)
+{
+    for (int channel = 0; channel < 16; channel++) {
+        columns[channel] = -1;
+        if (ADC_CAPTURE_CHANNELS & (1U << channel)) {
+            columns[channel] = (int8_t)channelCount++;
+            lastChannel = (uint8_t)channel;
+        }
+    }
+    if (channelCount == 0 || channelCount > ADC_CHANNELS_MAX) {
+        return -1;
+    }
+
+    adc = ADC_Open(MT3620_UNIT_ADC0);
+    if (!adc) {
+        return -1;
+    }
+
+    if (ADC_ReadPeriodicAsync(adc, OnAdcData, ADC_CAPTURE_DMA_ENTRIES, readings, dmaRing, ADC_CAPTURE_CHANNELS,
+                              ADC_CAPTURE_SCAN_HZ, ADC_CAPTURE_VREF_MV) != ERROR_NONE) {
+        ADC_Close(adc);
+        adc = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void AdcCapture_SendBlocks(void)
+{
+    if (blockTail == blockHead) {
+        return;
+    }
+
+    uint32_t start = Trace_Now();
+    while (blockTail != blockHead) {
+        AdcBlock *block = &blocks[blockTail % ADC_CAPTURE_QUEUE];
+
+        IntercoreAdcBlock header = {
+            .firstIndex = block->firstIndex,
+            .periodUs = 1000000U * ADC_CAPTURE_DECIMATION / ADC_CAPTURE_SCAN_HZ,
+            .channelMask = ADC_CAPTURE_CHANNELS,
+            .count = block->count,
+        };
+        IntercoreMessage_EncodeAdcBlock(block->payload, sizeof(block->payload), &header);
+        if (Intercore_Send(INTERCORE_MESSAGE_ADC_BLOCK, block->payload,
+                           INTERCORE_ADC_BLOCK_SIZE(block->count, channelCount)) != 0) {
+            droppedRows += block->count;
+            UART_LOG2(UART_LOG_ADC_DROPPED, block->count, block->firstIndex);
+        }
+
+        __sync_synchronize();
+        blockTail = blockTail + 1;
+    }
+    Trace_Span(INTERCORE_TRACE_SEND_ADC, start);
+}
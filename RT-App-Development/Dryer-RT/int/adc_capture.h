@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+* Continuous ADC capture.  The ADC runs in periodic mode and DMA fills a ring, the DMA interrupt
+* averages the readings into rows and fills one block while the main loop sends the other.
+* Configured in build_options.h.
+*/
+
+/// <summary>
+/// <para>Opens the ADC and starts the periodic conversions.  The ADC driver borrows GPT3 for its
+/// startup delay, so call this before GPT3 is opened for anything else.</para>
+/// </summary>
+/// <returns>0 on success, or -1 on failure.</returns>
+int AdcCapture_Start(void);
+
+/// <summary>
+/// <para>Sends the completed blocks to the high-level app.  Call from the main loop, the doorbell
+/// is left to Intercore_Notify.</para>
+/// </summary>
+void AdcCapture_SendBlocks(void);
@@ -0,0 +1,49 @@
+#include "i2c_lsm6dso.h"
+
+#include <string.h>
+
+#include "../build_options.h"
+
+// Transfers over the 8 byte I2C FIFOs go through DMA, which cannot reach TCM.  Everything the I2C
+// block reads or writes therefore lives in SYSRAM.
+#define LSM6DSO_BOUNCE_SIZE 32
+
+static uint8_t bounce[LSM6DSO_BOUNCE_SIZE + 1] __attribute__((section(".sysram")));
+static uint8_t outputsRegister __attribute__((section(".sysram")));
+static I2C_Transfer outputsTransfer[2];
+
+/* declarations */
+int32_t platform_write(void *handle, uint8_t Reg, const uint8_t *Bufp, uint16_t len)
+{
+    if (len > LSM6DSO_BOUNCE_SIZE) {
+        return ERROR_PARAMETER;
+    }
+
+    // Register address and data in one write, the address auto-increments
+    bounce[0] = Reg;
+    memcpy(&bounce[1], Bufp, len);
+    return I2CMaster_WriteSync(handle, LSM6DSO_I2C_ADDRESS, bounce, (uintptr_t)len + 1);
+}
+
+int32_t platform_read(void *handle, uint8_t Reg, uint8_t *Bufp, uint16_t len)
+{
+    if (len > LSM6DSO_BOUNCE_SIZE) {
+        return ERROR_PARAMETER;
+    }
+
+    bounce[0] = Reg;
+    int32_t error = I2CMaster_WriteThenReadSync(handle, LSM6DSO_I2C_ADDRESS, bounce, 1, &bounce[1], len);
+    if (error == ERROR_NONE) {
+        memcpy(Bufp, &bounce[1], len);
+    }
+    return error;
+}
+
+int32_t LSM6DSO_ReadOutputsAsync(I2CMaster *handle, uint8_t *outputs, void (*callback)(int32_t status, uintptr_t count))
+{
+    // The driver keeps a pointer to the transfer list until the callback
+    outputsRegister = 0x22; // OUTX_L_G
+    outputsTransfer[0] = (I2C_Transfer){ .writeData = &outputsRegister, .length = 1 };
+    outputsTransfer[1] = (I2C_Transfer){ .readData = outputs, .length = LSM6DSO_OUTPUTS_SIZE };
+    return I2CMaster_TransferSequentialAsync(handle, LSM6DSO_I2C_ADDRESS, outputsTransfer, 2, callback);
+}
@@ -1,5 +1,28 @@
+#pragma once
+
 #include <stdint.h>
 
+#include "I2CMaster.h"
+
+// Number of bytes read by LSM6DSO_ReadOutputsAsync: gyroscope X, Y, Z then accelerometer X, Y, Z
+#define LSM6DSO_OUTPUTS_SIZE 12
+// Bytes an outputs read moves: the register address, then the outputs
+#define LSM6DSO_OUTPUTS_TRANSFER_SIZE (1 + LSM6DSO_OUTPUTS_SIZE)
+
+// Register access for the lsm6dso driver, the handle is the I2CMaster of the sensor.  These block
+// until the transfer is done and are meant for configuration, before sampling starts.
 int32_t platform_write(void *handle, uint8_t Reg, const uint8_t *Bufp, uint16_t len);
 
-int32_t platform_read(void *handle, uint8_t Reg, uint8_t *Bufp, uint16_t len);
\ No newline at end of file
+int32_t platform_read(void *handle, uint8_t Reg, uint8_t *Bufp, uint16_t len);
+
+/// <summary>
+/// <para>Starts one auto-increment read of OUTX_L_G through OUTZ_H_A.  The callback runs in the
+/// I2C interrupt once the bytes are in outputs.</para>
+/// </summary>
+/// <param name="handle">I2CMaster of the sensor.</param>
+/// <param name="outputs">LSM6DSO_OUTPUTS_SIZE bytes in SYSRAM (the read goes through DMA), must stay
+/// valid until the callback.</param>
+/// <param name="callback">Called with the transfer status and the byte count of the whole sequence,
+/// the register address write included: LSM6DSO_OUTPUTS_TRANSFER_SIZE on success.</param>
+/// <returns>ERROR_NONE on success or an error code.</returns>
+int32_t LSM6DSO_ReadOutputsAsync(I2CMaster *handle, uint8_t *outputs, void (*callback)(int32_t status, uintptr_t count));
@@ -0,0 +1,145 @@
+#include "intercore.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "MBox.h"
+#include "intercore_message.h"
+
+// Mailbox commands the A7 uses to hand over the shared buffers, followed by the end command
+#define INTERCORE_OUTBOUND_BUFFER 0xba5e0001
+#define INTERCORE_INBOUND_BUFFER  0xba5e0002
+#define INTERCORE_END_OF_BUFFERS  0xba5e0003
+
+// SW interrupt port that tells the A7 there is new data in the outbound buffer
+#define INTERCORE_PORT_DATA_AVAILABLE 1
+
+// Block positions are kept aligned to this, and a full buffer keeps this much free so that a full
+// buffer is not mistaken for an empty one
+#define INTERCORE_ALIGNMENT 16
+
+// Shared buffer header.  The A7 writes the read position of our outbound buffer in the header of
+// the inbound buffer.
+typedef struct {
+    volatile uint32_t writePosition;
+    volatile uint32_t readPosition;
+    uint32_t reserved[14];
+} BufferHeader;
+
+// Every message starts with the component ID of the receiver and a reserved word
+typedef struct {
+    Intercore_ComponentId destination;
+    uint32_t reserved;
+} MessageHeader;
+
+static MBox *mbox = NULL;
+static BufferHeader *outbound = NULL;
+static BufferHeader *inbound = NULL;
+static uint32_t bufferSize = 0;
+static MessageHeader messageHeader;
+static uint32_t sequence = 0;
+static bool notifyPending = false;
+
+/* helpers */
+static BufferHeader *DecodeBuffer(uint32_t descriptor, uint32_t *size)
+{
+    // Base address in the upper bits, log2 of the size including the header in the low 5 bits
+    *size = (1U << (descriptor & 0x1F)) - sizeof(BufferHeader);
+    return (BufferHeader *)(uintptr_t)(descriptor & ~0x1FU);
+}
+
+static uint32_t RoundUp(uint32_t value)
+{
+    return (value + INTERCORE_ALIGNMENT - 1) & ~(uint32_t)(INTERCORE_ALIGNMENT - 1);
+}
+
+static uint32_t Write(uint32_t position, const void *data, uint32_t length)
+{
+    uint8_t *area = (uint8_t *)(outbound + 1);
+    uint32_t first = bufferSize - position;
+    if (first > length) {
+        first = length;
+    }
+    memcpy(&area[position], data, first);
+    memcpy(area, (const uint8_t *)data + first, length - first);
+
+    position += length;
+    return position >= bufferSize ? position - bufferSize : position;
+}
+
+/* declarations */
+int Intercore_Init(const Intercore_ComponentId *destination)
+{
+    mbox = MBox_FIFO_Open(MT3620_UNIT_MBOX_CA7, NULL, NULL, NULL, NULL, -1, -1);
+    if (!mbox) {
+        return -1;
+    }
+
+    // Blocks until the high-level app has connected
+    uint32_t outboundSize = 0, inboundSize = 0;
+    for (;;) {
+        uint32_t cmd, data;
+        MBox_FIFO_ReadSync(mbox, &cmd, &data, 1);
+        if (cmd == INTERCORE_OUTBOUND_BUFFER) {
+            outbound = DecodeBuffer(data, &outboundSize);
+        } else if (cmd == INTERCORE_INBOUND_BUFFER) {
+            inbound = DecodeBuffer(data, &inboundSize);
+        } else if (cmd == INTERCORE_END_OF_BUFFERS) {
+            break;
+        }
+    }
+
+    if (!outbound || !inbound || outboundSize != inboundSize) {
+        outbound = inbound = NULL;
+        return -1;
+    }
+    bufferSize = outboundSize;
+
+    messageHeader = (MessageHeader){ .destination = *destination };
+    return 0;
+}
+
+int Intercore_Send(uint16_t type, const void *payload, uint16_t length)
+{
+    if (!outbound) {
+        return -1;
+    }
+
+    uint8_t header[INTERCORE_MESSAGE_HEADER_SIZE];
+    IntercoreMessage_EncodeHeader(header, sizeof(header),
+        &(IntercoreMessageHeader){ .sequence = sequence++, .type = type, .payloadSize = length });
+
+    uint32_t writePosition = outbound->writePosition;
+    uint32_t readPosition = inbound->readPosition;
+    uint32_t used = writePosition >= readPosition
+        ? writePosition - readPosition
+        : bufferSize - readPosition + writePosition;
+
+    uint32_t messageLength = sizeof(MessageHeader) + sizeof(header) + length;
+    uint32_t blockSize = RoundUp(sizeof(uint32_t) + messageLength);
+    if (used + blockSize > bufferSize - INTERCORE_ALIGNMENT) {
+        return -1;
+    }
+
+    uint32_t position = Write(writePosition, &messageLength, sizeof(messageLength));
+    position = Write(position, &messageHeader, sizeof(messageHeader));
+    position = Write(position, header, sizeof(header));
+    Write(position, payload, length);
+
+    // Publish the block only once its contents are in memory
+    __sync_synchronize();
+    writePosition += blockSize;
+    outbound->writePosition = writePosition >= bufferSize ? writePosition - bufferSize : writePosition;
+
+    notifyPending = true;
+    return 0;
+}
+
+void Intercore_Notify(void)
+{
+    if (notifyPending) {
+        notifyPending = false;
+        MBox_SW_Interrupt_Trigger(mbox, INTERCORE_PORT_DATA_AVAILABLE);
+    }
+}
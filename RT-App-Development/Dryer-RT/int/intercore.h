@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+* Messages from the real-time core to a high-level app, over the shared buffers the A7 sets up for
+* the application connection.  The high-level app reads them from the socket it gets from
+* Application_Connect.
+*
+* Messages are written straight into the shared buffer with an IntercoreMessageHeader
+* (HighLevelApp/intercore_message.h) in front.  The A7 is only interrupted by Intercore_Notify, so a
+* batch of messages costs one doorbell.
+*/
+
+// Component ID of the app on the other side, as in its app_manifest.json
+typedef struct {
+    uint32_t data1;
+    uint16_t data2;
+    uint16_t data3;
+    uint8_t data4[8];
+} Intercore_ComponentId;
+
+/// <summary>
+/// <para>Waits for the A7 to hand over the shared buffers.  Call once before sending.</para>
+/// </summary>
+/// <param name="destination">The high-level app the messages are sent to.</param>
+/// <returns>0 on success, or -1 if the mailbox could not be opened.</returns>
+int Intercore_Init(const Intercore_ComponentId *destination);
+
+/// <summary>
+/// <para>Writes one message into the outbound buffer.  The A7 sees it after the next
+/// Intercore_Notify.  A message that does not fit still uses up a sequence number, so the
+/// high-level app can count the dropped ones.</para>
+/// </summary>
+/// <param name="type">IntercoreMessageType of the payload.</param>
+/// <returns>0 on success, or -1 if the buffer is full or not set up.</returns>
+int Intercore_Send(uint16_t type, const void *payload, uint16_t length);
+
+/// <summary>
+/// <para>Rings the doorbell once for everything sent since the last call.</para>
+/// </summary>
+void Intercore_Notify(void);
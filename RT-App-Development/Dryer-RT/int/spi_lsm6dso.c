@@ -0,0 +1,70 @@
+#include "spi_lsm6dso.h"
+
+#include <string.h>
+
+// The first byte of every transaction is the register address, with this bit set for a read.  The
+// address auto-increments, and from FIFO_DATA_OUT_Z_H it wraps back to FIFO_DATA_OUT_TAG, so
+// consecutive FIFO words come out of one read.
+#define LSM6DSO_SPI_READ 0x80
+#define LSM6DSO_FIFO_STATUS1 0x3A
+#define LSM6DSO_FIFO_DATA_OUT_TAG 0x78
+
+// A write goes out in one transaction with its address, which the SPI block limits to this
+#define LSM6DSO_SPI_WRITE_MAX 16
+
+static const uint8_t fifoStatusAddress = LSM6DSO_FIFO_STATUS1 | LSM6DSO_SPI_READ;
+static const uint8_t fifoDataAddress = LSM6DSO_FIFO_DATA_OUT_TAG | LSM6DSO_SPI_READ;
+
+// The driver keeps a pointer to the transfer list until the callback: an address write and a read
+// per transaction
+static SPITransfer statusTransfer[2];
+static SPITransfer fifoTransfer[2 * (LSM6DSO_FIFO_WORDS_PER_READ / LSM6DSO_FIFO_WORDS_PER_TRANSACTION)];
+
+/* declarations */
+int32_t platform_spi_write(void *handle, uint8_t Reg, const uint8_t *Bufp, uint16_t len)
+{
+    if (len > LSM6DSO_SPI_WRITE_MAX) {
+        return ERROR_PARAMETER;
+    }
+
+    uint8_t command[LSM6DSO_SPI_WRITE_MAX + 1];
+    command[0] = Reg;
+    memcpy(&command[1], Bufp, len);
+    return SPIMaster_WriteSync(handle, command, (uintptr_t)len + 1);
+}
+
+int32_t platform_spi_read(void *handle, uint8_t Reg, uint8_t *Bufp, uint16_t len)
+{
+    uint8_t address = Reg | LSM6DSO_SPI_READ;
+    return SPIMaster_WriteThenReadSync(handle, &address, 1, Bufp, len);
+}
+
+int32_t LSM6DSO_ReadFifoStatusAsync(SPIMaster *handle, uint8_t *status, void (*callback)(int32_t status, uintptr_t count))
+{
+    statusTransfer[0] = (SPITransfer){ .writeData = &fifoStatusAddress, .length = 1 };
+    statusTransfer[1] = (SPITransfer){ .readData = status, .length = LSM6DSO_FIFO_STATUS_SIZE };
+    return SPIMaster_TransferSequentialAsync(handle, statusTransfer, 2, callback);
+}
+
+int32_t LSM6DSO_ReadFifoAsync(SPIMaster *handle, uint8_t *words, uint16_t wordCount,
+                              void (*callback)(int32_t status, uintptr_t count))
+{
+    if (wordCount == 0 || wordCount > LSM6DSO_FIFO_WORDS_PER_READ) {
+        return ERROR_PARAMETER;
+    }
+
+    // One chip select per LSM6DSO_FIFO_WORDS_PER_TRANSACTION words, all queued in one go so the
+    // driver runs them back to back from its interrupt
+    uint32_t count = 0;
+    for (uint16_t word = 0; word < wordCount; word += LSM6DSO_FIFO_WORDS_PER_TRANSACTION) {
+        uint16_t chunk = wordCount - word;
+        if (chunk > LSM6DSO_FIFO_WORDS_PER_TRANSACTION) {
+            chunk = LSM6DSO_FIFO_WORDS_PER_TRANSACTION;
+        }
+        fifoTransfer[count++] = (SPITransfer){ .writeData = &fifoDataAddress, .length = 1 };
+        fifoTransfer[count++] = (SPITransfer){
+            .readData = &words[word * LSM6DSO_FIFO_WORD_SIZE], .length = chunk * LSM6DSO_FIFO_WORD_SIZE
+        };
+    }
+    return SPIMaster_TransferSequentialAsync(handle, fifoTransfer, count, callback);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "SPIMaster.h"
+
+// One FIFO word: the tag, then X, Y and Z of the sensor the tag names
+#define LSM6DSO_FIFO_WORD_SIZE 7
+
+// FIFO words drained by one LSM6DSO_ReadFifoAsync.  The SPI block moves at most 32 bytes per chip
+// select, so every 4 words are one transaction, and the driver chains up to 16 of them.
+#define LSM6DSO_FIFO_WORDS_PER_TRANSACTION 4
+#define LSM6DSO_FIFO_WORDS_PER_READ 64
+
+// FIFO_STATUS1 and FIFO_STATUS2, read by LSM6DSO_ReadFifoStatusAsync
+#define LSM6DSO_FIFO_STATUS_SIZE 2
+
+// Register access for the lsm6dso driver over SPI, the handle is the SPIMaster of the sensor.  Same
+// interface as the I2C ones in i2c_lsm6dso.h, they block until the transfer is done and are meant
+// for configuration, before sampling starts.
+int32_t platform_spi_write(void *handle, uint8_t Reg, const uint8_t *Bufp, uint16_t len);
+
+int32_t platform_spi_read(void *handle, uint8_t Reg, uint8_t *Bufp, uint16_t len);
+
+/// <summary>
+/// <para>Starts a read of FIFO_STATUS1 and FIFO_STATUS2.  The callback runs in the SPI interrupt
+/// once the bytes are in status.</para>
+/// </summary>
+/// <param name="handle">SPIMaster of the sensor.</param>
+/// <param name="status">LSM6DSO_FIFO_STATUS_SIZE bytes, must stay valid until the callback.</param>
+/// <param name="callback">Called with the transfer status and byte count.</param>
+/// <returns>ERROR_NONE on success or an error code.</returns>
+int32_t LSM6DSO_ReadFifoStatusAsync(SPIMaster *handle, uint8_t *status, void (*callback)(int32_t status, uintptr_t count));
+
+/// <summary>
+/// <para>Starts one DMA driven read of FIFO words.  The callback runs in the SPI interrupt once all
+/// of them are in words.</para>
+/// </summary>
+/// <param name="handle">SPIMaster of the sensor.</param>
+/// <param name="words">wordCount * LSM6DSO_FIFO_WORD_SIZE bytes, must stay valid until the
+/// callback.</param>
+/// <param name="wordCount">Words to read, 1 to LSM6DSO_FIFO_WORDS_PER_READ.</param>
+/// <param name="callback">Called with the transfer status and byte count.</param>
+/// <returns>ERROR_NONE on success or an error code.</returns>
+int32_t LSM6DSO_ReadFifoAsync(SPIMaster *handle, uint8_t *words, uint16_t wordCount,
+                              void (*callback)(int32_t status, uintptr_t count));
+
+/// <summary>
+/// <para>Number of unread FIFO words in a status read by LSM6DSO_ReadFifoStatusAsync.</para>
+/// </summary>
+static inline uint16_t LSM6DSO_FifoLevel(const uint8_t *status)
+{
+    return (uint16_t)(status[0] | ((status[1] & 0x03) << 8));
+}
+
+/// <summary>
+/// <para>Whether the FIFO overwrote words since the previous status read (FIFO_OVR_LATCHED).</para>
+/// </summary>
+static inline bool LSM6DSO_FifoOverrun(const uint8_t *status)
+{
+    return (status[1] & 0x08) != 0;
+}
@@ -0,0 +1,129 @@
+#include "trace.h"
+
+#ifdef TRACE_ENABLE
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "CPUFreq.h"
+#include "GPT.h"
+
+#include "intercore.h"
+
+#if (TRACE_RING_EVENTS & (TRACE_RING_EVENTS - 1)) != 0
+#error "TRACE_RING_EVENTS must be a power of two"
+#endif
+
+#if TRACE_REPORT_EVENTS > TRACE_RING_EVENTS
+#error "TRACE_REPORT_EVENTS must not be larger than TRACE_RING_EVENTS"
+#endif
+
+static GPT *traceClock = NULL;
+static uint32_t clockHz = 0;
+
+// Written with the interrupts blocked, so the interrupts and the main loop can all record.  Reports
+// carry the newest events, the whole ring can be read with the debugger.
+static IntercoreTraceEvent ring[TRACE_RING_EVENTS];
+static uint32_t eventCount = 0; // events recorded since the start, the next one goes in ring[eventCount % TRACE_RING_EVENTS]
+static IntercoreTraceStats stats[INTERCORE_TRACE_POINT_COUNT];
+
+static uint32_t lastReport = 0;
+static uint8_t report[INTERCORE_TRACE_REPORT_SIZE(INTERCORE_TRACE_POINT_COUNT, TRACE_REPORT_EVENTS)];
+
+/* helpers */
+// PRIMASK rather than NVIC_BlockIRQs: with three priority bits a BASEPRI of 1 masks nothing
+static inline uint32_t BlockInterrupts(void)
+{
+    uint32_t primask;
+    __asm__ volatile("mrs %0, PRIMASK\n\tcpsid i" : "=r"(primask) : : "memory");
+    return primask;
+}
+
+static inline void RestoreInterrupts(uint32_t primask)
+{
+    __asm__ volatile("msr PRIMASK, %0" : : "r"(primask) : "memory");
+}
+
+static void Record(IntercoreTracePoint point, IntercoreTraceKind kind, uint32_t timestamp, uint32_t value)
+{
+    if ((unsigned)point >= INTERCORE_TRACE_POINT_COUNT) {
+        return;
+    }
+
+    uint32_t primask = BlockInterrupts();
+
+    ring[eventCount++ % TRACE_RING_EVENTS] = (IntercoreTraceEvent){
+        .timestamp = timestamp, .value = value, .point = (uint16_t)point, .kind = (uint16_t)kind
+    };
+
+    IntercoreTraceStats *s = &stats[point];
+    if (s->count == 0 || value < s->min) {
+        s->min = value;
+    }
+    if (value > s->max) {
+        s->max = value;
+    }
+    s->kind = (uint16_t)kind;
+    s->count++;
+    s->total += value;
+
+    RestoreInterrupts(primask);
+}
+
+/* declarations */
+int Trace_Init(void)
+{
+    // The fast setting of GPT4 is the CPU clock
+    traceClock = GPT_Open(MT3620_UNIT_GPT4, (float)CPUFreq_Get(), GPT_MODE_NONE);
+    float speedHz = 0.0f;
+    if (!traceClock || GPT_GetSpeed(traceClock, &speedHz) != ERROR_NONE
+        || GPT_Start_Freerun(traceClock) != ERROR_NONE) {
+        return -1;
+    }
+
+    clockHz = (uint32_t)speedHz;
+    lastReport = Trace_Now();
+    return 0;
+}
+
+void Trace_Span(IntercoreTracePoint point, uint32_t start)
+{
+    Record(point, INTERCORE_TRACE_SPAN, start, Trace_Now() - start);
+}
+
+void Trace_Count(IntercoreTracePoint point, uint32_t value)
+{
+    Record(point, INTERCORE_TRACE_COUNTER, Trace_Now(), value);
+}
+
+void Trace_SendReport(void)
+{
+    uint32_t now = Trace_Now();
+    if (!traceClock || now - lastReport < clockHz / 1000 * TRACE_REPORT_PERIOD_MS) {
+        return;
+    }
+    lastReport = now;
+
+    IntercoreTraceReport header = { .clockHz = clockHz, .pointCount = INTERCORE_TRACE_POINT_COUNT };
+
+    // Copy out and start over in one go, so every report covers the time since the previous one
+    uint32_t primask = BlockInterrupts();
+
+    header.eventCount = (uint16_t)(eventCount < TRACE_REPORT_EVENTS ? eventCount : TRACE_REPORT_EVENTS);
+    header.firstEvent = eventCount - header.eventCount;
+    for (uint16_t i = 0; i < header.eventCount; i++) {
+        IntercoreMessage_EncodeTraceEvent(report, &header, i, &ring[(header.firstEvent + i) % TRACE_RING_EVENTS]);
+    }
+    for (uint16_t point = 0; point < INTERCORE_TRACE_POINT_COUNT; point++) {
+        stats[point].point = point;
+        IntercoreMessage_EncodeTraceStats(report, point, &stats[point]);
+        stats[point] = (IntercoreTraceStats){ .point = point };
+    }
+
+    RestoreInterrupts(primask);
+
+    IntercoreMessage_EncodeTraceReport(report, sizeof(report), &header);
+    Intercore_Send(INTERCORE_MESSAGE_TRACE, report, INTERCORE_TRACE_REPORT_SIZE(header.pointCount, header.eventCount));
+}
+
+#endif
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "mt3620/gpt.h"
+
+#include "../build_options.h"
+#include "intercore_message.h"
+
+/*
+* Cycle counting profiler.  Trace points record spans (a start time and a length) and counters (a
+* value) into a RAM ring and into per point min/max/total stats.  Timestamps come from GPT4, which
+* counts up at the CPU clock and wraps after about 20 s at 197.6 MHz, so spans are only meaningful
+* when they are shorter than that.  Safe to call from the interrupts and the main loop.
+*
+* Without TRACE_ENABLE the calls are empty inline functions, so call sites need no #ifdef.
+*/
+
+#ifdef TRACE_ENABLE
+
+/// <summary>
+/// <para>Starts the trace clock.  Call once, before the interrupts that record spans are
+/// enabled.</para>
+/// </summary>
+/// <returns>0 on success, or -1 if GPT4 could not be opened.</returns>
+int Trace_Init(void);
+
+/// <summary>
+/// <para>Current trace clock, the start of a span.</para>
+/// </summary>
+static inline uint32_t Trace_Now(void)
+{
+    return mt3620_gpt->gpt4_cnt;
+}
+
+/// <summary>
+/// <para>Records a span from start to now.</para>
+/// </summary>
+void Trace_Span(IntercoreTracePoint point, uint32_t start);
+
+/// <summary>
+/// <para>Records a counter value.</para>
+/// </summary>
+void Trace_Count(IntercoreTracePoint point, uint32_t value);
+
+/// <summary>
+/// <para>Sends a trace report to the high-level app every TRACE_REPORT_PERIOD_MS and starts the
+/// stats over.  Call from the main loop, the doorbell is left to Intercore_Notify.</para>
+/// </summary>
+void Trace_SendReport(void);
+
+#else
+
+static inline int Trace_Init(void)
+{
+    return 0;
+}
+
+static inline uint32_t Trace_Now(void)
+{
+    return 0;
+}
+
+static inline void Trace_Span(IntercoreTracePoint point, uint32_t start)
+{
+    (void)point;
+    (void)start;
+}
+
+static inline void Trace_Count(IntercoreTracePoint point, uint32_t value)
+{
+    (void)point;
+    (void)value;
+}
+
+static inline void Trace_SendReport(void)
+{
+}
+
+#endif
@@ -0,0 +1,120 @@
+#include "uart_log.h"
+
+#ifdef UART_LOG_ENABLE
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "UART.h"
+
+#define UART_LOG_SYNC 0xA5
+#define UART_LOG_HEADER_SIZE 4
+
+// UART_Write only waits once its 256 byte buffer is full.  Sending at most this much, and only when
+// the UART is idle, keeps it from ever waiting.
+#define UART_LOG_CHUNK 240
+
+#if (UART_LOG_RING_ENTRIES & (UART_LOG_RING_ENTRIES - 1)) != 0
+#error "UART_LOG_RING_ENTRIES must be a power of two"
+#endif
+
+// published is the index of the record plus one once its contents are written, so the drain can
+// tell a finished slot from one a producer has claimed but not filled yet
+typedef struct {
+    volatile uint32_t published;
+    uint8_t format;
+    uint8_t argCount;
+    uint32_t args[UART_LOG_MAX_ARGS];
+} Record;
+
+static UART *uart = NULL;
+
+// Many producers (the interrupts and the main loop) one consumer (the drain).  A producer claims
+// writeIndex with a compare and swap, the drain only moves readIndex.
+static Record ring[UART_LOG_RING_ENTRIES];
+static volatile uint32_t writeIndex = 0;
+static volatile uint32_t readIndex = 0;
+static volatile uint32_t dropped = 0;
+static uint32_t droppedReported = 0;
+static uint8_t sequence = 0; // records sent, so the decoder can tell when bytes were lost on the line
+
+static uint8_t chunk[UART_LOG_CHUNK];
+
+/* helpers */
+static uint32_t Encode(uint8_t *p, uint8_t format, uint8_t argCount, const uint32_t *args)
+{
+    p[0] = UART_LOG_SYNC;
+    p[1] = format;
+    p[2] = argCount;
+    p[3] = sequence++;
+    for (uint32_t i = 0; i < argCount; i++) {
+        uint8_t *arg = &p[UART_LOG_HEADER_SIZE + 4 * i];
+        arg[0] = (uint8_t)args[i];
+        arg[1] = (uint8_t)(args[i] >> 8);
+        arg[2] = (uint8_t)(args[i] >> 16);
+        arg[3] = (uint8_t)(args[i] >> 24);
+    }
+    return UART_LOG_HEADER_SIZE + 4 * argCount;
+}
+
+/* declarations */
+int UartLog_Init(void)
+{
+    uart = UART_Open(MT3620_UNIT_UART_DEBUG, UART_LOG_BAUD, UART_PARITY_NONE, 1, NULL);
+    return uart ? 0 : -1;
+}
+
+void UartLog_Write(UartLogFormat format, uint32_t argCount, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3)
+{
+    uint32_t index = writeIndex;
+    do {
+        if (index - readIndex >= UART_LOG_RING_ENTRIES) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&writeIndex, &index, index + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    Record *record = &ring[index % UART_LOG_RING_ENTRIES];
+    record->format = (uint8_t)format;
+    record->argCount = (uint8_t)(argCount > UART_LOG_MAX_ARGS ? UART_LOG_MAX_ARGS : argCount);
+    record->args[0] = a0;
+    record->args[1] = a1;
+    record->args[2] = a2;
+    record->args[3] = a3;
+    __atomic_store_n(&record->published, index + 1, __ATOMIC_RELEASE);
+}
+
+void UartLog_Drain(void)
+{
+    if (!uart || !UART_IsWriteComplete(uart)) {
+        return;
+    }
+
+    uint32_t length = 0;
+    uint32_t index = readIndex;
+
+    // Drops are reported from here rather than from the producers, which had no room for a record
+    uint32_t droppedNow = dropped;
+    if (droppedNow != droppedReported) {
+        uint32_t count = droppedNow - droppedReported;
+        droppedReported = droppedNow;
+        length += Encode(&chunk[length], UART_LOG_DROPPED, 1, &count);
+    }
+
+    for (; length + UART_LOG_HEADER_SIZE + 4 * UART_LOG_MAX_ARGS <= sizeof(chunk); index++) {
+        Record *record = &ring[index % UART_LOG_RING_ENTRIES];
+        if (__atomic_load_n(&record->published, __ATOMIC_ACQUIRE) != index + 1) {
+            break;
+        }
+        length += Encode(&chunk[length], record->format, record->argCount, record->args);
+    }
+
+    // The slots are free for the producers again once their records are copied
+    __atomic_store_n(&readIndex, index, __ATOMIC_RELEASE);
+
+    if (length > 0) {
+        UART_Write(uart, chunk, length);
+    }
+}
+
+#endif
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "../build_options.h"
+#include "uart_log_formats.h"
+
+/*
+* Deferred binary log on the debug UART.  A log call copies a format ID and its arguments into a
+* ring, which takes a few tens of cycles and never waits, so it is fine in the interrupts.  The main
+* loop sends the queued records when the UART is idle, the text is put together on the host by
+* RT-App-Development/rt_log_decode.py.  When the ring is full the record is dropped and counted, the
+* count is logged once there is room again.
+*
+* Every record is 0xA5, the format ID, the argument count and the number of records sent before it
+* (one byte each), then the arguments as little-endian uint32.
+*
+* Without UART_LOG_ENABLE the calls are empty inline functions, so call sites need no #ifdef.
+*/
+
+typedef enum {
+#define UART_LOG_FORMAT_ID(name, text) name,
+    UART_LOG_FORMATS(UART_LOG_FORMAT_ID)
+#undef UART_LOG_FORMAT_ID
+    UART_LOG_FORMAT_COUNT
+} UartLogFormat;
+
+// Arguments a record can carry
+#define UART_LOG_MAX_ARGS 4
+
+#ifdef UART_LOG_ENABLE
+
+/// <summary>
+/// <para>Opens the debug UART.  Records logged before this are kept and sent once the main loop
+/// drains the ring.</para>
+/// </summary>
+/// <returns>0 on success, or -1 if the UART could not be opened.</returns>
+int UartLog_Init(void);
+
+/// <summary>
+/// <para>Queues one record.  Use the UART_LOG macros, they fill in the argument count.</para>
+/// </summary>
+void UartLog_Write(UartLogFormat format, uint32_t argCount, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3);
+
+/// <summary>
+/// <para>Sends queued records if the UART has finished the previous ones.  Call from the main
+/// loop, never blocks.</para>
+/// </summary>
+void UartLog_Drain(void);
+
+#else
+
+static inline int UartLog_Init(void)
+{
+    return 0;
+}
+
+static inline void UartLog_Write(UartLogFormat format, uint32_t argCount, uint32_t a0, uint32_t a1, uint32_t a2,
+                                 uint32_t a3)
+{
+    (void)format;
+    (void)argCount;
+    (void)a0;
+    (void)a1;
+    (void)a2;
+    (void)a3;
+}
+
+static inline void UartLog_Drain(void)
+{
+}
+
+#endif
+
+#define UART_LOG(format) UartLog_Write(format, 0, 0, 0, 0, 0)
+#define UART_LOG1(format, a) UartLog_Write(format, 1, (uint32_t)(a), 0, 0, 0)
+#define UART_LOG2(format, a, b) UartLog_Write(format, 2, (uint32_t)(a), (uint32_t)(b), 0, 0)
+#define UART_LOG3(format, a, b, c) UartLog_Write(format, 3, (uint32_t)(a), (uint32_t)(b), (uint32_t)(c), 0)
+#define UART_LOG4(format, a, b, c, d) \
+    UartLog_Write(format, 4, (uint32_t)(a), (uint32_t)(b), (uint32_t)(c), (uint32_t)(d))
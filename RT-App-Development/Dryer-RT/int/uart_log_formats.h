@@ -0,0 +1,19 @@
+#pragma once
+
+/*
+* Every message the real-time app logs.  The format ID sent on the UART is the position in this
+* list, so only add to the end.  rt_log_decode.py reads this file for the texts: keep one entry per
+* line, the arguments are 32-bit integers for %d, %u, %x or %c.
+*/
+#define UART_LOG_FORMATS(X) \
+    X(UART_LOG_DROPPED, "%u log records dropped, the ring was full") \
+    X(UART_LOG_STARTED, "Dryer-RT started, CPU clock %u Hz") \
+    X(UART_LOG_INTERCORE_FAILED, "Inter-core buffers not set up") \
+    X(UART_LOG_TRACE_FAILED, "Trace clock GPT4 not available") \
+    X(UART_LOG_SENSOR_FAILED, "LSM6DSO not set up") \
+    X(UART_LOG_ADC_FAILED, "ADC capture not started") \
+    X(UART_LOG_TIMER_FAILED, "Sample timer GPT3 not started") \
+    X(UART_LOG_SAMPLING, "Sampling every %u us, frames of %u samples") \
+    X(UART_LOG_READ_FAILED, "LSM6DSO read failed, status %d, %u bytes") \
+    X(UART_LOG_BATCH_DROPPED, "Frame of %u samples from tick %u not sent, inter-core buffer full") \
+    X(UART_LOG_ADC_DROPPED, "ADC block of %u rows from row %u not sent, inter-core buffer full")
@@ -1,56 +1,443 @@
-// Use this app to test the device and SDK installation succeeded, and that you
-// can deploy and debug applications on the real-time core.
+// Real-time IMU sampler.  The LSM6DSO outputs are read from a GPT3 interrupt at a fixed period and
+// sent to the high-level app as telemetry frames, so the sample times do not depend on the load
+// on the A7.  With LSM6DSO_SPI an external LSM6DSO on SPI fills its FIFO at 6.66 kHz instead, and
+// the interrupt drains the FIFO.  The analog inputs are captured alongside by the ADC and DMA
+// (int/adc_capture.c).
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
-extern uint32_t StackTop; // &StackTop == end of TCM
+#include "CPUFreq.h"
+#include "GPT.h"
+#include "I2CMaster.h"
+#include "SPIMaster.h"
+#include "VectorTable.h"
+#include "lsm6dso_reg.h"
 
-static const uintptr_t SCB_BASE = 0xE000ED00;
+#include "build_options.h"
+#include "int/adc_capture.h"
+#include "int/i2c_lsm6dso.h"
+#include "int/spi_lsm6dso.h"
+#include "int/intercore.h"
+#include "int/trace.h"
+#include "int/uart_log.h"
+#include "intercore_message.h"
+#include "telemetry_frame.h"
 
-static _Noreturn void DefaultExceptionHandler(void);
+// Gyroscope samples averaged for the zero-rate offset at startup
+#define CALIBRATION_SAMPLES 32
 
-static _Noreturn void RTCoreMain(void);
+// One telemetry frame.  The interrupt encodes every sample straight into the frame and the main loop
+// adds the header, so the frame is copied once, into the inter-core buffer.  sequence is the tick of
+// the first sample, the samples are from consecutive ticks.  A tick is a timer period, or a FIFO
+// sample with LSM6DSO_SPI.
+typedef struct {
+    uint32_t sequence;
+    uint16_t count;
+    uint8_t frame[TELEMETRY_FRAME_SIZE(SAMPLER_BATCH_SAMPLES)];
+} Batch;
 
-// ARM DDI0403E.d SB1.5.2-3
-// From SB1.5.3, "The Vector table must be naturally aligned to a power of two whose alignment
-// value is greater than or equal to (Number of Exceptions supported x 4), with a minimum alignment
-// of 128 bytes.". The array is aligned in linker.ld, using the dedicated section ".vector_table".
+// Full scale register settings, looked up by the values in build_options.h
+static const struct {
+    uint16_t g;
+    lsm6dso_fs_xl_t setting;
+} accelFullScales[] = { { 2, LSM6DSO_2g }, { 4, LSM6DSO_4g }, { 8, LSM6DSO_8g }, { 16, LSM6DSO_16g } };
 
-// The exception vector table contains a stack pointer, 15 exception handlers, and an entry for
-// each interrupt.
-#define INTERRUPT_COUNT 100 // from datasheet
-#define EXCEPTION_COUNT (16 + INTERRUPT_COUNT)
-#define INT_TO_EXC(i_) (16 + (i_))
-const uintptr_t ExceptionVectorTable[EXCEPTION_COUNT] __attribute__((section(".vector_table")))
-__attribute__((used)) = {
-    [0] = (uintptr_t)&StackTop,                // Main Stack Pointer (MSP)
-    [1] = (uintptr_t)RTCoreMain,               // Reset
-    [2] = (uintptr_t)DefaultExceptionHandler,  // NMI
-    [3] = (uintptr_t)DefaultExceptionHandler,  // HardFault
-    [4] = (uintptr_t)DefaultExceptionHandler,  // MPU Fault
-    [5] = (uintptr_t)DefaultExceptionHandler,  // Bus Fault
-    [6] = (uintptr_t)DefaultExceptionHandler,  // Usage Fault
-    [11] = (uintptr_t)DefaultExceptionHandler, // SVCall
-    [12] = (uintptr_t)DefaultExceptionHandler, // Debug monitor
-    [14] = (uintptr_t)DefaultExceptionHandler, // PendSV
-    [15] = (uintptr_t)DefaultExceptionHandler, // SysTick
+static const struct {
+    uint16_t dps;
+    lsm6dso_fs_g_t setting;
+} gyroFullScales[] = { { 125, LSM6DSO_125dps }, { 250, LSM6DSO_250dps }, { 500, LSM6DSO_500dps },
+                       { 1000, LSM6DSO_1000dps }, { 2000, LSM6DSO_2000dps } };
 
-    [INT_TO_EXC(0)... INT_TO_EXC(INTERRUPT_COUNT - 1)] = (uintptr_t)DefaultExceptionHandler};
+#ifdef LSM6DSO_SPI
+static SPIMaster *spi = NULL;
+static stmdev_ctx_t sensor = { .write_reg = platform_spi_write, .read_reg = platform_spi_read };
+#else
+static I2CMaster *i2c = NULL;
+static stmdev_ctx_t sensor = { .write_reg = platform_write, .read_reg = platform_read };
+#endif
+static int16_t gyroOffset[3];
 
-static _Noreturn void DefaultExceptionHandler(void)
+#ifdef LSM6DSO_SPI
+// Filled by the SPI interrupt
+static uint8_t fifoStatus[LSM6DSO_FIFO_STATUS_SIZE];
+static uint8_t fifoWords[LSM6DSO_FIFO_WORDS_PER_READ * LSM6DSO_FIFO_WORD_SIZE];
+
+// The gyroscope and accelerometer words of one sample arrive one after the other, the first one
+// waits here for the second.  fifoTick counts the samples taken from the FIFO.
+static uint8_t pendingGyro[6];
+static uint8_t pendingAccel[6];
+static bool hasGyro = false;
+static bool hasAccel = false;
+static uint32_t fifoTick = 0;
+static uint16_t fifoReadWords = 0;
+#else
+// Filled by the I2C interrupt, read by the DMA so it lives in SYSRAM
+static uint8_t outputs[LSM6DSO_OUTPUTS_SIZE] __attribute__((section(".sysram")));
+#endif
+
+// Written by the timer interrupt only
+static uint32_t tick = 0;
+static uint32_t readTick = 0;
+static uint32_t readStart = 0;
+static volatile bool reading = false;
+
+// Single producer (sensor bus interrupt) single consumer (main loop) queue of batches.  batchHead is
+// only advanced by the interrupt and batchTail only by the main loop, the slot at batchHead is the
+// batch being filled.
+static Batch batches[SAMPLER_BATCH_QUEUE];
+static volatile uint32_t batchHead = 0;
+static volatile uint32_t batchTail = 0;
+static bool filling = false;
+
+// Diagnostic counters, readable with the debugger
+static volatile uint32_t missedReads = 0;   // timer ticks skipped because the previous read was still busy
+static volatile uint32_t failedReads = 0;   // reads the bus driver refused or that ended in an error
+static volatile uint32_t droppedSamples = 0; // samples lost to a full batch queue or intercore buffer
+#ifdef LSM6DSO_SPI
+static volatile uint32_t fifoOverruns = 0;  // drains that found the sensor FIFO had overwritten words
+#endif
+
+/* helpers */
+static int16_t Le16(const uint8_t *bytes)
+{
+    return (int16_t)(bytes[0] | (bytes[1] << 8));
+}
+
+static void PublishBatch(void)
+{
+    // The samples must be in memory before the main loop can see the batch
+    __sync_synchronize();
+    batchHead = batchHead + 1;
+    filling = false;
+}
+
+// Adds the sample of sampleTick to the batch being filled.  gyro and accel are the little-endian
+// X, Y, Z output registers.
+static void AddSample(uint32_t sampleTick, const uint8_t *gyro, const uint8_t *accel)
+{
+    // A missed tick is a gap in the sequence, start a new frame so every frame stays evenly spaced
+    Batch *batch = &batches[batchHead % SAMPLER_BATCH_QUEUE];
+    if (filling && sampleTick != batch->sequence + batch->count) {
+        PublishBatch();
+        batch = &batches[batchHead % SAMPLER_BATCH_QUEUE];
+    }
+
+    if (!filling) {
+        if (batchHead - batchTail == SAMPLER_BATCH_QUEUE) {
+            droppedSamples++;
+            return;
+        }
+        batch->sequence = sampleTick;
+        batch->count = 0;
+        filling = true;
+    }
+
+    TelemetrySample sample;
+    for (int axis = 0; axis < 3; axis++) {
+        sample.angularRate[axis] = (int16_t)(Le16(&gyro[2 * axis]) - gyroOffset[axis]);
+        sample.acceleration[axis] = Le16(&accel[2 * axis]);
+    }
+    TelemetryFrame_EncodeSample(batch->frame, sizeof(batch->frame), batch->count++, &sample);
+
+    if (batch->count == SAMPLER_BATCH_SAMPLES) {
+        PublishBatch();
+    }
+}
+
+#ifdef LSM6DSO_SPI
+static void OnFifoRead(int32_t status, uintptr_t count)
+{
+    uint32_t start = Trace_Now();
+    Trace_Span(INTERCORE_TRACE_SAMPLE_READ, readStart);
+
+    reading = false;
+    if (status != ERROR_NONE) {
+        failedReads++;
+        UART_LOG2(UART_LOG_READ_FAILED, status, count);
+        return;
+    }
+
+    // Pair every gyroscope word with the accelerometer word of the same sample.  A word without its
+    // partner was lost, its sample is skipped.
+    for (uint16_t i = 0; i < fifoReadWords; i++) {
+        const uint8_t *word = &fifoWords[i * LSM6DSO_FIFO_WORD_SIZE];
+        uint8_t tag = word[0] >> 3;
+        if (tag == LSM6DSO_GYRO_NC_TAG) {
+            if (hasGyro) {
+                fifoTick++;
+            }
+            memcpy(pendingGyro, &word[1], sizeof(pendingGyro));
+            hasGyro = true;
+        } else if (tag == LSM6DSO_XL_NC_TAG) {
+            if (hasAccel) {
+                fifoTick++;
+            }
+            memcpy(pendingAccel, &word[1], sizeof(pendingAccel));
+            hasAccel = true;
+        }
+
+        if (hasGyro && hasAccel) {
+            AddSample(fifoTick++, pendingGyro, pendingAccel);
+            hasGyro = hasAccel = false;
+        }
+    }
+    Trace_Span(INTERCORE_TRACE_READ_DONE, start);
+}
+
+static void OnFifoStatus(int32_t status, uintptr_t count)
 {
+    if (status != ERROR_NONE || count < LSM6DSO_FIFO_STATUS_SIZE) {
+        reading = false;
+        failedReads++;
+        UART_LOG2(UART_LOG_READ_FAILED, status, count);
+        return;
+    }
+
+    // How much was overwritten is unknown, skip a tick so the high-level app sees a gap and syncs
+    // its clock again
+    if (LSM6DSO_FifoOverrun(fifoStatus)) {
+        fifoOverruns++;
+        hasGyro = hasAccel = false;
+        fifoTick++;
+    }
+
+    // Whatever does not fit in one drain is left for the next tick
+    uint16_t level = LSM6DSO_FifoLevel(fifoStatus);
+    fifoReadWords = level > LSM6DSO_FIFO_WORDS_PER_READ ? LSM6DSO_FIFO_WORDS_PER_READ : level;
+    if (fifoReadWords == 0) {
+        reading = false;
+        return;
+    }
+
+    if (LSM6DSO_ReadFifoAsync(spi, fifoWords, fifoReadWords, OnFifoRead) != ERROR_NONE) {
+        reading = false;
+        failedReads++;
+    }
+}
+#else
+static void OnReadDone(int32_t status, uintptr_t count)
+{
+    uint32_t start = Trace_Now();
+    Trace_Span(INTERCORE_TRACE_SAMPLE_READ, readStart);
+
+    reading = false;
+    if (status != ERROR_NONE || count != LSM6DSO_OUTPUTS_TRANSFER_SIZE) {
+        failedReads++;
+        UART_LOG2(UART_LOG_READ_FAILED, status, count);
+        return;
+    }
+
+    AddSample(readTick, &outputs[0], &outputs[6]);
+    Trace_Span(INTERCORE_TRACE_READ_DONE, start);
+}
+#endif
+
+static void OnSampleTimer(GPT *timer)
+{
+    uint32_t start = Trace_Now();
+    // GPT3 counts on from 0 past the expiry until the driver restarts it after this callback
+    Trace_Count(INTERCORE_TRACE_SAMPLE_LATENCY, GPT_GetCount(timer) - (SAMPLER_PERIOD_US - 1));
+
+    uint32_t now = tick++;
+    if (reading) {
+        missedReads++;
+        return;
+    }
+
+    reading = true;
+    readStart = Trace_Now();
+#ifdef LSM6DSO_SPI
+    // Every tick drains the FIFO, the samples are numbered by the sensor's own rate
+    (void)now;
+    int32_t error = LSM6DSO_ReadFifoStatusAsync(spi, fifoStatus, OnFifoStatus);
+#else
+    readTick = now;
+    int32_t error = LSM6DSO_ReadOutputsAsync(i2c, outputs, OnReadDone);
+#endif
+    if (error != ERROR_NONE) {
+        reading = false;
+        failedReads++;
+    }
+    Trace_Span(INTERCORE_TRACE_SAMPLE_TIMER, start);
+}
+
+static int FullScaleSettings(lsm6dso_fs_xl_t *accel, lsm6dso_fs_g_t *gyro)
+{
+    int found = 0;
+    for (size_t i = 0; i < sizeof(accelFullScales) / sizeof(accelFullScales[0]); i++) {
+        if (accelFullScales[i].g == SAMPLER_ACCEL_FULL_SCALE_G) {
+            *accel = accelFullScales[i].setting;
+            found |= 1;
+        }
+    }
+    for (size_t i = 0; i < sizeof(gyroFullScales) / sizeof(gyroFullScales[0]); i++) {
+        if (gyroFullScales[i].dps == SAMPLER_GYRO_FULL_SCALE_DPS) {
+            *gyro = gyroFullScales[i].setting;
+            found |= 2;
+        }
+    }
+    return found == 3 ? 0 : -1;
+}
+
+static int InitSensor(void)
+{
+#ifdef LSM6DSO_SPI
+    // SPI mode 3, the DMA loads every transaction so queued transactions run back to back
+    spi = SPIMaster_Open(LSM6DSO_SPI_UNIT);
+    if (!spi || SPIMaster_Select(spi, LSM6DSO_SPI_CS) != ERROR_NONE
+        || SPIMaster_Configure(spi, true, true, LSM6DSO_SPI_BUS_SPEED) != ERROR_NONE
+        || SPIMaster_DMAEnable(spi, true) != ERROR_NONE) {
+        return -1;
+    }
+    sensor.handle = spi;
+#else
+    i2c = I2CMaster_Open(LSM6DSO_I2C_UNIT);
+    if (!i2c || I2CMaster_SetBusSpeed(i2c, LSM6DSO_I2C_BUS_SPEED) != ERROR_NONE) {
+        return -1;
+    }
+    sensor.handle = i2c;
+#endif
+
+    uint8_t whoAmI = 0;
+    if (lsm6dso_device_id_get(&sensor, &whoAmI) != 0 || whoAmI != LSM6DSO_ID) {
+        return -1;
+    }
+
+    uint8_t resetting;
+    lsm6dso_reset_set(&sensor, PROPERTY_ENABLE);
+    do {
+        lsm6dso_reset_get(&sensor, &resetting);
+    } while (resetting);
+
+    lsm6dso_fs_xl_t accelFullScale;
+    lsm6dso_fs_g_t gyroFullScale;
+    if (FullScaleSettings(&accelFullScale, &gyroFullScale) != 0) {
+        return -1;
+    }
+
+    lsm6dso_i3c_disable_set(&sensor, LSM6DSO_I3C_DISABLE);
+    lsm6dso_block_data_update_set(&sensor, PROPERTY_ENABLE);
+    lsm6dso_xl_full_scale_set(&sensor, accelFullScale);
+    lsm6dso_gy_full_scale_set(&sensor, gyroFullScale);
+    lsm6dso_xl_data_rate_set(&sensor, SAMPLER_XL_ODR);
+    lsm6dso_gy_data_rate_set(&sensor, SAMPLER_GY_ODR);
+
+    // The dryer is at rest at startup, average the gyroscope for its zero-rate offset
+    int32_t sums[3] = { 0, 0, 0 };
+    for (int n = 0; n < CALIBRATION_SAMPLES; n++) {
+        uint8_t ready = 0;
+        do {
+            lsm6dso_gy_flag_data_ready_get(&sensor, &ready);
+        } while (!ready);
+
+        int16_t rate[3];
+        lsm6dso_angular_rate_raw_get(&sensor, rate);
+        for (int axis = 0; axis < 3; axis++) {
+            sums[axis] += rate[axis];
+        }
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        gyroOffset[axis] = (int16_t)(sums[axis] / CALIBRATION_SAMPLES);
+    }
+
+#ifdef LSM6DSO_SPI
+    // From here on every sample goes through the FIFO, which the timer drains
+    lsm6dso_fifo_xl_batch_set(&sensor, LSM6DSO_XL_BATCHED_AT_6667Hz);
+    lsm6dso_fifo_gy_batch_set(&sensor, LSM6DSO_GY_BATCHED_AT_6667Hz);
+    lsm6dso_fifo_mode_set(&sensor, LSM6DSO_STREAM_MODE);
+#endif
+
+    return 0;
+}
+
+static void SendBatches(void)
+{
+    static TelemetryFrameHeader header = {
+        .type = TELEMETRY_FRAME_SAMPLES,
+        .samplePeriodNs = SAMPLER_SAMPLE_PERIOD_NS,
+        .accelFullScaleG = SAMPLER_ACCEL_FULL_SCALE_G,
+        .gyroFullScaleDps = SAMPLER_GYRO_FULL_SCALE_DPS,
+    };
+    if (batchTail == batchHead) {
+        return;
+    }
+
+    uint32_t start = Trace_Now();
+    while (batchTail != batchHead) {
+        Batch *batch = &batches[batchTail % SAMPLER_BATCH_QUEUE];
+
+        // Timestamps are on the sampler's own clock, the high-level app maps them to its monotonic clock
+        header.sampleCount = batch->count;
+        header.sequence = batch->sequence;
+        header.timestampNs = (uint64_t)batch->sequence * SAMPLER_SAMPLE_PERIOD_NS;
+
+        TelemetryFrame_EncodeHeader(batch->frame, sizeof(batch->frame), &header);
+        if (Intercore_Send(INTERCORE_MESSAGE_TELEMETRY, batch->frame, TELEMETRY_FRAME_SIZE(batch->count)) != 0) {
+            droppedSamples += batch->count;
+            UART_LOG2(UART_LOG_BATCH_DROPPED, batch->count, batch->sequence);
+        }
+
+        // Done with the slot before the interrupt may refill it
+        __sync_synchronize();
+        batchTail = batchTail + 1;
+    }
+    Trace_Span(INTERCORE_TRACE_SEND_BATCHES, start);
+}
+
+// Stops after a failed setup.  Keeps draining the log so the reason gets out.
+static _Noreturn void Halt(UartLogFormat reason)
+{
+    UART_LOG(reason);
     for (;;) {
-        // empty.
+        UartLog_Drain();
     }
 }
 
-static _Noreturn void RTCoreMain(void)
+_Noreturn void RTCoreMain(void)
 {
-    // SCB->VTOR = ExceptionVectorTable
-    *(volatile uint32_t *)(SCB_BASE + 0x08) = (uint32_t)ExceptionVectorTable;
+    VectorTableInit();
+
+    // Sampling goes ahead without the UART, the log calls then only fill the ring
+    UartLog_Init();
+    UART_LOG1(UART_LOG_STARTED, CPUFreq_Get());
+
+    static const Intercore_ComponentId highLevelApp = HIGH_LEVEL_APP_COMPONENT_ID;
+    if (Intercore_Init(&highLevelApp) != 0) {
+        Halt(UART_LOG_INTERCORE_FAILED);
+    }
+    if (Trace_Init() != 0) {
+        Halt(UART_LOG_TRACE_FAILED);
+    }
+    if (InitSensor() != 0) {
+        Halt(UART_LOG_SENSOR_FAILED);
+    }
+
+#ifdef ADC_CAPTURE_ENABLE
+    // Before GPT3 is taken, the ADC driver uses it once while starting up
+    if (AdcCapture_Start() != 0) {
+        Halt(UART_LOG_ADC_FAILED);
+    }
+#endif
+
+    GPT *timer = GPT_Open(MT3620_UNIT_GPT3, 1000000, GPT_MODE_REPEAT);
+    if (!timer || GPT_StartTimeout(timer, SAMPLER_PERIOD_US, GPT_UNITS_MICROSEC, OnSampleTimer) != ERROR_NONE) {
+        Halt(UART_LOG_TIMER_FAILED);
+    }
+    UART_LOG2(UART_LOG_SAMPLING, SAMPLER_PERIOD_US, SAMPLER_BATCH_SAMPLES);
 
+    // Everything time critical happens in the interrupts, the main loop only hands frames to the A7
     for (;;) {
-        // empty.
+        SendBatches();
+#ifdef ADC_CAPTURE_ENABLE
+        AdcCapture_SendBlocks();
+#endif
+        Trace_SendReport();
+        // One doorbell for everything that was waiting
+        Intercore_Notify();
+        UartLog_Drain();
+        __asm__("wfi");
     }
 }
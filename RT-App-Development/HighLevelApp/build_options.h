@@ -15,15 +15,159 @@
 
 // Include Intercore Communication code
 // This will enable reading the ALST19 light sensor data from the M0 application
+// The M0 application streams INTERCORE_MESSAGE_ADC messages (intercore_message.h), nothing is requested
 // To exercise the inter-core communication code run the M0 application first
 // Enable the M0_INTERCORE_COMMS #define below
 //#define M0_INTERCORE_COMMS
 
-// Defines how quickly the accelerator data is read and reported
+// Read the LSM6DSO on the real-time core (Dryer-RT) instead of from this app.  The M4 reads the sensor
+// from a hardware timer and sends frames of samples over the inter-core socket, so the sample times
+// do not depend on Linux scheduling.  The sample rate and full scale are set in Dryer-RT/build_options.h
+// and the setSensorConfig direct method is not available.  Only one core can own the ISU2 bus, so
+// the default build claims it here: when enabling this, move "$AVNET_MT3620_SK_ISU2_I2C" from the
+// I2cMaster capability in app_manifest.json to an "I2cMaster" capability in Dryer-RT/app_manifest.json,
+// then deploy Dryer-RT first.
+//#define LSM6DSO_ON_RT_CORE
+#define RT_SAMPLER_COMPONENT_ID "120b9f11-85d4-4071-a352-6315b956d283"
+
+// Defines how quickly the accelerator data is read and reported when the FIFO is not used.  The sensor
+// runs at 12.5 Hz then, so this polls twice per sample.
 #define ACCEL_READ_PERIOD_SECONDS 0
-#define ACCEL_READ_PERIOD_NANO_SECONDS 10
+#define ACCEL_READ_PERIOD_NANO_SECONDS 40000000
+
+// LSM6DSO full scale: 2, 4, 8 or 16 g and 125, 250, 500, 1000 or 2000 dps.  Programmed in initI2c and
+// written to every telemetry frame, so the consumers convert the raw values with the right sensitivity.
+#define LSM6DSO_ACCEL_FULL_SCALE_G 4
+#define LSM6DSO_GYRO_FULL_SCALE_DPS 2000
+
+// Convert raw samples to ug/mdps with integer sensitivity tables (sensor_units.h) instead of float
+// multiplies.  Samples stay raw int16 all the way to the MQTT frames; the conversion only feeds the
+// debug log and the IoT Hub telemetry.  Comment out for the float path.
+#define SENSOR_UNITS_FIXED_POINT
+
+// Log every sample in mg/dps.  Formatting at the FIFO ODR costs far more than reading the sensor.
+//#define ENABLE_SAMPLE_DEBUG
+
+// Collect samples through the LSM6DSO hardware FIFO instead of polling the output registers.
+// The sensor batches accelerometer and gyroscope words at the FIFO ODR and every timer wakeup
+// drains everything that is queued with a single burst read.  Comment out to go back to polling.
+#define LSM6DSO_FIFO_ENABLE
+
+// FIFO ODR in mHz (12500, 26000, 52000, ... 6667000) and watermark.  Both sensors run and batch at this
+// rate.  The watermark is in samples of LSM6DSO_FIFO_WORDS_PER_SAMPLE FIFO words each (accel, gyro and
+// a timestamp with DEC_1, so 3).  At 417 Hz a 16 sample (48 word) watermark fills in ~38 ms, and the
+// 20 ms LSM6DSO_FIFO_READ_PERIOD_NANO_SECONDS drain finds ~8 samples (25 words) per poll, about half
+// of it.  These are the startup values, the setSensorConfig direct method changes the ODR, full scale,
+// watermark and poll period at runtime.
+#define LSM6DSO_FIFO_ODR_MILLIHZ 417000
+#define LSM6DSO_FIFO_WATERMARK_SAMPLES 16
+
+// Timestamp words batched in the FIFO: LSM6DSO_DEC_1 stores one per sample, DEC_8/DEC_32 one per 8 or 32
+// samples (the rest are interpolated at the ODR) and LSM6DSO_NO_DECIMATION none.  Each timestamp is
+// converted to the device monotonic clock and becomes the frame timestamps.  Keep WORDS_PER_SAMPLE at
+// 3 for DEC_1 (accel, gyro, timestamp) and 2 otherwise so the watermark stays in samples.
+#define LSM6DSO_FIFO_TS_DECIMATION LSM6DSO_DEC_1
+#define LSM6DSO_FIFO_WORDS_PER_SAMPLE 3
+#define LSM6DSO_FIFO_READ_PERIOD_NANO_SECONDS 20000000
+
+// GPIO wired to the LSM6DSO INT1 pin.  The sensor raises INT1 at the FIFO watermark (on gyroscope data
+// ready without the FIFO), and each poll reads the pin level before it touches the I2C bus, so the
+// sensor is only read when it has data.  Leave commented out unless INT1 is connected, otherwise no
+// sample is ever read, and add the pin ("$AVNET_MT3620_SK_GPIO2" here) to the Gpio capability in
+// app_manifest.json with it.
+//#define LSM6DSO_INT1_GPIO AVNET_MT3620_SK_GPIO2
+
+// Let the LSM6DSO drop to 12.5 Hz with the gyroscope asleep once the dryer has not moved for
+// ACTIVITY_SLEEP_SECONDS (at most 15 * 512 / ODR, ~18 s at 417 Hz), and poll it only every
+// ACTIVITY_IDLE_POLL_MS while it sleeps.  The sensor goes back to the configured ODR by itself with
+// the first sample that moves more than ACTIVITY_WAKEUP_THRESHOLD_MG, and the FIFO keeps batching
+// through the change, so capture resumes within one ODR period.  With the FIFO the idle poll comes
+// sooner if needed, so the samples taken after the dryer starts again fit.  Comment out to always
+// sample at the full rate.
+#define ACTIVITY_DETECTION_ENABLE
+#define ACTIVITY_WAKEUP_THRESHOLD_MG 63
+#define ACTIVITY_SLEEP_SECONDS 10
+#define ACTIVITY_IDLE_POLL_MS 1000
+
+// Samples are published in batches: one MQTT message per TELEMETRY_BATCH_SAMPLES samples, or sooner if
+// the oldest sample has waited TELEMETRY_BATCH_MAX_LATENCY_MS.  Both can be changed at runtime with the
+// setTelemetryBatch direct method, up to TELEMETRY_BATCH_MAX_SAMPLES (telemetry_batch.h).
+#define TELEMETRY_BATCH_SAMPLES 32
+#define TELEMETRY_BATCH_MAX_LATENCY_MS 100
+
+// Completed frames wait in a RAM ring buffer until the broker accepts them, so samples survive
+// broker and Wi-Fi outages.  When the ring is full either the oldest frames or the new frame are dropped.
+// At 417 Hz with 32 sample frames, 48 KB holds roughly 10 seconds of data.
+#define TELEMETRY_RING_SIZE_BYTES (48 * 1024)
+#define TELEMETRY_RING_POLICY TELEMETRY_RING_DROP_OLDEST
+
+// Save frames still in the ring to mutable storage when the application exits, and send them after the
+// next start.  Requires "MutableStorage" in app_manifest.json, sized to hold TELEMETRY_RING_SIZE_BYTES.
+#define TELEMETRY_RING_PERSIST
+
+// MQTT client buffer sizes.  The send buffer holds every message until its PUBACK arrives.  When a
+// buffer turns out too small it doubles, up to the MAX size (set MAX equal to the size to disable this).
+// The getTelemetryStats direct method reports the sizes reached and the queue high-water marks.
+#define MQTT_SEND_BUFFER_SIZE 8192
+#define MQTT_SEND_BUFFER_MAX_SIZE (32 * 1024)
+#define MQTT_RECV_BUFFER_SIZE 512
+#define MQTT_RECV_BUFFER_MAX_SIZE 4096
+
+// QoS per message class.  Sample frames go out at QoS 0 so the hot path never waits for a PUBACK; start
+// markers and other control messages, and low-rate summaries, are acknowledged.  Summaries are retained
+// so a new subscriber immediately gets the latest one.
+#define MQTT_QOS_TELEMETRY 0
+#define MQTT_QOS_CONTROL 1
+#define MQTT_QOS_SUMMARY 1
+#define MQTT_RETAIN_SUMMARY true
+
+// Delay range between MQTT reconnect attempts while the broker is unreachable.  The delay doubles
+// with every failed attempt and is jittered, reconnecting never blocks the sampling loop.
+#define MQTT_BACKOFF_MIN_MS 500
+#define MQTT_BACKOFF_MAX_MS 60000
+
+// Run the dryness model on the device.  Every sample is fed to the model loaded from the "drynessModel"
+// device twin property, and every DRYNESS_PUBLISH_INTERVAL_MS the smoothed dryness and a confidence
+// value are published as one small summary frame.  Raw sample frames stop once a model is loaded,
+// unless DRYNESS_KEEP_RAW_UPLINK is defined (e.g. to collect new training data), which also keeps them
+// next to the FEATURE_WINDOW_ENABLE frames.
+#define DRYNESS_ON_DEVICE
+#define DRYNESS_PUBLISH_INTERVAL_MS 10000
+//#define DRYNESS_KEEP_RAW_UPLINK
+
+// Weight of the newest window in the smoothed dryness, and the window-to-window spread of the dryness
+// at which the reported confidence reaches 0.
+#define DRYNESS_SMOOTHING_ALPHA 0.3f
+#define DRYNESS_CONFIDENCE_SPREAD 0.2f
+
+// Publish features of a sliding window of FEATURE_WINDOW_SIZE samples (feature_window.h) instead of the raw
+// samples: RMS, variance, zero-crossing rate and FFT band energies per axis, one frame every
+// FEATURE_WINDOW_HOP samples.  At 417 Hz with a 64 sample window and a 32 sample hop that is a
+// 196 byte frame every ~77 ms.  The host tools, mqttWrite.py and DryerRegression.py only read raw
+// sample frames, so leave this commented out while they collect the data.
+//#define FEATURE_WINDOW_ENABLE
+#define FEATURE_WINDOW_HOP 32
+
+// Fastest ISU2 speed every device on the bus supports, the LSM6DSO takes fast-mode plus (1 MHz) and the
+// SSD1306 OLED fast mode (400 kHz).  The bus starts at this speed and steps down while the LSM6DSO does
+// not answer.  The transfer timeout is twice the time of the largest transaction at the speed reached
+// plus SENSOR_BUS_TIMEOUT_MARGIN_MS: a 448 byte FIFO burst takes ~41 ms at 100 kHz and ~10 ms at
+// 400 kHz, so the timeout comes to ~92 ms and ~32 ms there.
+#ifdef OLED_SD1306
+#define SENSOR_BUS_MAX_SPEED_HZ 400000
+#else
+#define SENSOR_BUS_MAX_SPEED_HZ 1000000
+#endif
+#define SENSOR_BUS_TIMEOUT_MARGIN_MS 10
 
 // Enables I2C read/write debug
 //#define ENABLE_READ_WRITE_DEBUG
 
+// The FIFO, activity detection and INT1 are set up by the high-level sensor code only
+#ifdef LSM6DSO_ON_RT_CORE
+#undef LSM6DSO_FIFO_ENABLE
+#undef ACTIVITY_DETECTION_ENABLE
+#undef LSM6DSO_INT1_GPIO
+#endif
+
 #endif 
\ No newline at end of file
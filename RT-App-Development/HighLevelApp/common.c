@@ -1,4 +1,6 @@
 #include <sys/time.h>
+#include <time.h>
+#include <errno.h>
 #include <stdio.h> 
 #include "common.h"
 #include "common.h"
@@ -12,8 +14,9 @@ unsigned long millis()
 }
 
 void waitMs(unsigned long t) {
-	unsigned long start = millis();
-	while (millis() - start < t) {
-		__asm("nop");
+	struct timespec remaining = { .tv_sec = (time_t)(t / 1000), .tv_nsec = (long)(t % 1000) * 1000000 };
+
+	// Sleep instead of spinning, resuming after signals until the full time has passed
+	while (nanosleep(&remaining, &remaining) == -1 && errno == EINTR) {
 	}
 }
\ No newline at end of file
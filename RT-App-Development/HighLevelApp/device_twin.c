@@ -21,6 +21,9 @@
 #include "azure_iot_utilities.h"
 #include "parson.h"
 #include "build_options.h"
+#ifdef DRYNESS_ON_DEVICE
+#include "dryness_estimator.h"
+#endif
 
 bool userLedRedIsOn = false;
 bool userLedGreenIsOn = false;
@@ -112,6 +115,44 @@ void checkAndUpdateDeviceTwin(char* property, void* value, data_type_t type, boo
 	}
 }
 
+#ifdef DRYNESS_ON_DEVICE
+///<summary>
+///		Loads the dryness model from the "drynessModel" desired property.  The property is either an array
+///		[intercept, xa, ya, za, xr, yr, zr] or the text of the dryness_model.txt file written by DryerRegression.py.
+///</summary>
+static void UpdateDrynessModel(JSON_Object * desiredProperties)
+{
+	JSON_Value *value = json_object_get_value(desiredProperties, "drynessModel");
+	DrynessModel model;
+	int result = -1;
+
+	if (json_value_get_type(value) == JSONArray) {
+		JSON_Array *coefficients = json_value_get_array(value);
+		if (json_array_get_count(coefficients) == 1 + DRYNESS_MODEL_FEATURES) {
+			model.intercept = (float)json_array_get_number(coefficients, 0);
+			for (int i = 0; i < DRYNESS_MODEL_FEATURES; i++) {
+				model.coefficients[i] = (float)json_array_get_number(coefficients, 1 + (size_t)i);
+			}
+			result = 0;
+		}
+	} else if (json_value_get_type(value) == JSONString) {
+		const char *text = json_value_get_string(value);
+		result = DrynessModel_Parse(&model, text, strlen(text));
+	}
+
+	if (result != 0) {
+		Log_Debug("ERROR: drynessModel must hold the intercept and %d coefficients\n", DRYNESS_MODEL_FEATURES);
+		return;
+	}
+
+	DrynessEstimator_SetModel(&model);
+	Log_Debug("Received device update. New dryness model intercept %f\n", model.intercept);
+
+	bool loaded = true;
+	checkAndUpdateDeviceTwin("drynessModelLoaded", &loaded, TYPE_BOOL, true);
+}
+#endif
+
 ///<summary>
 ///		Parses received desired property changes.
 ///</summary>
@@ -163,4 +204,10 @@ void deviceTwinChangedHandler(JSON_Object * desiredProperties)
 			}
 		}
 	}
+
+#ifdef DRYNESS_ON_DEVICE
+	if (json_object_has_value(desiredProperties, "drynessModel") != 0) {
+		UpdateDrynessModel(desiredProperties);
+	}
+#endif
 }
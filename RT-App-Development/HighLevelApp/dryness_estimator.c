@@ -0,0 +1,152 @@
+#include "dryness_estimator.h"
+
+#include <math.h>
+#include <time.h>
+
+#include <applibs/log.h>
+#include "epoll_timerfd_utilities.h"
+
+static DrynessModel model;
+static bool hasModel = false;
+
+// Model coefficients scaled to raw sensor units for the current full scale
+static float rawCoefficients[DRYNESS_MODEL_FEATURES];
+static TelemetryFrameHeader header = { .type = TELEMETRY_FRAME_DRYNESS };
+
+// Current window
+static uint32_t windowSamples = 0;
+static uint32_t windowSequence = 0;
+static double windowSum = 0.0;
+
+// Smoothed estimate over the previous windows
+static float smoothingAlpha = 1.0f;
+static float maxSpread = 1.0f;
+static float smoothedDryness = 0.0f;
+static float smoothedVariance = 0.0f;
+static uint32_t smoothedWindows = 0;
+
+static int publishTimerFd = -1;
+static DrynessEstimatorPublishHandler publishHandler = NULL;
+
+/* helpers */
+static void PublishTimerEventHandler(EventData* eventData);
+static EventData publishTimerEventData = { .eventHandler = &PublishTimerEventHandler };
+
+static void updateRawCoefficients(void) {
+	DrynessModel_RawCoefficients(&model, &header, rawCoefficients);
+}
+
+static uint64_t monotonicNs(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+/**
+* @brief Fold the finished window into the smoothed estimate and publish it.
+*
+* The confidence falls as the windows disagree with the smoothed value, and starts low until enough
+* windows have been averaged for the smoothing to settle.
+*/
+static void publishWindow(void) {
+	float windowDryness = 1.0f - (float)(windowSum / windowSamples);
+
+	if (smoothedWindows == 0) {
+		smoothedDryness = windowDryness;
+		smoothedVariance = 0.0f;
+	} else {
+		float deviation = windowDryness - smoothedDryness;
+		smoothedDryness += smoothingAlpha * deviation;
+		smoothedVariance = (1.0f - smoothingAlpha) * (smoothedVariance + smoothingAlpha * deviation * deviation);
+	}
+	smoothedWindows++;
+
+	float warmUp = smoothedWindows * smoothingAlpha;
+	float spread = sqrtf(smoothedVariance) / maxSpread;
+	TelemetryDryness dryness = {
+		.dryness = smoothedDryness,
+		.confidence = (warmUp < 1.0f ? warmUp : 1.0f) * (spread < 1.0f ? 1.0f - spread : 0.0f),
+		.samples = windowSamples
+	};
+
+	header.sequence = windowSequence;
+	header.timestampNs = monotonicNs();
+	windowSamples = 0;
+	windowSum = 0.0;
+
+	uint8_t frame[TELEMETRY_FRAME_DRYNESS_SIZE];
+	size_t frameSize = TelemetryFrame_EncodeDryness(frame, sizeof(frame), &header, &dryness);
+	if (publishHandler != NULL)
+		publishHandler(frame, frameSize);
+}
+
+static void PublishTimerEventHandler(EventData* eventData) {
+	if (ConsumeTimerFdEvent(publishTimerFd) != 0)
+		return;
+
+	if (hasModel && windowSamples > 0)
+		publishWindow();
+}
+
+/* declarations */
+int DrynessEstimator_Init(int epollFd, uint32_t publishIntervalMs, float alpha, float confidenceSpread,
+	DrynessEstimatorPublishHandler publish) {
+	if (publishIntervalMs < 1 || !(alpha > 0.0f && alpha <= 1.0f) || !(confidenceSpread > 0.0f)) {
+		Log_Debug("ERROR: Invalid dryness estimator configuration (%u ms, alpha %.2f, spread %.2f)\n",
+			publishIntervalMs, alpha, confidenceSpread);
+		return -1;
+	}
+
+	smoothingAlpha = alpha;
+	maxSpread = confidenceSpread;
+	publishHandler = publish;
+
+	struct timespec period = { .tv_sec = publishIntervalMs / 1000, .tv_nsec = (long)(publishIntervalMs % 1000) * 1000000 };
+	publishTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &period, &publishTimerEventData, EPOLLIN);
+	if (publishTimerFd < 0)
+		return -1;
+
+	return 0;
+}
+
+void DrynessEstimator_SetModel(const DrynessModel* newModel) {
+	model = *newModel;
+	hasModel = true;
+	updateRawCoefficients();
+
+	windowSamples = 0;
+	windowSum = 0.0;
+	smoothedWindows = 0;
+}
+
+bool DrynessEstimator_HasModel(void) {
+	return hasModel;
+}
+
+void DrynessEstimator_SetFormat(uint16_t accelFullScaleG, uint16_t gyroFullScaleDps) {
+	header.accelFullScaleG = accelFullScaleG;
+	header.gyroFullScaleDps = gyroFullScaleDps;
+	if (hasModel)
+		updateRawCoefficients();
+}
+
+void DrynessEstimator_AddSample(const TelemetrySample* sample, uint32_t sequence) {
+	if (!hasModel)
+		return;
+
+	float prediction = model.intercept;
+	for (int axis = 0; axis < 3; axis++) {
+		prediction += rawCoefficients[axis] * sample->acceleration[axis];
+		prediction += rawCoefficients[3 + axis] * sample->angularRate[axis];
+	}
+
+	if (windowSamples == 0)
+		windowSequence = sequence;
+	windowSamples++;
+	windowSum += prediction;
+}
+
+void DrynessEstimator_Close(void) {
+	CloseFdAndPrintError(publishTimerFd, "drynessPublishTimer");
+	publishTimerFd = -1;
+}
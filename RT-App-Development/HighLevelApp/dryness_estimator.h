@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "dryness_model.h"
+#include "telemetry_frame.h"
+
+/*
+* On-device dryness inference.  Every sample is run through the linear model as it is read; once per
+* publish interval the window mean is smoothed and published as a single TELEMETRY_FRAME_DRYNESS
+* frame instead of the raw samples.
+*/
+
+/**
+* @brief Called with every dryness frame. The frame buffer is reused once the handler returns.
+*/
+typedef void (*DrynessEstimatorPublishHandler)(const uint8_t* frame, size_t frameSize);
+
+/**
+* @brief Create the publish timer and register it with the epoll instance. Nothing is published
+* until a model is set.
+*
+* @param epollFd Epoll file descriptor.
+* @param publishIntervalMs Length of an estimation window, in ms.
+* @param alpha Weight of the newest window in the smoothed dryness, 0 < alpha <= 1.
+* @param confidenceSpread Window-to-window spread of the dryness at which the confidence drops to 0.
+* @param publish Handler that publishes the dryness frames.
+* @return 0 on success, -1 on failure.
+*/
+int DrynessEstimator_Init(int epollFd, uint32_t publishIntervalMs, float alpha, float confidenceSpread,
+	DrynessEstimatorPublishHandler publish);
+
+/**
+* @brief Replace the model. The smoothed estimate restarts from the next window.
+*/
+void DrynessEstimator_SetModel(const DrynessModel* model);
+
+/**
+* @brief Check whether a model has been set.
+*/
+bool DrynessEstimator_HasModel(void);
+
+/**
+* @brief Set the full scale of the following samples, used to scale the coefficients to raw units.
+*/
+void DrynessEstimator_SetFormat(uint16_t accelFullScaleG, uint16_t gyroFullScaleDps);
+
+/**
+* @brief Add one raw sample to the current window.
+*
+* @param sample Raw sample.
+* @param sequence Sequence number of the sample.
+*/
+void DrynessEstimator_AddSample(const TelemetrySample* sample, uint32_t sequence);
+
+/**
+* @brief Close the publish timer. The current window is dropped.
+*/
+void DrynessEstimator_Close(void);
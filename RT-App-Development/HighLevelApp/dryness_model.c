@@ -0,0 +1,229 @@
+#include "dryness_model.h"
+
+#include <stdbool.h>
+
+/* helpers */
+static int isSeparator(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == ',';
+}
+
+/**
+* @brief Parse a decimal number with optional sign, fraction and exponent, without strtod so the
+* input need not be NUL terminated and the locale does not matter.
+*
+* @return Number of characters consumed, 0 if there is no number at p.
+*/
+static size_t parseNumber(const char* p, const char* end, double* value) {
+	const char* start = p;
+	double sign = 1.0;
+	double result = 0.0;
+	int digits = 0;
+
+	if (p < end && (*p == '-' || *p == '+')) {
+		if (*p == '-')
+			sign = -1.0;
+		p++;
+	}
+
+	while (p < end && *p >= '0' && *p <= '9') {
+		result = result * 10.0 + (*p++ - '0');
+		digits++;
+	}
+
+	if (p < end && *p == '.') {
+		p++;
+		double scale = 0.1;
+		while (p < end && *p >= '0' && *p <= '9') {
+			result += (*p++ - '0') * scale;
+			scale *= 0.1;
+			digits++;
+		}
+	}
+
+	if (digits == 0)
+		return 0;
+
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		const char* q = p + 1;
+		int expSign = 1;
+		int exponent = 0;
+		if (q < end && (*q == '-' || *q == '+')) {
+			if (*q == '-')
+				expSign = -1;
+			q++;
+		}
+		if (q < end && *q >= '0' && *q <= '9') {
+			while (q < end && *q >= '0' && *q <= '9' && exponent < 400)
+				exponent = exponent * 10 + (*q++ - '0');
+			for (int i = 0; i < exponent; i++)
+				result = (expSign > 0) ? result * 10.0 : result / 10.0;
+			p = q;
+		}
+	}
+
+	*value = sign * result;
+	return (size_t)(p - start);
+}
+
+/**
+* @brief Decode the header of a frame and check that it is a samples frame.
+*
+* @return 0 on success, -1 if the frame is truncated, of another version or not a samples frame.
+*/
+static int decodeSampleFrame(const uint8_t* frame, size_t length, TelemetryFrameHeader* header) {
+	if (TelemetryFrame_DecodeHeader(frame, length, header) != 0 || header->type != TELEMETRY_FRAME_SAMPLES)
+		return -1;
+	return 0;
+}
+
+static int16_t rawValue(const uint8_t* sample, int feature) {
+	return (int16_t)(sample[2 * feature] | (sample[2 * feature + 1] << 8));
+}
+
+/* declarations */
+void DrynessModel_RawCoefficients(const DrynessModel* model, const TelemetryFrameHeader* header, float raw[DRYNESS_MODEL_FEATURES]) {
+	float mgPerLsb = TelemetryFrame_AccelToMg(header, 1);
+	float dpsPerLsb = TelemetryFrame_GyroToDps(header, 1);
+
+	for (int i = 0; i < 3; i++) {
+		raw[i] = model->coefficients[i] * mgPerLsb;
+		raw[3 + i] = model->coefficients[3 + i] * dpsPerLsb;
+	}
+}
+
+int DrynessModel_Parse(DrynessModel* model, const char* text, size_t length) {
+	const char* p = text;
+	const char* end = text + length;
+	float values[1 + DRYNESS_MODEL_FEATURES];
+	int count = 0;
+
+	while (p < end) {
+		if (isSeparator(*p)) {
+			p++;
+		} else if (*p == '#') {
+			while (p < end && *p != '\n')
+				p++;
+		} else {
+			double value;
+			size_t used = parseNumber(p, end, &value);
+			if (used == 0 || count == 1 + DRYNESS_MODEL_FEATURES)
+				return -1;
+			values[count++] = (float)value;
+			p += used;
+		}
+	}
+
+	if (count != 1 + DRYNESS_MODEL_FEATURES)
+		return -1;
+
+	model->intercept = values[0];
+	for (int i = 0; i < DRYNESS_MODEL_FEATURES; i++)
+		model->coefficients[i] = values[1 + i];
+	return 0;
+}
+
+float DrynessModel_Predict(const DrynessModel* model, const float features[DRYNESS_MODEL_FEATURES]) {
+	float prediction = model->intercept;
+	for (int i = 0; i < DRYNESS_MODEL_FEATURES; i++)
+		prediction += model->coefficients[i] * features[i];
+	return prediction;
+}
+
+size_t DrynessModel_PredictFrame(const DrynessModel* model, const uint8_t* frame, size_t length, float* out, size_t outSize) {
+	TelemetryFrameHeader header;
+	if (decodeSampleFrame(frame, length, &header) != 0)
+		return 0;
+
+	float raw[DRYNESS_MODEL_FEATURES];
+	DrynessModel_RawCoefficients(model, &header, raw);
+
+	size_t count = header.sampleCount < outSize ? header.sampleCount : outSize;
+	const uint8_t* sample = &frame[TELEMETRY_FRAME_HEADER_SIZE];
+
+	for (size_t i = 0; i < count; i++, sample += TELEMETRY_FRAME_SAMPLE_SIZE) {
+		float prediction = model->intercept;
+		for (int f = 0; f < DRYNESS_MODEL_FEATURES; f++)
+			prediction += raw[f] * rawValue(sample, f);
+		out[i] = prediction;
+	}
+
+	return count;
+}
+
+int DrynessModel_FrameMean(const DrynessModel* model, const uint8_t* frame, size_t length, float* mean, uint32_t* samples) {
+	TelemetryFrameHeader header;
+	if (decodeSampleFrame(frame, length, &header) != 0 || header.sampleCount == 0)
+		return -1;
+
+	int32_t sums[DRYNESS_MODEL_FEATURES] = { 0 };
+	const uint8_t* sample = &frame[TELEMETRY_FRAME_HEADER_SIZE];
+
+	for (uint16_t i = 0; i < header.sampleCount; i++, sample += TELEMETRY_FRAME_SAMPLE_SIZE) {
+		for (int f = 0; f < DRYNESS_MODEL_FEATURES; f++)
+			sums[f] += rawValue(sample, f);
+	}
+
+	float raw[DRYNESS_MODEL_FEATURES];
+	DrynessModel_RawCoefficients(model, &header, raw);
+
+	float prediction = 0.0f;
+	for (int f = 0; f < DRYNESS_MODEL_FEATURES; f++)
+		prediction += raw[f] * (float)sums[f];
+
+	*mean = model->intercept + prediction / header.sampleCount;
+	*samples = header.sampleCount;
+	return 0;
+}
+
+int DrynessModel_TextMean(const DrynessModel* model, const char* text, size_t length, float* mean, uint32_t* samples) {
+	const char* p = text;
+	const char* end = text + length;
+	double sums[DRYNESS_MODEL_FEATURES] = { 0 };
+	uint32_t count = 0;
+
+	while (p < end) {
+		// One line: sequence followed by the six features
+		double values[1 + DRYNESS_MODEL_FEATURES];
+		int fields = 0;
+		bool valid = true;
+
+		while (p < end && *p != '\n') {
+			if (*p == ',' || *p == ' ' || *p == '\r') {
+				p++;
+				continue;
+			}
+
+			double value;
+			size_t used = parseNumber(p, end, &value);
+			if (used == 0 || fields == 1 + DRYNESS_MODEL_FEATURES) {
+				valid = false;
+				while (p < end && *p != '\n')
+					p++;
+				break;
+			}
+			values[fields++] = value;
+			p += used;
+		}
+		if (p < end)
+			p++;
+
+		// Start markers carry a negative sequence number
+		if (!valid || fields != 1 + DRYNESS_MODEL_FEATURES || values[0] < 0)
+			continue;
+
+		for (int f = 0; f < DRYNESS_MODEL_FEATURES; f++)
+			sums[f] += values[1 + f];
+		count++;
+	}
+
+	if (count == 0)
+		return -1;
+
+	float features[DRYNESS_MODEL_FEATURES];
+	for (int f = 0; f < DRYNESS_MODEL_FEATURES; f++)
+		features[f] = (float)(sums[f] / count);
+
+	*mean = DrynessModel_Predict(model, features);
+	*samples = count;
+	return 0;
+}
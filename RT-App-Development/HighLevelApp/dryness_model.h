@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "telemetry_frame.h"
+
+/*
+* Linear dryness model fitted by DryerRegression.py:
+*
+*   prediction = intercept + sum(coefficients[i] * feature[i])
+*
+* over the features xa, ya, za (mg) and xr, yr, zr (dps) of one sample; the reported dryness of a
+* frame is 1 - mean(prediction).  Shared by the host predictor and the device.  No allocation and no
+* applibs headers.
+*/
+
+#define DRYNESS_MODEL_FEATURES 6
+
+typedef struct {
+	float intercept;
+	float coefficients[DRYNESS_MODEL_FEATURES];
+} DrynessModel;
+
+/**
+* @brief Parse a model written by DryerRegression.py: the intercept followed by the six coefficients,
+* separated by whitespace or commas. Lines starting with '#' are comments.
+*
+* @param text Model text, need not be NUL terminated.
+* @param length Length of text in bytes.
+* @return 0 on success, -1 if the text does not hold exactly seven numbers.
+*/
+int DrynessModel_Parse(DrynessModel* model, const char* text, size_t length);
+
+/**
+* @brief Scale the coefficients to raw sensor units for the full scale settings in header, so that
+* prediction = intercept + sum(raw[i] * rawValue[i]).
+*/
+void DrynessModel_RawCoefficients(const DrynessModel* model, const TelemetryFrameHeader* header, float raw[DRYNESS_MODEL_FEATURES]);
+
+/**
+* @brief Prediction for one sample given in engineering units.
+*/
+float DrynessModel_Predict(const DrynessModel* model, const float features[DRYNESS_MODEL_FEATURES]);
+
+/**
+* @brief Predict every sample of a binary frame.
+*
+* The coefficients are scaled once per frame to raw sensor units, so each sample costs six
+* multiply-adds on the raw values.
+*
+* @param out Receives one prediction per sample.
+* @param outSize Capacity of out.
+* @return Number of predictions written, 0 if the payload is not a sample frame.
+*/
+size_t DrynessModel_PredictFrame(const DrynessModel* model, const uint8_t* frame, size_t length, float* out, size_t outSize);
+
+/**
+* @brief Mean prediction over the samples of a binary frame.
+*
+* The model is linear, so the mean prediction is the prediction of the mean sample: only the raw
+* values are summed per sample.
+*
+* @param samples Receives the number of samples used.
+* @return 0 on success, -1 if the payload is not a sample frame or has no samples.
+*/
+int DrynessModel_FrameMean(const DrynessModel* model, const uint8_t* frame, size_t length, float* mean, uint32_t* samples);
+
+/**
+* @brief Mean prediction over a text payload of "sequence,xa,ya,za,xr,yr,zr" lines, the format of
+* the legacy firmware and of mqttWrite.py. Start markers (all -1) and malformed lines are skipped.
+*
+* @return 0 on success, -1 if no sample line was found.
+*/
+int DrynessModel_TextMean(const DrynessModel* model, const char* text, size_t length, float* mean, uint32_t* samples);
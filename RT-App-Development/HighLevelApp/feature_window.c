@@ -0,0 +1,238 @@
+#include "feature_window.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <applibs/log.h>
+
+#define AXES TELEMETRY_FEATURE_AXES
+#define BINS_PER_BAND ((FEATURE_WINDOW_SIZE / 2) / TELEMETRY_FEATURE_BANDS)
+
+#if (FEATURE_WINDOW_SIZE & (FEATURE_WINDOW_SIZE - 1)) != 0 || FEATURE_WINDOW_SIZE / 2 < TELEMETRY_FEATURE_BANDS
+#error "FEATURE_WINDOW_SIZE must be a power of two with at least one FFT bin per band"
+#endif
+
+// Raw samples, one row per axis so the per-axis loops run over contiguous memory
+static int16_t window[AXES][FEATURE_WINDOW_SIZE];
+static uint32_t sequences[FEATURE_WINDOW_SIZE];
+static uint64_t timestamps[FEATURE_WINDOW_SIZE];
+static uint16_t head = 0;   // next slot to write, the oldest sample once the window is full
+static uint16_t filled = 0;
+static uint16_t sinceFlush = 0;
+static uint16_t hop = FEATURE_WINDOW_SIZE;
+
+// Running sums over the samples in the window
+static int32_t sums[AXES];
+static int64_t squareSums[AXES];
+
+// Bit a of crossings[i] is set if sample i of axis a is on the other side of the reference than the
+// sample before it.  The reference is the mean of the previous window.
+static uint8_t crossings[FEATURE_WINDOW_SIZE];
+static uint16_t crossingCounts[AXES];
+static int16_t reference[AXES];
+static uint8_t aboveReference = 0;
+static bool hasReference = false;
+
+// FFT tables, built once in FeatureWindow_Init
+static float hann[FEATURE_WINDOW_SIZE];
+static float hannPower = 0.0f;
+static float twiddleCos[FEATURE_WINDOW_SIZE / 2];
+static float twiddleSin[FEATURE_WINDOW_SIZE / 2];
+static uint16_t bitReversed[FEATURE_WINDOW_SIZE];
+
+static TelemetryFrameHeader header = { .type = TELEMETRY_FRAME_FEATURES };
+static FeatureWindowFlushHandler flushHandler = NULL;
+
+/* helpers */
+static void buildTables(void) {
+	const float pi = 3.14159265358979f;
+	int bits = 0;
+	while ((1 << bits) < FEATURE_WINDOW_SIZE)
+		bits++;
+
+	hannPower = 0.0f;
+	for (int n = 0; n < FEATURE_WINDOW_SIZE; n++) {
+		hann[n] = 0.5f - 0.5f * cosf(2.0f * pi * n / FEATURE_WINDOW_SIZE);
+		hannPower += hann[n] * hann[n];
+
+		uint16_t reversed = 0;
+		for (int b = 0; b < bits; b++)
+			reversed |= (uint16_t)(((n >> b) & 1) << (bits - 1 - b));
+		bitReversed[n] = reversed;
+	}
+
+	for (int k = 0; k < FEATURE_WINDOW_SIZE / 2; k++) {
+		twiddleCos[k] = cosf(2.0f * pi * k / FEATURE_WINDOW_SIZE);
+		twiddleSin[k] = -sinf(2.0f * pi * k / FEATURE_WINDOW_SIZE);
+	}
+}
+
+/**
+* @brief In-place iterative radix-2 FFT of FEATURE_WINDOW_SIZE points, input in bit-reversed order.
+*/
+static void fft(float* re, float* im) {
+	for (int size = 2; size <= FEATURE_WINDOW_SIZE; size <<= 1) {
+		int half = size / 2;
+		int step = FEATURE_WINDOW_SIZE / size;
+		for (int start = 0; start < FEATURE_WINDOW_SIZE; start += size) {
+			for (int k = 0; k < half; k++) {
+				float wr = twiddleCos[k * step];
+				float wi = twiddleSin[k * step];
+				int a = start + k;
+				int b = a + half;
+				float tr = re[b] * wr - im[b] * wi;
+				float ti = re[b] * wi + im[b] * wr;
+				re[b] = re[a] - tr;
+				im[b] = im[a] - ti;
+				re[a] += tr;
+				im[a] += ti;
+			}
+		}
+	}
+}
+
+/**
+* @brief Band energies of one axis. The mean is removed and a Hann window applied, and the
+* one-sided spectrum is scaled so the bands add up to about the variance of the window.
+*/
+static void bandEnergies(int axis, float mean, float unit, float* energy) {
+	float re[FEATURE_WINDOW_SIZE];
+	float im[FEATURE_WINDOW_SIZE];
+
+	// head is the oldest sample once the window is full
+	for (int n = 0; n < FEATURE_WINDOW_SIZE; n++) {
+		int16_t raw = window[axis][(head + n) & (FEATURE_WINDOW_SIZE - 1)];
+		uint16_t slot = bitReversed[n];
+		re[slot] = ((float)raw - mean) * hann[n];
+		im[slot] = 0.0f;
+	}
+	fft(re, im);
+
+	float scale = unit * unit / (FEATURE_WINDOW_SIZE * hannPower);
+	for (int band = 0; band < TELEMETRY_FEATURE_BANDS; band++) {
+		float sum = 0.0f;
+		for (int k = 1 + band * BINS_PER_BAND; k <= (band + 1) * BINS_PER_BAND; k++) {
+			float power = re[k] * re[k] + im[k] * im[k];
+			sum += k == FEATURE_WINDOW_SIZE / 2 ? power : 2.0f * power;
+		}
+		energy[band] = sum * scale;
+	}
+}
+
+static void flushFeatures(void) {
+	TelemetryFeatures features = { .windowSamples = FEATURE_WINDOW_SIZE };
+	float mgPerLsb = TelemetryFrame_AccelToMg(&header, 1);
+	float dpsPerLsb = TelemetryFrame_GyroToDps(&header, 1);
+
+	for (int axis = 0; axis < AXES; axis++) {
+		float unit = axis < 3 ? mgPerLsb : dpsPerLsb;
+		float mean = (float)sums[axis] / FEATURE_WINDOW_SIZE;
+
+		// N * sum(x^2) - sum(x)^2 is exact in 64 bits for int16 samples
+		int64_t spread = (int64_t)FEATURE_WINDOW_SIZE * squareSums[axis] - (int64_t)sums[axis] * sums[axis];
+		features.variance[axis] = (float)spread / ((float)FEATURE_WINDOW_SIZE * FEATURE_WINDOW_SIZE) * unit * unit;
+		features.rms[axis] = sqrtf((float)squareSums[axis] / FEATURE_WINDOW_SIZE) * unit;
+		features.zeroCrossingRate[axis] = (float)crossingCounts[axis] / FEATURE_WINDOW_SIZE;
+		bandEnergies(axis, mean, unit, features.bandEnergy[axis]);
+
+		reference[axis] = (int16_t)lroundf(mean);
+	}
+
+	header.sequence = sequences[head];
+	header.timestampNs = timestamps[head];
+	sinceFlush = 0;
+
+	uint8_t frame[TELEMETRY_FRAME_FEATURES_SIZE];
+	size_t frameSize = TelemetryFrame_EncodeFeatures(frame, sizeof(frame), &header, &features);
+	if (flushHandler != NULL)
+		flushHandler(frame, frameSize);
+}
+
+/* declarations */
+int FeatureWindow_Init(uint16_t hopSamples, FeatureWindowFlushHandler flush) {
+	if (hopSamples < 1 || hopSamples > FEATURE_WINDOW_SIZE) {
+		Log_Debug("ERROR: Invalid feature window hop (%u samples)\n", hopSamples);
+		return -1;
+	}
+
+	hop = hopSamples;
+	flushHandler = flush;
+	buildTables();
+	FeatureWindow_Reset();
+	return 0;
+}
+
+void FeatureWindow_SetFormat(uint32_t samplePeriodNs, uint16_t accelFullScaleG, uint16_t gyroFullScaleDps) {
+	if (header.samplePeriodNs == samplePeriodNs && header.accelFullScaleG == accelFullScaleG
+		&& header.gyroFullScaleDps == gyroFullScaleDps)
+		return;
+
+	FeatureWindow_Reset();
+
+	header.samplePeriodNs = samplePeriodNs;
+	header.accelFullScaleG = accelFullScaleG;
+	header.gyroFullScaleDps = gyroFullScaleDps;
+}
+
+void FeatureWindow_AddSample(const TelemetrySample* sample, uint32_t sequence, uint64_t timestampNs) {
+	int16_t values[AXES] = {
+		sample->acceleration[0], sample->acceleration[1], sample->acceleration[2],
+		sample->angularRate[0], sample->angularRate[1], sample->angularRate[2]
+	};
+
+	if (!hasReference) {
+		memcpy(reference, values, sizeof(reference));
+		aboveReference = (uint8_t)((1 << AXES) - 1);
+		hasReference = true;
+	}
+
+	bool full = filled == FEATURE_WINDOW_SIZE;
+	uint8_t crossed = 0;
+
+	for (int axis = 0; axis < AXES; axis++) {
+		int16_t value = values[axis];
+
+		// Slide the oldest sample out of the running sums
+		if (full) {
+			int16_t old = window[axis][head];
+			sums[axis] -= old;
+			squareSums[axis] -= (int32_t)old * old;
+			crossingCounts[axis] -= (crossings[head] >> axis) & 1;
+		}
+
+		window[axis][head] = value;
+		sums[axis] += value;
+		squareSums[axis] += (int32_t)value * value;
+
+		uint8_t above = value >= reference[axis] ? 1 : 0;
+		if (above != ((aboveReference >> axis) & 1)) {
+			crossed |= (uint8_t)(1 << axis);
+			crossingCounts[axis]++;
+			aboveReference ^= (uint8_t)(1 << axis);
+		}
+	}
+
+	crossings[head] = crossed;
+	sequences[head] = sequence;
+	timestamps[head] = timestampNs;
+	head = (head + 1) & (FEATURE_WINDOW_SIZE - 1);
+	if (!full)
+		filled++;
+	sinceFlush++;
+
+	if (filled == FEATURE_WINDOW_SIZE && sinceFlush >= hop)
+		flushFeatures();
+}
+
+void FeatureWindow_Reset(void) {
+	head = 0;
+	filled = 0;
+	sinceFlush = 0;
+	hasReference = false;
+	aboveReference = 0;
+	memset(sums, 0, sizeof(sums));
+	memset(squareSums, 0, sizeof(squareSums));
+	memset(crossings, 0, sizeof(crossings));
+	memset(crossingCounts, 0, sizeof(crossingCounts));
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "telemetry_frame.h"
+
+/*
+* Sliding-window features of the accelerometer and gyroscope streams.  The last FEATURE_WINDOW_SIZE raw
+* samples are kept per axis; every hop samples the RMS, variance, zero-crossing rate and FFT band
+* energies of the window are published as one TELEMETRY_FRAME_FEATURES frame.
+*
+* Per sample only integer running sums and crossing counts are updated.  The FFT runs once per hop,
+* so for the fixed window size the cost per sample stays constant.
+*/
+
+// Window length in samples, a power of two.  Sizes the static sample buffers.
+#define FEATURE_WINDOW_SIZE 64
+
+/**
+* @brief Called with every features frame. The frame buffer is reused once the handler returns.
+*/
+typedef void (*FeatureWindowFlushHandler)(const uint8_t* frame, size_t frameSize);
+
+/**
+* @brief Set the hop and the frame handler, and build the FFT tables.
+*
+* @param hopSamples Samples between two feature frames, 1 to FEATURE_WINDOW_SIZE. Equal to
+* FEATURE_WINDOW_SIZE for back-to-back windows, smaller for overlapping ones.
+* @param flush Handler that publishes the features frames.
+* @return 0 on success, -1 if the hop is out of range.
+*/
+int FeatureWindow_Init(uint16_t hopSamples, FeatureWindowFlushHandler flush);
+
+/**
+* @brief Set the sample period and full scale of the following samples. The window restarts when
+* they change, so one window never mixes two formats.
+*/
+void FeatureWindow_SetFormat(uint32_t samplePeriodNs, uint16_t accelFullScaleG, uint16_t gyroFullScaleDps);
+
+/**
+* @brief Add a sample to the window, publishing the features when a hop completes.
+*
+* @param sample Raw sample.
+* @param sequence Sequence number of the sample.
+* @param timestampNs Device monotonic time of the sample.
+*/
+void FeatureWindow_AddSample(const TelemetrySample* sample, uint32_t sequence, uint64_t timestampNs);
+
+/**
+* @brief Drop the samples collected so far.
+*/
+void FeatureWindow_Reset(void);
@@ -36,12 +36,14 @@
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 // applibs_versions.h defines the API struct versions to use for applibs APIs.
 #include "applibs_versions.h"
 
 #include <applibs/log.h>
 #include <applibs/i2c.h>
+#include <applibs/storage.h>
 
 #include <hw/avnet_mt3620_sk.h>
 #include "deviceTwin.h"
@@ -49,6 +51,21 @@
 #include "build_options.h"
 #include "i2c.h"
 #include "lsm6dso_reg.h"
+#include "telemetry_frame.h"
+#include "telemetry_batch.h"
+#include "telemetry_ring.h"
+#include "sensor_units.h"
+#include "sensor_clock.h"
+#include "sensor_bus.h"
+#ifdef DRYNESS_ON_DEVICE
+#include "dryness_estimator.h"
+#endif
+#ifdef FEATURE_WINDOW_ENABLE
+#include "feature_window.h"
+#endif
+#ifdef LSM6DSO_ON_RT_CORE
+#include "rt_sampler.h"
+#endif
 
 // mqtt
 #include "mqtt_utilities.h"
@@ -56,20 +73,48 @@
 //const char* MQTT_ADDRESS = "ece1894.eastus.cloudapp.azure.com";
 const char* MQTT_ADDRESS = "20.62.169.88";
 const char* MQTT_TOPIC = "DryerTelemetry";
-int mqtt_message_counter = 0; // counts mqtt sequence
-
-// 6 * (7 characters of float representation + period + comma separator) + sequence number (10 digits in max int so 10 characters) + null terminator
-//#define MQTT_MESSAGE_SIZE 6*(9*sizeof(char)) + 10*sizeof(char) + sizeof(char)
-#define MQTT_MESSAGE_SIZE 150
+uint32_t mqtt_message_counter = 0; // counts samples, each frame carries the sequence number of its first sample
 
+// Frames waiting for the broker
+static uint8_t telemetryRingStorage[TELEMETRY_RING_SIZE_BYTES];
+static TelemetryRing telemetryRing;
+static uint32_t telemetryDropsReported = 0;
 
 /* Private variables ---------------------------------------------------------*/
 static axis3bit16_t data_raw_acceleration;
 static axis3bit16_t data_raw_angular_rate;
 static axis3bit16_t raw_angular_rate_calibration;
+#ifdef SENSOR_UNITS_FIXED_POINT
+static SensorScale sensorScale;
+static SensorValues sensorValues;
+#endif
 static float acceleration_mg[3];
 static float angular_rate_dps[3];
 
+// Current sensor settings, changed at runtime with setSensorConfig
+static SensorConfig sensorConfig = {
+#ifdef LSM6DSO_FIFO_ENABLE
+	.odrMilliHz = LSM6DSO_FIFO_ODR_MILLIHZ,
+	.pollPeriodNs = LSM6DSO_FIFO_READ_PERIOD_NANO_SECONDS,
+#else
+	.odrMilliHz = 12500,
+	.pollPeriodNs = ACCEL_READ_PERIOD_SECONDS * 1000000000ULL + ACCEL_READ_PERIOD_NANO_SECONDS,
+#endif
+	.accelFullScaleG = LSM6DSO_ACCEL_FULL_SCALE_G,
+	.gyroFullScaleDps = LSM6DSO_GYRO_FULL_SCALE_DPS,
+	.watermarkSamples = LSM6DSO_FIFO_WATERMARK_SAMPLES
+};
+
+#ifdef ACTIVITY_DETECTION_ENABLE
+// Set while the LSM6DSO reports no motion and runs at its low power rate
+static bool sensorIdle = false;
+#endif
+
+#ifdef LSM6DSO_ON_RT_CORE
+// Read period of the real-time sampler, taken from its frames
+static uint32_t rtSamplePeriodNs = 0;
+#endif
+
 static int gpioButtonFd;
 bool collect_samples = false;
 GPIO_Value_Type buttonState;
@@ -91,21 +136,220 @@ uint8_t RTCore_status = 1;
 int i2cFd = -1;
 extern int epollFd;
 extern volatile sig_atomic_t terminationRequired;
+#if defined(M0_INTERCORE_COMMS) || defined(LSM6DSO_ON_RT_CORE)
+extern float light_sensor;
+#endif
 
 //Private functions
 
-void publishMQTTMessageFromI2C(char *mqtt_message_string) {
-	int mqtt_status = MQTTIsActiveConnection();
+/// <summary>
+///     Picks the MQTT QoS/retain class from the frame type.
+/// </summary>
+static MQTTMessageClass MessageClassForFrame(const uint8_t *frame, size_t frameSize)
+{
+	TelemetryFrameHeader header;
+	if (TelemetryFrame_DecodeHeader(frame, frameSize, &header) != 0) {
+		return MQTT_CLASS_CONTROL;
+	}
+
+	switch (header.type) {
+	case TELEMETRY_FRAME_SAMPLES:
+	case TELEMETRY_FRAME_FEATURES:
+		return MQTT_CLASS_TELEMETRY;
+	case TELEMETRY_FRAME_DRYNESS:
+		return MQTT_CLASS_SUMMARY;
+	default:
+		return MQTT_CLASS_CONTROL;
+	}
+}
+
+/// <summary>
+///     Publishes queued frames, oldest first, for as long as the MQTT send buffer has room.
+///     Frames stay queued while the broker is unreachable; the MQTT client reconnects by itself.
+/// </summary>
+static void DrainTelemetryRing(void)
+{
+	if (telemetryRing.droppedFrames != telemetryDropsReported) {
+		Log_Debug("WARNING: telemetry ring full, %u frames dropped so far\n", telemetryRing.droppedFrames);
+		telemetryDropsReported = telemetryRing.droppedFrames;
+	}
+
+	if (!MQTTIsActiveConnection()) {
+		return;
+	}
+
+	size_t frameSize;
+	const uint8_t *frame;
+	while ((frame = TelemetryRing_Peek(&telemetryRing, &frameSize)) != NULL) {
+		// Leave the rest for the next tick once the send buffer is full
+		if (!MQTTCanPublish(MQTT_TOPIC, frameSize)) {
+			break;
+		}
+		// On failure the connection is closed and the frame stays queued for the reconnect
+		if (MQTTPublishBinary(MQTT_TOPIC, frame, frameSize, MessageClassForFrame(frame, frameSize)) != 0) {
+			break;
+		}
+		TelemetryRing_Pop(&telemetryRing);
+	}
+}
+
+/// <summary>
+///     Queues a completed frame and publishes as much of the queue as possible.
+/// </summary>
+void publishMQTTMessageFromI2C(const uint8_t *frame, size_t frameSize) {
+	TelemetryRing_Push(&telemetryRing, frame, frameSize);
+	DrainTelemetryRing();
+}
+
+const TelemetryRing *getTelemetryRing(void) {
+	return &telemetryRing;
+}
+
+#ifdef TELEMETRY_RING_PERSIST
+/// <summary>
+///     Loads frames saved by SaveTelemetryRing at the last exit, then clears the file.
+/// </summary>
+static void RestoreTelemetryRing(void)
+{
+	int storageFd = Storage_OpenMutableFile();
+	if (storageFd < 0) {
+		Log_Debug("ERROR: Could not open mutable storage: %s (%d).\n", strerror(errno), errno);
+		return;
+	}
+
+	int restored = TelemetryRing_Restore(&telemetryRing, storageFd);
+	if (restored > 0) {
+		Log_Debug("Restored %d telemetry frames from mutable storage\n", restored);
+	}
+
+	// Frames are only saved once, clear the file so they are not sent again after the next restart
+	ftruncate(storageFd, 0);
+	close(storageFd);
+}
+
+/// <summary>
+///     Saves frames that were not published yet to mutable storage.
+/// </summary>
+static void SaveTelemetryRing(void)
+{
+	if (telemetryRing.frames == 0) {
+		return;
+	}
+
+	int storageFd = Storage_OpenMutableFile();
+	if (storageFd < 0) {
+		Log_Debug("ERROR: Could not open mutable storage: %s (%d).\n", strerror(errno), errno);
+		return;
+	}
 
-	if(MQTTPublish(MQTT_TOPIC, mqtt_message_string) == 0) {
-		Log_Debug("%s: Tx Successful\n", mqtt_message_string);
-		mqtt_message_counter++;
+	ftruncate(storageFd, 0);
+	lseek(storageFd, 0, SEEK_SET);
+	if (TelemetryRing_Save(&telemetryRing, storageFd) != 0) {
+		Log_Debug("ERROR: Could not save telemetry frames: %s (%d).\n", strerror(errno), errno);
 	} else {
-		if(!mqtt_status) {
-			MQTTInit(MQTT_ADDRESS, "1883", MQTT_TOPIC);
+		Log_Debug("Saved %u telemetry frames to mutable storage\n", telemetryRing.frames);
+	}
+	close(storageFd);
+}
+#endif
+
+// ODR in mHz, indexed by lsm6dso_odr_xl_t.  The gyroscope ODR and the FIFO batch rates use the same values.
+static const uint32_t odrMilliHz[] = { 0, 12500, 26000, 52000, 104000, 208000, 417000, 833000, 1667000, 3333000, 6667000, 6500 };
+
+/// <summary>
+///     Finds the accelerometer ODR setting for a rate in mHz.  The 6.5 Hz low power rate has no
+///     gyroscope equivalent and is not accepted.
+/// </summary>
+/// <returns>0 on success, or -1 if the sensor has no such rate</returns>
+static int OdrFromMilliHz(uint32_t milliHz, lsm6dso_odr_xl_t *odr)
+{
+	for (int setting = LSM6DSO_XL_ODR_12Hz5; setting <= LSM6DSO_XL_ODR_6667Hz; setting++) {
+		if (odrMilliHz[setting] == milliHz) {
+			*odr = (lsm6dso_odr_xl_t)setting;
+			return 0;
 		}
-		publishMQTTMessageFromI2C(mqtt_message_string);
 	}
+	return -1;
+}
+
+/// <summary>
+///     Returns the time between samples at the current output data rate.
+/// </summary>
+static uint32_t SamplePeriodNs(void)
+{
+#ifdef LSM6DSO_ON_RT_CORE
+	// The real-time core reads at its own timer period, not at the ODR
+	if (rtSamplePeriodNs != 0) {
+		return rtSamplePeriodNs;
+	}
+#endif
+	return (uint32_t)(1000000000000ULL / sensorConfig.odrMilliHz);
+}
+
+/// <summary>
+///     Converts a period in ns to a timespec for the timerfd helpers.
+/// </summary>
+static struct timespec NsToTimespec(uint64_t ns)
+{
+	struct timespec ts = { .tv_sec = (time_t)(ns / 1000000000ULL), .tv_nsec = (long)(ns % 1000000000ULL) };
+	return ts;
+}
+
+/// <summary>
+///     Returns the device monotonic time in ns, used to timestamp telemetry frames.
+/// </summary>
+static uint64_t MonotonicNs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/// <summary>
+///     Reads the LSM6DSO timestamp counter.
+/// </summary>
+static int ReadSensorTicks(uint32_t *ticks)
+{
+	uint8_t raw[4];
+	if (lsm6dso_timestamp_raw_get(&dev_ctx, raw) != 0) {
+		return -1;
+	}
+	*ticks = (uint32_t)raw[0] | ((uint32_t)raw[1] << 8) | ((uint32_t)raw[2] << 16) | ((uint32_t)raw[3] << 24);
+	return 0;
+}
+
+/// <summary>
+///     Reads the timestamp counter together with the monotonic clock and adds the pair as a sync
+///     point, stamped in the middle of the I2C transfer.
+/// </summary>
+/// <param name="ticks">Receives the counter value, may be NULL</param>
+static void SyncSensorClock(uint32_t *ticks)
+{
+	uint64_t before = MonotonicNs();
+	uint32_t now;
+	if (ReadSensorTicks(&now) != 0) {
+		return;
+	}
+	uint64_t after = MonotonicNs();
+
+	SensorClock_Sync(now, before + (after - before) / 2);
+	if (ticks != NULL) {
+		*ticks = now;
+	}
+}
+
+/// <summary>
+///     Enables the LSM6DSO timestamp counter and starts the clock mapping with its trimmed tick period.
+/// </summary>
+static void StartSensorClock(void)
+{
+	// Nominal 25 us per tick, corrected by 0.15 % per INTERNAL_FREQ_FINE step (datasheet)
+	int8_t freqFine = 0;
+	lsm6dso_read_reg(&dev_ctx, LSM6DSO_INTERNAL_FREQ_FINE, (uint8_t *)&freqFine, 1);
+	SensorClock_Init(25000.0 / (1.0 + 0.0015 * freqFine));
+
+	lsm6dso_timestamp_set(&dev_ctx, PROPERTY_ENABLE);
+	SyncSensorClock(NULL);
 }
 
 // Routines to read/write to the LSM6DSO device
@@ -122,13 +366,543 @@ void HAL_Delay(int delayTime) {
 	nanosleep(&ts, NULL);
 }
 
+/// <summary>
+///     Maps full scales in g and dps to the LSM6DSO register settings.
+/// </summary>
+/// <returns>0 on success, or -1 if the sensor has no such full scale</returns>
+static int FullScaleSettings(uint16_t accelFullScaleG, uint16_t gyroFullScaleDps,
+	lsm6dso_fs_xl_t *accelFullScale, lsm6dso_fs_g_t *gyroFullScale)
+{
+	switch (accelFullScaleG) {
+	case 2: *accelFullScale = LSM6DSO_2g; break;
+	case 4: *accelFullScale = LSM6DSO_4g; break;
+	case 8: *accelFullScale = LSM6DSO_8g; break;
+	case 16: *accelFullScale = LSM6DSO_16g; break;
+	default: return -1;
+	}
+
+	switch (gyroFullScaleDps) {
+	case 125: *gyroFullScale = LSM6DSO_125dps; break;
+	case 250: *gyroFullScale = LSM6DSO_250dps; break;
+	case 500: *gyroFullScale = LSM6DSO_500dps; break;
+	case 1000: *gyroFullScale = LSM6DSO_1000dps; break;
+	case 2000: *gyroFullScale = LSM6DSO_2000dps; break;
+	default: return -1;
+	}
+
+	return 0;
+}
+
+/// <summary>
+///     Converts a raw gyroscope value to dps for the configured full scale.
+/// </summary>
+static float GyroToDps(int16_t raw)
+{
+#ifdef SENSOR_UNITS_FIXED_POINT
+	return SensorUnits_GyroToMdps(&sensorScale, raw) / 1000.0f;
+#else
+	return (float)raw * 0.000035f * sensorConfig.gyroFullScaleDps;
+#endif
+}
+
+#ifdef ACTIVITY_DETECTION_ENABLE
+/// <summary>
+///     Programs the wake-up threshold and inactivity time, which the LSM6DSO counts in steps of the
+///     full scale and of the ODR.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int WriteActivityConfig(const SensorConfig *config)
+{
+	// Threshold in steps of FS / 256, 6 bits
+	uint32_t threshold = (ACTIVITY_WAKEUP_THRESHOLD_MG * 256U + config->accelFullScaleG * 500U) / (config->accelFullScaleG * 1000U);
+	threshold = threshold < 1 ? 1 : (threshold > 63 ? 63 : threshold);
+
+	// Inactivity time in steps of 512 / ODR, 4 bits.  The longest time is about 18 s at 417 Hz.
+	uint64_t duration = ((uint64_t)ACTIVITY_SLEEP_SECONDS * config->odrMilliHz + 511999) / 512000;
+	duration = duration < 1 ? 1 : (duration > 15 ? 15 : duration);
+
+	// The activity function only runs with the basic interrupts enabled
+	lsm6dso_tap_cfg2_t tapCfg2;
+	if (lsm6dso_read_reg(&dev_ctx, LSM6DSO_TAP_CFG2, (uint8_t *)&tapCfg2, 1) != 0) {
+		return -1;
+	}
+	tapCfg2.interrupts_enable = PROPERTY_ENABLE;
+
+	// Wake up on the first sample over the threshold
+	if (lsm6dso_write_reg(&dev_ctx, LSM6DSO_TAP_CFG2, (uint8_t *)&tapCfg2, 1) != 0
+		|| lsm6dso_wkup_ths_weight_set(&dev_ctx, LSM6DSO_LSb_FS_DIV_256) != 0
+		|| lsm6dso_wkup_threshold_set(&dev_ctx, (uint8_t)threshold) != 0
+		|| lsm6dso_wkup_dur_set(&dev_ctx, 0) != 0
+		|| lsm6dso_act_sleep_dur_set(&dev_ctx, (uint8_t)duration) != 0) {
+		return -1;
+	}
+	return 0;
+}
+#endif
+
+/// <summary>
+///     Writes the output data rate and full scale of both sensors.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int WriteSensorConfig(const SensorConfig *config)
+{
+	lsm6dso_odr_xl_t odr;
+	lsm6dso_fs_xl_t accelFullScale;
+	lsm6dso_fs_g_t gyroFullScale;
+	if (OdrFromMilliHz(config->odrMilliHz, &odr) != 0
+		|| FullScaleSettings(config->accelFullScaleG, config->gyroFullScaleDps, &accelFullScale, &gyroFullScale) != 0) {
+		return -1;
+	}
+
+	// CTRL1_XL and CTRL2_G are adjacent, the rates and full scales go out as one write
+	SensorBus_BeginBatch();
+	int result = 0;
+	if (lsm6dso_xl_full_scale_set(&dev_ctx, accelFullScale) != 0
+		|| lsm6dso_gy_full_scale_set(&dev_ctx, gyroFullScale) != 0
+		|| lsm6dso_xl_data_rate_set(&dev_ctx, odr) != 0
+		|| lsm6dso_gy_data_rate_set(&dev_ctx, (lsm6dso_odr_g_t)odr) != 0) {
+		result = -1;
+	}
+#ifdef ACTIVITY_DETECTION_ENABLE
+	if (result == 0) {
+		result = WriteActivityConfig(config);
+	}
+#endif
+	if (SensorBus_EndBatch() != 0) {
+		result = -1;
+	}
+	return result;
+}
+
+/// <summary>
+///     Passes the current sample period and full scale on to everything that converts or publishes
+///     samples.  Batches and windows collected with the old settings are flushed or dropped first.
+/// </summary>
+static void ApplySensorFormat(void)
+{
+#ifdef SENSOR_UNITS_FIXED_POINT
+	SensorUnits_GetScale(sensorConfig.accelFullScaleG, sensorConfig.gyroFullScaleDps, &sensorScale);
+#endif
+	TelemetryBatch_SetFormat(SamplePeriodNs(), sensorConfig.accelFullScaleG, sensorConfig.gyroFullScaleDps);
+#ifdef FEATURE_WINDOW_ENABLE
+	FeatureWindow_SetFormat(SamplePeriodNs(), sensorConfig.accelFullScaleG, sensorConfig.gyroFullScaleDps);
+#endif
+#ifdef DRYNESS_ON_DEVICE
+	DrynessEstimator_SetFormat(sensorConfig.accelFullScaleG, sensorConfig.gyroFullScaleDps);
+#endif
+}
+
+/// <summary>
+///     Adds one accelerometer/gyroscope sample pair to the telemetry batch that is published over MQTT.
+/// </summary>
+/// <param name="timestampNs">Time the sensor took the sample, on the device monotonic clock</param>
+static void ProcessSample(const int16_t *rawAcceleration, const int16_t *rawAngularRate, uint64_t timestampNs)
+{
+	// Before we store the angular rate subtract the calibration data we captured at startup.
+	TelemetrySample sample;
+	for (int axis = 0; axis < 3; axis++) {
+		sample.acceleration[axis] = rawAcceleration[axis];
+		sample.angularRate[axis] = (int16_t)(rawAngularRate[axis] - raw_angular_rate_calibration.i16bit[axis]);
+	}
+
+#ifdef SENSOR_UNITS_FIXED_POINT
+	// Integer only: the frames carry the raw values, these are for the log and the IoT Hub telemetry
+	SensorUnits_Convert(&sensorScale, sample.acceleration, sample.angularRate, &sensorValues);
+
+#ifdef ENABLE_SAMPLE_DEBUG
+	char text[6][16];
+	for (int axis = 0; axis < 3; axis++) {
+		SensorUnits_FormatMilli(sensorValues.accelerationUg[axis], text[axis]);
+		SensorUnits_FormatMilli(sensorValues.angularRateMdps[axis], text[3 + axis]);
+	}
+	Log_Debug("\nLSM6DSO: Acceleration [mg]  : %s, %s, %s\n", text[0], text[1], text[2]);
+	Log_Debug("LSM6DSO: Angular rate [dps] : %s, %s, %s\r\n", text[3], text[4], text[5]);
+#endif
+#else
+	for (int axis = 0; axis < 3; axis++) {
+		acceleration_mg[axis] = (float)sample.acceleration[axis] * 0.0305f * sensorConfig.accelFullScaleG;
+		angular_rate_dps[axis] = GyroToDps(sample.angularRate[axis]);
+	}
+
+#ifdef ENABLE_SAMPLE_DEBUG
+	Log_Debug("\nLSM6DSO: Acceleration [mg]  : %.4lf, %.4lf, %.4lf\n",
+		acceleration_mg[0], acceleration_mg[1], acceleration_mg[2]);
+	Log_Debug("LSM6DSO: Angular rate [dps] : %4.2f, %4.2f, %4.2f\r\n",
+		angular_rate_dps[0], angular_rate_dps[1], angular_rate_dps[2]);
+#endif
+#endif
+
+	uint32_t sequence = mqtt_message_counter++;
+	bool publishRaw = true;
+
+#ifdef DRYNESS_ON_DEVICE
+	DrynessEstimator_AddSample(&sample, sequence);
+#ifndef DRYNESS_KEEP_RAW_UPLINK
+	// Once a model is loaded only the dryness estimate goes out
+	publishRaw = !DrynessEstimator_HasModel();
+#endif
+#endif
+
+#ifdef FEATURE_WINDOW_ENABLE
+	// One features frame per hop replaces the raw samples, unless they are kept for training data
+	FeatureWindow_AddSample(&sample, sequence, timestampNs);
+#ifndef DRYNESS_KEEP_RAW_UPLINK
+	publishRaw = false;
+#endif
+#endif
+
+	// The frame is published once it holds TELEMETRY_BATCH_SAMPLES samples or the latency deadline passes
+	if (publishRaw) {
+		TelemetryBatch_AddSample(&sample, sequence, timestampNs);
+	}
+}
+
+// STATUS_REG through OUTZ_H_A: status, reserved, temperature, gyro XYZ and accel XYZ
+#define LSM6DSO_ALL_OUTPUTS_SIZE (LSM6DSO_OUTZ_H_A - LSM6DSO_STATUS_REG + 1)
+
+/// <summary>
+///     Reads STATUS_REG and the gyroscope and accelerometer output registers with a single
+///     auto-increment I2C transaction instead of two flag reads plus two data reads.
+/// </summary>
+/// <param name="status">Receives the STATUS_REG value (XLDA/GDA/TDA flags)</param>
+/// <param name="angularRate">Receives the raw gyroscope X, Y, Z values</param>
+/// <param name="acceleration">Receives the raw accelerometer X, Y, Z values</param>
+/// <returns>0 on success, or -1 on failure</returns>
+static int ReadAllOutputs(uint8_t *status, int16_t *angularRate, int16_t *acceleration)
+{
+	uint8_t outputs[LSM6DSO_ALL_OUTPUTS_SIZE];
+
+	if (lsm6dso_read_reg(&dev_ctx, LSM6DSO_STATUS_REG, outputs, sizeof(outputs)) != 0) {
+		return -1;
+	}
+
+	*status = outputs[0];
+
+	const uint8_t *gyro = &outputs[LSM6DSO_OUTX_L_G - LSM6DSO_STATUS_REG];
+	const uint8_t *accel = &outputs[LSM6DSO_OUTX_L_A - LSM6DSO_STATUS_REG];
+	for (int axis = 0; axis < 3; axis++) {
+		angularRate[axis] = (int16_t)(gyro[2 * axis + 1] << 8 | gyro[2 * axis]);
+		acceleration[axis] = (int16_t)(accel[2 * axis + 1] << 8 | accel[2 * axis]);
+	}
+
+	return 0;
+}
+
+#ifdef LSM6DSO_FIFO_ENABLE
+// Each FIFO word is a tag byte followed by three little-endian 16 bit axes.
+#define LSM6DSO_FIFO_WORD_SIZE 7
+// Largest number of FIFO words pulled in one I2C burst.  Anything left over is read by the next burst.
+#define LSM6DSO_FIFO_MAX_BURST_WORDS 64
+// The 3 KB FIFO holds this many words
+#define LSM6DSO_FIFO_CAPACITY_WORDS 438
+// Largest value of the 9 bit watermark register
+#define LSM6DSO_FIFO_MAX_WATERMARK_WORDS 511
+
+static uint8_t fifoBuffer[LSM6DSO_FIFO_MAX_BURST_WORDS * LSM6DSO_FIFO_WORD_SIZE];
+static uint32_t fifoOverrunCount = 0;
+
+/// <summary>
+///     Configures the FIFO to batch accel and gyro words in continuous (stream) mode.
+/// </summary>
+static void StartFifo(void)
+{
+	// Going through bypass mode empties anything already queued in the FIFO
+	lsm6dso_fifo_mode_set(&dev_ctx, LSM6DSO_BYPASS_MODE);
+
+	// FIFO_CTRL1 to FIFO_CTRL4 are written together, stream mode starts with the rest of the settings
+	SensorBus_BeginBatch();
+	lsm6dso_fifo_watermark_set(&dev_ctx, (uint16_t)(LSM6DSO_FIFO_WORDS_PER_SAMPLE * sensorConfig.watermarkSamples));
+
+	// Batch both sensors at the output data rate, the batch rate settings use the same values as the ODR
+	lsm6dso_odr_xl_t odr;
+	if (OdrFromMilliHz(sensorConfig.odrMilliHz, &odr) == 0) {
+		lsm6dso_fifo_xl_batch_set(&dev_ctx, (lsm6dso_bdr_xl_t)odr);
+		lsm6dso_fifo_gy_batch_set(&dev_ctx, (lsm6dso_bdr_gy_t)odr);
+	}
+	lsm6dso_fifo_timestamp_decimation_set(&dev_ctx, LSM6DSO_FIFO_TS_DECIMATION);
+	lsm6dso_fifo_mode_set(&dev_ctx, LSM6DSO_STREAM_MODE);
+	SensorBus_EndBatch();
+}
+
+/// <summary>
+///     Stops batching so the FIFO does not fill up while samples are not being collected.
+/// </summary>
+static void StopFifo(void)
+{
+	lsm6dso_fifo_mode_set(&dev_ctx, LSM6DSO_BYPASS_MODE);
+}
+
+/// <summary>
+///     Drains every word currently queued in the LSM6DSO FIFO.  The words are fetched with one
+///     auto-increment burst read starting at FIFO_DATA_OUT_TAG (the address rolls back to the tag
+///     register after FIFO_DATA_OUT_Z_H), then paired up into accel/gyro samples.
+/// </summary>
+static void DrainFifo(void)
+{
+	static int16_t lastAcceleration[3];
+	static int16_t lastAngularRate[3];
+	static bool haveAcceleration = false;
+	static bool haveAngularRate = false;
+
+	// TAG_CNT of the last word of each sensor, the words of one sample share it
+	static uint8_t accelerationCount;
+	static uint8_t angularRateCount;
+
+	// Last timestamp word and the samples completed since; samples between two timestamp words
+	// (decimation above 1) are placed one ODR period apart
+	static uint32_t lastTicks;
+	static uint32_t samplesSinceTicks = 0;
+	static bool haveTicks = false;
+
+	// FIFO_STATUS1 and FIFO_STATUS2 are adjacent, read them together
+	uint8_t fifoStatus[2];
+	if (lsm6dso_read_reg(&dev_ctx, LSM6DSO_FIFO_STATUS1, fifoStatus, sizeof(fifoStatus)) != 0) {
+		return;
+	}
+
+	uint16_t wordsQueued = (uint16_t)(((fifoStatus[1] & 0x03) << 8) | fifoStatus[0]);
+	if (((lsm6dso_fifo_status2_t *)&fifoStatus[1])->fifo_ovr_ia) {
+		fifoOverrunCount++;
+		Log_Debug("WARNING: LSM6DSO FIFO overrun, samples were lost (%u overruns)\n", fifoOverrunCount);
+	}
+
+	// One sync point per drain keeps the sensor clock mapping locked to the monotonic clock
+	SyncSensorClock(NULL);
+	uint32_t periodTicks = (uint32_t)(SamplePeriodNs() / SensorClock_TickNs() + 0.5);
+
+	while (wordsQueued > 0) {
+		uint16_t words = wordsQueued > LSM6DSO_FIFO_MAX_BURST_WORDS ? LSM6DSO_FIFO_MAX_BURST_WORDS : wordsQueued;
+		if (lsm6dso_read_reg(&dev_ctx, LSM6DSO_FIFO_DATA_OUT_TAG, fifoBuffer, words * LSM6DSO_FIFO_WORD_SIZE) != 0) {
+			return;
+		}
+		wordsQueued -= words;
+
+		for (uint16_t i = 0; i < words; i++) {
+			const uint8_t *word = &fifoBuffer[i * LSM6DSO_FIFO_WORD_SIZE];
+			int16_t *axes;
+
+			const lsm6dso_fifo_data_out_tag_t *tag = (const lsm6dso_fifo_data_out_tag_t *)word;
+			switch (tag->tag_sensor) {
+			case LSM6DSO_XL_NC_TAG:
+				axes = lastAcceleration;
+				haveAcceleration = true;
+				accelerationCount = tag->tag_cnt;
+				break;
+			case LSM6DSO_GYRO_NC_TAG:
+				axes = lastAngularRate;
+				haveAngularRate = true;
+				angularRateCount = tag->tag_cnt;
+				break;
+			case LSM6DSO_TIMESTAMP_TAG:
+				lastTicks = (uint32_t)word[1] | ((uint32_t)word[2] << 8) | ((uint32_t)word[3] << 16) | ((uint32_t)word[4] << 24);
+				samplesSinceTicks = 0;
+				haveTicks = true;
+				continue;
+			default:
+				continue;
+			}
+
+			for (int axis = 0; axis < 3; axis++) {
+				axes[axis] = (int16_t)(word[2 + 2 * axis] << 8 | word[1 + 2 * axis]);
+			}
+
+			// Both sensors batch at the same rate, so one word of each makes a sample.  While the sensor
+			// sleeps only the accelerometer batches, and its words are replaced before a gyroscope word
+			// with the same count comes along.
+			if (haveAcceleration && haveAngularRate && accelerationCount == angularRateCount) {
+				uint64_t timestampNs = haveTicks
+					? SensorClock_ToNs(lastTicks + samplesSinceTicks * periodTicks)
+					: MonotonicNs();
+				samplesSinceTicks++;
+				ProcessSample(lastAcceleration, lastAngularRate, timestampNs);
+				haveAcceleration = false;
+				haveAngularRate = false;
+			}
+		}
+	}
+}
+#endif
+
+/// <summary>
+///     Sets the poll timer to the configured period, or to the idle period while the sensor sleeps.
+/// </summary>
+static void SetPollPeriod(void)
+{
+	uint64_t periodNs = sensorConfig.pollPeriodNs;
+
+#ifdef ACTIVITY_DETECTION_ENABLE
+	if (sensorIdle) {
+		periodNs = (uint64_t)ACTIVITY_IDLE_POLL_MS * 1000000ULL;
+#ifdef LSM6DSO_FIFO_ENABLE
+		// Samples taken once the dryer starts again wait in the FIFO for the next poll, which must come
+		// before the FIFO fills up at the full rate
+		uint64_t fillNs = (uint64_t)(LSM6DSO_FIFO_CAPACITY_WORDS * 3 / 4 / LSM6DSO_FIFO_WORDS_PER_SAMPLE)
+			* 1000000000000ULL / sensorConfig.odrMilliHz;
+		if (fillNs < periodNs) {
+			periodNs = fillNs;
+		}
+#endif
+		if (periodNs < sensorConfig.pollPeriodNs) {
+			periodNs = sensorConfig.pollPeriodNs;
+		}
+	}
+#endif
+
+	struct timespec period = NsToTimespec(periodNs);
+	SetTimerFdToPeriod(accelTimerFd, &period);
+}
+
+#ifdef ACTIVITY_DETECTION_ENABLE
+/// <summary>
+///     Reads the LSM6DSO sleep state and slows down or speeds up the poll timer when it changes.
+///     The sensor switches its own ODR: it drops to 12.5 Hz with the gyroscope asleep after
+///     ACTIVITY_SLEEP_SECONDS without motion, and returns to the configured ODR with the first
+///     sample over the wake-up threshold.  The FIFO keeps batching through both changes.
+/// </summary>
+static void UpdateActivity(void)
+{
+	lsm6dso_wake_up_src_t wakeUpSource;
+	if (lsm6dso_read_reg(&dev_ctx, LSM6DSO_WAKE_UP_SRC, (uint8_t *)&wakeUpSource, 1) != 0) {
+		return;
+	}
+
+	bool idle = wakeUpSource.sleep_state;
+	if (idle == sensorIdle) {
+		return;
+	}
+	sensorIdle = idle;
+
+	if (idle) {
+		Log_Debug("LSM6DSO: No motion, sampling at 12.5 Hz until the dryer moves\n");
+	}
+	else {
+		Log_Debug("LSM6DSO: Motion detected, sampling at %u mHz\n", sensorConfig.odrMilliHz);
+	}
+	SetPollPeriod();
+}
+#endif
+
+#ifdef LSM6DSO_ON_RT_CORE
+/// <summary>
+///     Takes one sample read by the real-time core.  Ticks the real-time core missed advance the
+///     sequence number as well, so the gap shows up in the published frames.
+/// </summary>
+static void RtSampleHandler(const TelemetryFrameHeader *format, const TelemetrySample *sample, uint32_t tick, uint64_t timestampNs)
+{
+	static bool started = false;
+	static uint32_t nextTick = 0;
+
+	if (format->samplePeriodNs != rtSamplePeriodNs || format->accelFullScaleG != sensorConfig.accelFullScaleG
+		|| format->gyroFullScaleDps != sensorConfig.gyroFullScaleDps) {
+		rtSamplePeriodNs = format->samplePeriodNs;
+		sensorConfig.odrMilliHz = (uint32_t)((1000000000000ULL + rtSamplePeriodNs / 2) / rtSamplePeriodNs);
+		sensorConfig.accelFullScaleG = format->accelFullScaleG;
+		sensorConfig.gyroFullScaleDps = format->gyroFullScaleDps;
+		ApplySensorFormat();
+	}
+
+	if (!collect_samples) {
+		started = false;
+		return;
+	}
+
+	if (started && (int32_t)(tick - nextTick) > 0) {
+		mqtt_message_counter += tick - nextTick;
+	}
+	started = true;
+	nextTick = tick + 1;
+
+	ProcessSample(sample->acceleration, sample->angularRate, timestampNs);
+}
+
+/// <summary>
+///     Takes a block of decimated ADC readings from the real-time core.  Rows the real-time core
+///     could not send show up as a gap in the row index.  ADC channel 0 is the starter kit's ALS-PT19
+///     ambient light sensor: the mean of the block becomes light_sensor, as the M0 application's
+///     readings did.
+/// </summary>
+static void RtAdcHandler(const IntercoreAdcBlock *block, const uint8_t *payload)
+{
+	static bool started = false;
+	static uint32_t nextIndex = 0;
+
+	if (started && (int32_t)(block->firstIndex - nextIndex) > 0) {
+		Log_Debug("ERROR: Real-time core dropped %u ADC rows\n", block->firstIndex - nextIndex);
+	}
+	started = true;
+	nextIndex = block->firstIndex + block->count;
+
+	// Channel 0 comes first in every row when it is captured
+	if ((block->channelMask & 1) && block->count > 0) {
+		uint32_t sum = 0;
+		for (uint16_t row = 0; row < block->count; row++) {
+			sum += IntercoreMessage_AdcValue(payload, block, row, 0);
+		}
+
+		// Same conversion as the M0 readings: 2.5 V reference, 3.65 kohm load, 0.1428 uA per lux.  The
+		// values are in 1/16 LSB.
+		float adc = (float)sum / (16.0f * block->count);
+		light_sensor = (adc * 2.5f / 4095) * 1000000 / (3650 * 0.1428f);
+	}
+
+#ifdef ENABLE_SAMPLE_DEBUG
+	// Newest row, the values are in 1/16 LSB
+	uint8_t channels = IntercoreMessage_AdcChannels(block->channelMask);
+	for (uint8_t column = 0; column < channels && block->count > 0; column++) {
+		uint16_t value = IntercoreMessage_AdcValue(payload, block, (uint16_t)(block->count - 1), column);
+		Log_Debug("ADC: column %u : %u.%02u LSB\n", column, value / 16, (value % 16) * 100 / 16);
+	}
+#endif
+}
+#endif
+
+#ifdef LSM6DSO_INT1_GPIO
+static int int1GpioFd = -1;
+
+/// <summary>
+///     Routes the FIFO watermark, or the gyroscope data ready flag without the FIFO, to INT1 and
+///     opens the GPIO it is wired to.  Both stay high until the data is read.
+/// </summary>
+/// <returns>0 on success, or -1 on failure</returns>
+static int StartInt1(void)
+{
+	lsm6dso_pin_int1_route_t route;
+	if (lsm6dso_pin_int1_route_get(&dev_ctx, &route) != 0) {
+		return -1;
+	}
+#ifdef LSM6DSO_FIFO_ENABLE
+	route.int1_ctrl.int1_fifo_th = PROPERTY_ENABLE;
+#else
+	route.int1_ctrl.int1_drdy_g = PROPERTY_ENABLE;
+#endif
+	if (lsm6dso_pin_int1_route_set(&dev_ctx, &route) != 0) {
+		return -1;
+	}
+
+	int1GpioFd = GPIO_OpenAsInput(LSM6DSO_INT1_GPIO);
+	if (int1GpioFd == -1) {
+		Log_Debug("ERROR: Could not open the LSM6DSO INT1 GPIO: %s (%d).\n", strerror(errno), errno);
+		return -1;
+	}
+	return 0;
+}
+
+/// <summary>
+///     Reads the INT1 level.  This does not touch the I2C bus, so polling it is cheap.
+/// </summary>
+/// <returns>true if the sensor has data, or if the pin could not be read</returns>
+static bool Int1Asserted(void)
+{
+	GPIO_Value_Type level;
+	return GPIO_GetValue(int1GpioFd, &level) != 0 || level == GPIO_Value_High;
+}
+#endif
+
 /// <summary>
 ///     Print latest data from on-board sensors.
 /// </summary>
 void AccelTimerEventHandler(EventData *eventData)
 {
-	uint8_t reg;
-
 #ifdef IOT_HUB_APPLICATION
 	static bool firstPass = true;
 #endif
@@ -145,96 +919,80 @@ void AccelTimerEventHandler(EventData *eventData)
 		if(newButtonState == GPIO_Value_Low) {
 			collect_samples = !collect_samples; // toggle sample collection when button is pressed.
 			Log_Debug("Collect Sample State set to: %d\n", collect_samples);
+#ifdef LSM6DSO_FIFO_ENABLE
+			// Start from an empty FIFO so stale samples aren't published when collection resumes
+			if (collect_samples) {
+				StartFifo();
+			} else {
+				StopFifo();
+			}
+#endif
 		}
 	}
 
 	buttonState = newButtonState; // store state
 
+	// Send whatever is queued, this also catches up after the broker comes back
+	DrainTelemetryRing();
+
 
+#ifndef LSM6DSO_ON_RT_CORE
 	// Read the sensors on the lsm6dso device
 
 	//Read output only if new xl value is available
 	
-	if(collect_samples) {
-	
-		lsm6dso_xl_flag_data_ready_get(&dev_ctx, &reg);
-		if (reg)
-		{
-			// Read acceleration field data
-			memset(data_raw_acceleration.u8bit, 0x00, 3 * sizeof(int16_t));
-			lsm6dso_acceleration_raw_get(&dev_ctx, data_raw_acceleration.u8bit);
+	bool readSensor = collect_samples;
 
-			acceleration_mg[0] = lsm6dso_from_fs4_to_mg(data_raw_acceleration.i16bit[0]);
-			acceleration_mg[1] = lsm6dso_from_fs4_to_mg(data_raw_acceleration.i16bit[1]);
-			acceleration_mg[2] = lsm6dso_from_fs4_to_mg(data_raw_acceleration.i16bit[2]);
+	// Without INT1 the sensor is read on every poll
+	bool dataReady = true;
+#ifdef LSM6DSO_INT1_GPIO
+	dataReady = Int1Asserted();
+#endif
 
-			Log_Debug("\nLSM6DSO: Acceleration [mg]  : %.4lf, %.4lf, %.4lf\n",
-				acceleration_mg[0], acceleration_mg[1], acceleration_mg[2]);
+#ifdef ACTIVITY_DETECTION_ENABLE
+	// INT1 rises at least once per watermark while the sensor is awake.  While it sleeps the wake-up
+	// source is checked on every (slow) poll.
+	if (collect_samples && (dataReady || sensorIdle)) {
+#ifdef LSM6DSO_FIFO_ENABLE
+		// The FIFO stays in stream mode while the sensor sleeps, so the full rate samples from the
+		// moment it wakes up are batched.  Idle polls drain it below the watermark as well: the 12.5 Hz
+		// accelerometer words have no gyroscope word to pair with and are dropped there.
+		UpdateActivity();
+		dataReady = true;
+#else
+		// The samples up to the moment the sensor fell asleep are still read once, after that the
+		// identical low rate samples are not collected
+		bool wasIdle = sensorIdle;
+		UpdateActivity();
+		if (wasIdle && sensorIdle) {
+			readSensor = false;
 		}
+#endif
+	}
+#endif
 
-		lsm6dso_gy_flag_data_ready_get(&dev_ctx, &reg);
-		if (reg)
-		{
-			// Read angular rate field data
-			memset(data_raw_angular_rate.u8bit, 0x00, 3 * sizeof(int16_t));
-			lsm6dso_angular_rate_raw_get(&dev_ctx, data_raw_angular_rate.u8bit);
-
-			// Before we store the mdps values subtract the calibration data we captured at startup.
-			angular_rate_dps[0] = (lsm6dso_from_fs2000_to_mdps(data_raw_angular_rate.i16bit[0] - raw_angular_rate_calibration.i16bit[0])) / 1000.0;
-			angular_rate_dps[1] = (lsm6dso_from_fs2000_to_mdps(data_raw_angular_rate.i16bit[1] - raw_angular_rate_calibration.i16bit[1])) / 1000.0;
-			angular_rate_dps[2] = (lsm6dso_from_fs2000_to_mdps(data_raw_angular_rate.i16bit[2] - raw_angular_rate_calibration.i16bit[2])) / 1000.0;
-
-			
-
-			Log_Debug("LSM6DSO: Angular rate [dps] : %4.2f, %4.2f, %4.2f\r\n",
-				angular_rate_dps[0], angular_rate_dps[1], angular_rate_dps[2]);
-
-		}
-		
-		// send message
-		if(reg)
-		{
-			// char *mqtt_message_string = (char*)malloc(MQTT_MESSAGE_SIZE);
-
-			size_t mqtt_message_size = snprintf(NULL, 0, "%d,%f,%f,%f,%f,%f,%f", mqtt_message_counter,
-				acceleration_mg[0], 
-				acceleration_mg[1], 
-				acceleration_mg[2],
-				angular_rate_dps[0],
-				angular_rate_dps[1],
-				angular_rate_dps[2]
-			) + 1;
-
-			char *mqtt_message_string = (char *)malloc(mqtt_message_size);
-			sprintf(mqtt_message_string, "%d,%f,%f,%f,%f,%f,%f", mqtt_message_counter,
-				acceleration_mg[0], 
-				acceleration_mg[1], 
-				acceleration_mg[2],
-				angular_rate_dps[0],
-				angular_rate_dps[1],
-				angular_rate_dps[2]
-			);
-
-			//Log_Debug(mqtt_message_string);
-			//Log_Debug("\n");
-			
-			
-
-			publishMQTTMessageFromI2C(mqtt_message_string); // publish message
-
-					
-					// char *mqtt_failure_string = (char*)malloc(sizeof(MQTT_MESSAGE_SIZE) + 25);
-					// sprintf(mqtt_failure_string, "%s: No TX\n", mqtt_message_string);
-					// Log_Debug(mqtt_failure_string);
-
-					// if(mqtt_failure_string != NULL) free(mqtt_failure_string);
-					// mqtt_failure_string = NULL;
-		
-			
-			free(mqtt_message_string);
-			mqtt_message_string = NULL;
+	if(readSensor && dataReady) {
+#ifdef LSM6DSO_FIFO_ENABLE
+		DrainFifo();
+#else
+		uint8_t status;
+
+		// One transaction fetches the data ready flags and both output register groups
+		if (ReadAllOutputs(&status, data_raw_angular_rate.i16bit, data_raw_acceleration.i16bit) == 0) {
+			lsm6dso_status_reg_t *statusReg = (lsm6dso_status_reg_t *)&status;
+
+			// send message when a new angular rate sample is available
+			if (statusReg->gda) {
+				// Registers hold the latest sample, the counter read right after is within one ODR period of it
+				uint32_t ticks;
+				SyncSensorClock(&ticks);
+				ProcessSample(data_raw_acceleration.i16bit, data_raw_angular_rate.i16bit,
+					SensorClock_IsSynced() ? SensorClock_ToNs(ticks) : MonotonicNs());
+			}
 		}
+#endif
 	}
+#endif
 
 // The ALTITUDE value calculated is actually "Pressure Altitude". This lacks correction for temperature (and humidity)
 // "pressure altitude" calculator located at: https://www.weather.gov/epz/wxcalc_pressurealtitude
@@ -262,6 +1020,14 @@ void AccelTimerEventHandler(EventData *eventData)
 		// will skew the data.
 		if (!firstPass) {
 
+#ifdef SENSOR_UNITS_FIXED_POINT
+			// Converted to float once per report instead of once per sample
+			for (int axis = 0; axis < 3; axis++) {
+				acceleration_mg[axis] = sensorValues.accelerationUg[axis] / 1000.0f;
+				angular_rate_dps[axis] = sensorValues.angularRateMdps[axis] / 1000.0f;
+			}
+#endif
+
 			// Allocate memory for a telemetry message to Azure
 			char *pjsonBuffer = (char *)malloc(JSON_BUFFER_SIZE);
 			if (pjsonBuffer == NULL) {
@@ -283,6 +1049,115 @@ void AccelTimerEventHandler(EventData *eventData)
 
 }
 
+/// <summary>
+///     Checks that a sensor configuration is supported and, with the FIFO, that the poll timer drains
+///     it well before it overruns.
+/// </summary>
+/// <returns>0 if the configuration can be applied, or -1 if not</returns>
+static int ValidateSensorConfig(const SensorConfig *config)
+{
+	lsm6dso_odr_xl_t odr;
+	lsm6dso_fs_xl_t accelFullScale;
+	lsm6dso_fs_g_t gyroFullScale;
+	if (OdrFromMilliHz(config->odrMilliHz, &odr) != 0) {
+		Log_Debug("ERROR: Unsupported LSM6DSO ODR %u mHz\n", config->odrMilliHz);
+		return -1;
+	}
+	if (FullScaleSettings(config->accelFullScaleG, config->gyroFullScaleDps, &accelFullScale, &gyroFullScale) != 0) {
+		Log_Debug("ERROR: Unsupported LSM6DSO full scale %u g / %u dps\n", config->accelFullScaleG, config->gyroFullScaleDps);
+		return -1;
+	}
+	if (config->pollPeriodNs < 1000000ULL || config->pollPeriodNs > 60000000000ULL) {
+		Log_Debug("ERROR: Sensor poll period must be 1 ms to 60 s\n");
+		return -1;
+	}
+
+#ifdef LSM6DSO_FIFO_ENABLE
+	if (config->watermarkSamples < 1
+		|| config->watermarkSamples * LSM6DSO_FIFO_WORDS_PER_SAMPLE > LSM6DSO_FIFO_MAX_WATERMARK_WORDS) {
+		Log_Debug("ERROR: FIFO watermark must be 1 to %d samples\n", LSM6DSO_FIFO_MAX_WATERMARK_WORDS / LSM6DSO_FIFO_WORDS_PER_SAMPLE);
+		return -1;
+	}
+
+	// Leave a quarter of the FIFO for a late timer wakeup
+	uint64_t wordsPerPoll = config->pollPeriodNs * config->odrMilliHz / 1000000000000ULL * LSM6DSO_FIFO_WORDS_PER_SAMPLE;
+	if (wordsPerPoll > LSM6DSO_FIFO_CAPACITY_WORDS * 3 / 4) {
+		Log_Debug("ERROR: Polling every %llu ns at %u mHz would fill the FIFO\n",
+			(unsigned long long)config->pollPeriodNs, config->odrMilliHz);
+		return -1;
+	}
+#endif
+
+	return 0;
+}
+
+void getSensorConfig(SensorConfig *config)
+{
+	*config = sensorConfig;
+}
+
+/// <summary>
+///     Changes the sensor ODR, full scale, FIFO watermark and poll period together.  Runs on the
+///     epoll thread like the timer handlers, so no sample is read while the settings change.  The
+///     samples already queued are published with the old format before the sensor is reconfigured.
+/// </summary>
+/// <returns>0 on success, or -1 if the configuration is invalid or could not be written</returns>
+int setSensorConfig(const SensorConfig *config)
+{
+#ifdef LSM6DSO_ON_RT_CORE
+	Log_Debug("ERROR: The sensor is configured by the real-time app, see Dryer-RT/build_options.h\n");
+	return -1;
+#endif
+
+	if (ValidateSensorConfig(config) != 0) {
+		return -1;
+	}
+
+	SensorConfig previous = sensorConfig;
+
+#ifdef LSM6DSO_FIFO_ENABLE
+	// Publish what was sampled with the old settings, then stop batching while the registers change
+	if (collect_samples) {
+		DrainFifo();
+	}
+	StopFifo();
+#endif
+
+	if (WriteSensorConfig(config) != 0) {
+		Log_Debug("ERROR: Could not write the sensor configuration, restoring the previous one\n");
+		WriteSensorConfig(&previous);
+#ifdef LSM6DSO_FIFO_ENABLE
+		if (collect_samples) {
+			StartFifo();
+		}
+#endif
+		return -1;
+	}
+
+	// The calibration offsets are raw values, rescale them to the new gyroscope full scale
+	for (int axis = 0; axis < 3; axis++) {
+		int32_t offset = raw_angular_rate_calibration.i16bit[axis] * (int32_t)previous.gyroFullScaleDps;
+		raw_angular_rate_calibration.i16bit[axis] = (int16_t)((offset + (offset < 0 ? -1 : 1) * config->gyroFullScaleDps / 2)
+			/ config->gyroFullScaleDps);
+	}
+
+	sensorConfig = *config;
+	ApplySensorFormat();
+
+	SetPollPeriod();
+
+#ifdef LSM6DSO_FIFO_ENABLE
+	if (collect_samples) {
+		StartFifo();
+	}
+#endif
+
+	Log_Debug("LSM6DSO set to %u mHz, %u g, %u dps, %u sample watermark, polled every %llu ns\n",
+		sensorConfig.odrMilliHz, sensorConfig.accelFullScaleG, sensorConfig.gyroFullScaleDps,
+		sensorConfig.watermarkSamples, (unsigned long long)sensorConfig.pollPeriodNs);
+	return 0;
+}
+
 // initializes SW3 - button B as input
 int initGPIO_Input(void) {
 	gpioButtonFd = GPIO_OpenAsInput(AVNET_MT3620_SK_USER_BUTTON_B);
@@ -295,15 +1170,39 @@ int initGPIO_Input(void) {
 }
 
 int initMQTTI2c(void) {
+	// The client is synced from the main epoll loop, there is no MQTT thread
+	if (MQTTAttachToEpoll(epollFd) != 0) {
+		return -1;
+	}
+	MQTTConfigureBuffers(MQTT_SEND_BUFFER_SIZE, MQTT_SEND_BUFFER_MAX_SIZE, MQTT_RECV_BUFFER_SIZE, MQTT_RECV_BUFFER_MAX_SIZE);
+	MQTTConfigureBackoff(MQTT_BACKOFF_MIN_MS, MQTT_BACKOFF_MAX_MS);
+	MQTTSetPublishPolicy(MQTT_CLASS_TELEMETRY, MQTT_QOS_TELEMETRY, false);
+	MQTTSetPublishPolicy(MQTT_CLASS_CONTROL, MQTT_QOS_CONTROL, false);
+	MQTTSetPublishPolicy(MQTT_CLASS_SUMMARY, MQTT_QOS_SUMMARY, MQTT_RETAIN_SUMMARY);
+	// Connects in the background, frames are queued until the connection is up
 	return MQTTInit(MQTT_ADDRESS, "1883", MQTT_TOPIC);
 }
 
+#ifndef LSM6DSO_ON_RT_CORE
+// Largest sensor bus transaction, register address included: a full FIFO burst, or the output registers
+#ifdef LSM6DSO_FIFO_ENABLE
+#define SENSOR_BUS_MAX_TRANSFER_BYTES (1 + LSM6DSO_FIFO_MAX_BURST_WORDS * LSM6DSO_FIFO_WORD_SIZE)
+#else
+#define SENSOR_BUS_MAX_TRANSFER_BYTES (1 + LSM6DSO_ALL_OUTPUTS_SIZE)
+#endif
+#endif
+
 /// <summary>
 ///     Initializes the I2C interface.
 /// </summary>
 /// <returns>0 on success, or -1 on failure</returns>
 int initI2c(void) {
 
+	TelemetryRing_Init(&telemetryRing, telemetryRingStorage, sizeof(telemetryRingStorage), TELEMETRY_RING_POLICY);
+#ifdef TELEMETRY_RING_PERSIST
+	RestoreTelemetryRing();
+#endif
+
 	initMQTTI2c(); // start mqtt connection
 	// Begin MT3620 I2C init 
 
@@ -311,21 +1210,17 @@ int initI2c(void) {
 		return -1; 
 	}
 
-	i2cFd = I2CMaster_Open(AVNET_MT3620_SK_ISU2_I2C);
-	if (i2cFd < 0) {
-		Log_Debug("ERROR: I2CMaster_Open: errno=%d (%s)\n", errno, strerror(errno));
+#ifdef LSM6DSO_ON_RT_CORE
+	// The real-time core owns the sensor and the ISU2 bus, it sends the samples with the format
+	if (RtSampler_Init(epollFd, RT_SAMPLER_COMPONENT_ID, RtSampleHandler, RtAdcHandler) != 0) {
 		return -1;
 	}
-
-	int result = I2CMaster_SetBusSpeed(i2cFd, I2C_BUS_SPEED_STANDARD);
-	if (result != 0) {
-		Log_Debug("ERROR: I2CMaster_SetBusSpeed: errno=%d (%s)\n", errno, strerror(errno));
-		return -1;
-	}
-
-	result = I2CMaster_SetTimeout(i2cFd, 100);
-	if (result != 0) {
-		Log_Debug("ERROR: I2CMaster_SetTimeout: errno=%d (%s)\n", errno, strerror(errno));
+#else
+	// Run ISU2 as fast as the LSM6DSO answers, up to what every device on the bus supports
+	static const I2C_DeviceAddress busDevices[] = { LSM6DSO_ADDRESS };
+	i2cFd = SensorBus_Open(AVNET_MT3620_SK_ISU2_I2C, SENSOR_BUS_MAX_SPEED_HZ, SENSOR_BUS_MAX_TRANSFER_BYTES,
+		SENSOR_BUS_TIMEOUT_MARGIN_MS, busDevices, sizeof(busDevices) / sizeof(busDevices[0]));
+	if (i2cFd < 0) {
 		return -1;
 	}
 
@@ -382,25 +1277,42 @@ int initI2c(void) {
 		lsm6dso_reset_get(&dev_ctx, &rst);
 	} while (rst);
 
+	if (ValidateSensorConfig(&sensorConfig) != 0) {
+		return -1;
+	}
+
+	// The settings below go out when the batch ends, one transaction per run of adjacent registers
+	// (CTRL1_XL to CTRL3_C, CTRL8_XL to CTRL9_XL, ...) instead of one per setting
+	SensorBus_BeginBatch();
+
 	 // Disable I3C interface
 	lsm6dso_i3c_disable_set(&dev_ctx, LSM6DSO_I3C_DISABLE);
 
 	// Enable Block Data Update
 	lsm6dso_block_data_update_set(&dev_ctx, PROPERTY_ENABLE);
 
-	 // Set Output Data Rate
-	lsm6dso_xl_data_rate_set(&dev_ctx, LSM6DSO_XL_ODR_12Hz5);
-	lsm6dso_gy_data_rate_set(&dev_ctx, LSM6DSO_GY_ODR_12Hz5);
-
-	 // Set full scale
-	lsm6dso_xl_full_scale_set(&dev_ctx, LSM6DSO_4g);
-	lsm6dso_gy_full_scale_set(&dev_ctx, LSM6DSO_2000dps);
+	 // Set full scale, and calibrate at 12.5 Hz
+	SensorConfig calibrationConfig = sensorConfig;
+	calibrationConfig.odrMilliHz = 12500;
+	int result = WriteSensorConfig(&calibrationConfig);
 
 	 // Configure filtering chain(No aux interface)
 	// Accelerometer - LPF1 + LPF2 path	
 	lsm6dso_xl_hp_path_on_out_set(&dev_ctx, LSM6DSO_LP_ODR_DIV_100);
 	lsm6dso_xl_filter_lp2_set(&dev_ctx, PROPERTY_ENABLE);
 
+	if (SensorBus_EndBatch() != 0 || result != 0) {
+		Log_Debug("ERROR: Could not configure the LSM6DSO\n");
+		return -1;
+	}
+#ifdef SENSOR_UNITS_FIXED_POINT
+	SensorUnits_GetScale(sensorConfig.accelFullScaleG, sensorConfig.gyroFullScaleDps, &sensorScale);
+#endif
+
+	// Sample times come from the sensor's own counter instead of the time they were read.  Not in the
+	// batch, the counter has to run before it is read back.
+	StartSensorClock();
+
 	// Read the raw angular rate data from the device to use as offsets.  We're making the assumption that the device
 	// is stationary.
 
@@ -429,9 +1341,9 @@ int initI2c(void) {
 			lsm6dso_angular_rate_raw_get(&dev_ctx, data_raw_angular_rate.u8bit);
 
 			// Before we store the mdps values subtract the calibration data we captured at startup.
-			angular_rate_dps[0] = lsm6dso_from_fs2000_to_mdps(data_raw_angular_rate.i16bit[0] - raw_angular_rate_calibration.i16bit[0]);
-			angular_rate_dps[1] = lsm6dso_from_fs2000_to_mdps(data_raw_angular_rate.i16bit[1] - raw_angular_rate_calibration.i16bit[1]);
-			angular_rate_dps[2] = lsm6dso_from_fs2000_to_mdps(data_raw_angular_rate.i16bit[2] - raw_angular_rate_calibration.i16bit[2]);
+			angular_rate_dps[0] = GyroToDps(data_raw_angular_rate.i16bit[0] - raw_angular_rate_calibration.i16bit[0]);
+			angular_rate_dps[1] = GyroToDps(data_raw_angular_rate.i16bit[1] - raw_angular_rate_calibration.i16bit[1]);
+			angular_rate_dps[2] = GyroToDps(data_raw_angular_rate.i16bit[2] - raw_angular_rate_calibration.i16bit[2]);
 		}
 		
 		// If the angular values after applying the offset are not 0.7 or less, then do it again!
@@ -440,10 +1352,43 @@ int initI2c(void) {
 	Log_Debug("LSM6DSO: Calibrating angular rate complete!\n");
 
 
+	// Switch to the configured output data rate now that calibration is done
+	if (WriteSensorConfig(&sensorConfig) != 0) {
+		Log_Debug("ERROR: Could not configure the LSM6DSO\n");
+		return -1;
+	}
+#ifdef LSM6DSO_FIFO_ENABLE
+	// Batching starts when sample collection is enabled with the button
+	StopFifo();
+#endif
+#ifdef ACTIVITY_DETECTION_ENABLE
+	// Only now, the gyroscope must stay awake while it is calibrated
+	if (lsm6dso_act_mode_set(&dev_ctx, LSM6DSO_XL_12Hz5_GY_SLEEP) != 0) {
+		Log_Debug("ERROR: Could not enable the LSM6DSO activity detection\n");
+		return -1;
+	}
+#endif
+#ifdef LSM6DSO_INT1_GPIO
+	// Poll the INT1 pin instead of the status registers
+	if (StartInt1() != 0) {
+		return -1;
+	}
+#endif
+
+	// Startup cost of the configuration and calibration, getTelemetryStats reports the steady state
+	SensorBus_LogStats("startup");
+	SensorBus_ResetStats();
+#endif
+#ifdef FEATURE_WINDOW_ENABLE
+	if (FeatureWindow_Init(FEATURE_WINDOW_HOP, publishMQTTMessageFromI2C) != 0) {
+		return -1;
+	}
+#endif
+
 	// Init the epoll interface to periodically run the AccelTimerEventHandler routine where we read the sensors
 
-	// Define the period in the build_options.h file
-	struct timespec accelReadPeriod = { .tv_sec = ACCEL_READ_PERIOD_SECONDS,.tv_nsec = ACCEL_READ_PERIOD_NANO_SECONDS };
+	// The default period is set in the build_options.h file, setSensorConfig changes it
+	struct timespec accelReadPeriod = NsToTimespec(sensorConfig.pollPeriodNs);
 	// event handler data structures. Only the event handler field needs to be populated.
 	static EventData accelEventData = { .eventHandler = &AccelTimerEventHandler };
 	accelTimerFd = -1;
@@ -451,8 +1396,31 @@ int initI2c(void) {
 	if (accelTimerFd < 0) {
 		return -1;
 	}
-	
-	MQTTPublish(MQTT_TOPIC, "-1,-1,-1,-1,-1,-1,-1");
+
+	if (TelemetryBatch_Init(epollFd, TELEMETRY_BATCH_SAMPLES, TELEMETRY_BATCH_MAX_LATENCY_MS, publishMQTTMessageFromI2C) != 0) {
+		return -1;
+	}
+
+#ifdef DRYNESS_ON_DEVICE
+	// Idle until the device twin delivers a model
+	if (DrynessEstimator_Init(epollFd, DRYNESS_PUBLISH_INTERVAL_MS, DRYNESS_SMOOTHING_ALPHA, DRYNESS_CONFIDENCE_SPREAD,
+		publishMQTTMessageFromI2C) != 0) {
+		return -1;
+	}
+#endif
+	ApplySensorFormat();
+
+	// Mark the start of a collection run for the consumers
+	uint8_t startFrame[TELEMETRY_FRAME_SIZE(0)];
+	TelemetryFrameHeader startHeader = {
+		.type = TELEMETRY_FRAME_START,
+		.sequence = mqtt_message_counter,
+		.timestampNs = MonotonicNs(),
+		.accelFullScaleG = sensorConfig.accelFullScaleG,
+		.gyroFullScaleDps = sensorConfig.gyroFullScaleDps
+	};
+	size_t startFrameSize = TelemetryFrame_EncodeHeader(startFrame, sizeof(startFrame), &startHeader);
+	publishMQTTMessageFromI2C(startFrame, startFrameSize);
 
 	return 0;
 }
@@ -461,9 +1429,22 @@ int initI2c(void) {
 ///     Closes the I2C interface File Descriptors.
 /// </summary>
 void closeI2c(void) {
-	MQTTStop();
+	TelemetryBatch_Close();
+#ifdef DRYNESS_ON_DEVICE
+	DrynessEstimator_Close();
+#endif
+#ifdef TELEMETRY_RING_PERSIST
+	SaveTelemetryRing();
+#endif
+	MQTTDetachFromEpoll();
+#ifdef LSM6DSO_ON_RT_CORE
+	RtSampler_Close();
+#endif
 	CloseFdAndPrintError(i2cFd, "i2c");
 	CloseFdAndPrintError(accelTimerFd, "accelTimer");
+#ifdef LSM6DSO_INT1_GPIO
+	CloseFdAndPrintError(int1GpioFd, "int1Gpio");
+#endif
 }
 
 /// <summary>
@@ -487,30 +1468,22 @@ static int32_t platform_write(int *fD, uint8_t reg, uint8_t *bufp,
 	Log_Debug("\n");
 #endif 
 
-	// Construct a new command buffer that contains the register to write to, then the data to write
-	uint8_t cmdBuffer[len + 1];
-	cmdBuffer[0] = reg;
-	for (int i = 0; i < len; i++) {
-		cmdBuffer[i + 1] = bufp[i];
+	// The embedded function registers share addresses with the main bank, so nothing may stay queued
+	// across a bank switch
+	bool bankSwitch = reg == LSM6DSO_FUNC_CFG_ACCESS;
+	if (bankSwitch && SensorBus_Flush() != 0) {
+		return -1;
 	}
 
-#ifdef ENABLE_READ_WRITE_DEBUG
-	Log_Debug("cmdBuffer contents: ");
-	for (int i = 0; i < len + 1; i++) {
-
-		Log_Debug("%0x: ", cmdBuffer[i]);
+	// Register address and data go out as one transaction, or are queued while a batch is open
+	if (SensorBus_Write(*fD, lsm6dsOAddress, reg, bufp, len) != 0) {
+		return -1;
 	}
-	Log_Debug("\n");
-#endif
-
-	// Write the data to the device
-	int32_t retVal = I2CMaster_Write(*fD, lsm6dsOAddress, cmdBuffer, (size_t)len + 1);
-	if (retVal < 0) {
-		Log_Debug("ERROR: platform_write: errno=%d (%s)\n", errno, strerror(errno));
+	if (bankSwitch && SensorBus_Flush() != 0) {
 		return -1;
 	}
 #ifdef ENABLE_READ_WRITE_DEBUG
-	Log_Debug("Wrote %d bytes to device.\n\n", retVal);
+	Log_Debug("Wrote %d bytes to device.\n\n", len + 1);
 #endif
 	return 0;
 }
@@ -541,17 +1514,9 @@ static int32_t platform_read(int *fD, uint8_t reg, uint8_t *bufp,
 ;
 #endif
 
-	// Set the register address to read
-	int32_t retVal = I2CMaster_Write(i2cFd, lsm6dsOAddress, &reg, 1);
-	if (retVal < 0) {
-		Log_Debug("ERROR: platform_read(write step): errno=%d (%s)\n", errno, strerror(errno));
-		return -1;
-	}
-
-	// Read the data into the provided buffer
-	retVal = I2CMaster_Read(i2cFd, lsm6dsOAddress, bufp, len);
-	if (retVal < 0) {
-		Log_Debug("ERROR: platform_read(read step): errno=%d (%s)\n", errno, strerror(errno));
+	// Set the register address and read the data into the provided buffer in one combined
+	// transaction (repeated start) rather than a separate write and read
+	if (SensorBus_Read(*fD, lsm6dsOAddress, reg, bufp, len) != 0) {
 		return -1;
 	}
 
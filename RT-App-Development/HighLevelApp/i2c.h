@@ -1,7 +1,9 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "epoll_timerfd_utilities.h"
+#include "telemetry_ring.h"
 
 #ifdef OLED_SD1306
 //// OLED
@@ -11,8 +13,24 @@
 #define LSM6DSO_ID         0x6C   // register value
 #define LSM6DSO_ADDRESS	   0x6A	  // I2C Address
 
+// Sensor settings that can be changed while the app runs
+typedef struct {
+	uint32_t odrMilliHz;        // accelerometer and gyroscope output data rate, 12500 to 6667000 mHz
+	uint16_t accelFullScaleG;   // 2, 4, 8 or 16
+	uint16_t gyroFullScaleDps;  // 125, 250, 500, 1000 or 2000
+	uint16_t watermarkSamples;  // FIFO watermark, only used with LSM6DSO_FIFO_ENABLE
+	uint64_t pollPeriodNs;      // period of the timer that reads the sensor
+} SensorConfig;
+
 int initI2c(void);
 void closeI2c(void);
 
+// Current sensor settings, and a way to change all of them at once without restarting
+void getSensorConfig(SensorConfig *config);
+int setSensorConfig(const SensorConfig *config);
+
+// Frames waiting to be published, for fill level and drop counters
+const TelemetryRing *getTelemetryRing(void);
+
 // Export to use I2C in other file
 extern int i2cFd;
\ No newline at end of file
@@ -0,0 +1,162 @@
+#include "intercore_message.h"
+
+/* helpers */
+static void put_u16(uint8_t* p, uint16_t v) {
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t* p, uint32_t v) {
+	put_u16(p, (uint16_t)v);
+	put_u16(p + 2, (uint16_t)(v >> 16));
+}
+
+static uint16_t get_u16(const uint8_t* p) {
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+	return (uint32_t)get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+/* declarations */
+size_t IntercoreMessage_EncodeHeader(uint8_t* buf, size_t bufSize, const IntercoreMessageHeader* header) {
+	if (bufSize < INTERCORE_MESSAGE_HEADER_SIZE)
+		return 0;
+
+	put_u32(&buf[0], header->sequence);
+	put_u16(&buf[4], header->type);
+	put_u16(&buf[6], header->payloadSize);
+
+	return INTERCORE_MESSAGE_HEADER_SIZE;
+}
+
+int IntercoreMessage_DecodeHeader(const uint8_t* buf, size_t len, IntercoreMessageHeader* header) {
+	if (len < INTERCORE_MESSAGE_HEADER_SIZE)
+		return -1;
+
+	header->sequence = get_u32(&buf[0]);
+	header->type = get_u16(&buf[4]);
+	header->payloadSize = get_u16(&buf[6]);
+
+	return len < INTERCORE_MESSAGE_HEADER_SIZE + (size_t)header->payloadSize ? -1 : 0;
+}
+
+size_t IntercoreMessage_EncodeAdcBlock(uint8_t* buf, size_t bufSize, const IntercoreAdcBlock* block) {
+	if (bufSize < INTERCORE_ADC_BLOCK_HEADER_SIZE)
+		return 0;
+
+	put_u32(&buf[0], block->firstIndex);
+	put_u32(&buf[4], block->periodUs);
+	put_u16(&buf[8], block->channelMask);
+	put_u16(&buf[10], block->count);
+
+	return INTERCORE_ADC_BLOCK_HEADER_SIZE;
+}
+
+int IntercoreMessage_DecodeAdcBlock(const uint8_t* payload, size_t len, IntercoreAdcBlock* block) {
+	if (len < INTERCORE_ADC_BLOCK_HEADER_SIZE)
+		return -1;
+
+	block->firstIndex = get_u32(&payload[0]);
+	block->periodUs = get_u32(&payload[4]);
+	block->channelMask = get_u16(&payload[8]);
+	block->count = get_u16(&payload[10]);
+
+	size_t needed = INTERCORE_ADC_BLOCK_SIZE((size_t)block->count, IntercoreMessage_AdcChannels(block->channelMask));
+	return len < needed ? -1 : 0;
+}
+
+uint16_t IntercoreMessage_AdcValue(const uint8_t* payload, const IntercoreAdcBlock* block, uint16_t row, uint8_t column) {
+	size_t channels = IntercoreMessage_AdcChannels(block->channelMask);
+	return get_u16(&payload[INTERCORE_ADC_BLOCK_HEADER_SIZE + (row * channels + column) * 2]);
+}
+
+uint8_t IntercoreMessage_AdcChannels(uint16_t channelMask) {
+	uint8_t channels = 0;
+	for (; channelMask != 0; channelMask &= (uint16_t)(channelMask - 1))
+		channels++;
+	return channels;
+}
+
+size_t IntercoreMessage_EncodeTraceReport(uint8_t* buf, size_t bufSize, const IntercoreTraceReport* report) {
+	if (bufSize < INTERCORE_TRACE_REPORT_HEADER_SIZE)
+		return 0;
+
+	put_u32(&buf[0], report->clockHz);
+	put_u32(&buf[4], report->firstEvent);
+	put_u16(&buf[8], report->pointCount);
+	put_u16(&buf[10], report->eventCount);
+
+	return INTERCORE_TRACE_REPORT_HEADER_SIZE;
+}
+
+void IntercoreMessage_EncodeTraceStats(uint8_t* payload, uint16_t index, const IntercoreTraceStats* stats) {
+	uint8_t* p = &payload[INTERCORE_TRACE_REPORT_SIZE((size_t)index, 0)];
+	put_u16(&p[0], stats->point);
+	put_u16(&p[2], stats->kind);
+	put_u32(&p[4], stats->count);
+	put_u32(&p[8], stats->min);
+	put_u32(&p[12], stats->max);
+	put_u32(&p[16], stats->total);
+}
+
+void IntercoreMessage_EncodeTraceEvent(uint8_t* payload, const IntercoreTraceReport* report, uint16_t index,
+	const IntercoreTraceEvent* event) {
+	uint8_t* p = &payload[INTERCORE_TRACE_REPORT_SIZE((size_t)report->pointCount, (size_t)index)];
+	put_u32(&p[0], event->timestamp);
+	put_u32(&p[4], event->value);
+	put_u16(&p[8], event->point);
+	put_u16(&p[10], event->kind);
+}
+
+int IntercoreMessage_DecodeTraceReport(const uint8_t* payload, size_t len, IntercoreTraceReport* report) {
+	if (len < INTERCORE_TRACE_REPORT_HEADER_SIZE)
+		return -1;
+
+	report->clockHz = get_u32(&payload[0]);
+	report->firstEvent = get_u32(&payload[4]);
+	report->pointCount = get_u16(&payload[8]);
+	report->eventCount = get_u16(&payload[10]);
+
+	return len < INTERCORE_TRACE_REPORT_SIZE((size_t)report->pointCount, (size_t)report->eventCount) ? -1 : 0;
+}
+
+void IntercoreMessage_DecodeTraceStats(const uint8_t* payload, uint16_t index, IntercoreTraceStats* stats) {
+	const uint8_t* p = &payload[INTERCORE_TRACE_REPORT_SIZE((size_t)index, 0)];
+	stats->point = get_u16(&p[0]);
+	stats->kind = get_u16(&p[2]);
+	stats->count = get_u32(&p[4]);
+	stats->min = get_u32(&p[8]);
+	stats->max = get_u32(&p[12]);
+	stats->total = get_u32(&p[16]);
+}
+
+void IntercoreMessage_DecodeTraceEvent(const uint8_t* payload, const IntercoreTraceReport* report, uint16_t index,
+	IntercoreTraceEvent* event) {
+	const uint8_t* p = &payload[INTERCORE_TRACE_REPORT_SIZE((size_t)report->pointCount, (size_t)index)];
+	event->timestamp = get_u32(&p[0]);
+	event->value = get_u32(&p[4]);
+	event->point = get_u16(&p[8]);
+	event->kind = get_u16(&p[10]);
+}
+
+const char* IntercoreMessage_TracePointName(uint16_t point) {
+	static const char* const names[INTERCORE_TRACE_POINT_COUNT] = {
+		[INTERCORE_TRACE_SAMPLE_LATENCY] = "sample timer latency (us)",
+		[INTERCORE_TRACE_SAMPLE_TIMER] = "sample timer interrupt",
+		[INTERCORE_TRACE_SAMPLE_READ] = "LSM6DSO read",
+		[INTERCORE_TRACE_READ_DONE] = "I2C read callback",
+		[INTERCORE_TRACE_ADC_DMA] = "ADC DMA callback",
+		[INTERCORE_TRACE_ADC_READINGS] = "ADC readings per callback",
+		[INTERCORE_TRACE_SEND_BATCHES] = "send IMU frames",
+		[INTERCORE_TRACE_SEND_ADC] = "send ADC blocks",
+	};
+	return point < INTERCORE_TRACE_POINT_COUNT && names[point] != NULL ? names[point] : "unknown";
+}
+
+uint32_t IntercoreMessage_Missed(uint32_t previousSequence, uint32_t sequence) {
+	// A step back means the real-time app restarted, that is not a gap
+	int32_t step = (int32_t)(sequence - previousSequence);
+	return step > 1 ? (uint32_t)(step - 1) : 0;
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+* Header of every message a real-time app sends to this app over the inter-core buffers.
+*
+* The real-time core writes messages straight into the shared buffer and rings the doorbell once per
+* batch of messages, not once per message.  The sequence number counts every message the real-time
+* core tried to send, including the ones it dropped because the buffer was full, so the receiver can
+* tell how many it missed.  Little-endian, packed byte by byte, no applibs headers: the same code is
+* built for the M4.
+*/
+
+#define INTERCORE_MESSAGE_HEADER_SIZE 8
+
+typedef enum {
+	INTERCORE_MESSAGE_TELEMETRY = 0, // a telemetry frame (telemetry_frame.h)
+	INTERCORE_MESSAGE_ADC = 1,       // little-endian uint32 ADC readings, oldest first
+	INTERCORE_MESSAGE_ADC_BLOCK = 2, // an IntercoreAdcBlock header followed by the averaged values
+	INTERCORE_MESSAGE_TRACE = 3      // an IntercoreTraceReport, its IntercoreTraceStats then its IntercoreTraceEvents
+} IntercoreMessageType;
+
+typedef struct {
+	uint32_t sequence;
+	uint16_t type;
+	uint16_t payloadSize; // bytes following the header
+} IntercoreMessageHeader;
+
+#define INTERCORE_ADC_BLOCK_HEADER_SIZE 12
+
+/**
+* @brief Size of an ADC block payload with the given number of rows and channels.
+*/
+#define INTERCORE_ADC_BLOCK_SIZE(rows, channels) (INTERCORE_ADC_BLOCK_HEADER_SIZE + (rows) * (channels) * 2)
+
+// Decimated ADC samples of one or more channels.  The header is followed by count rows, each with one
+// uint16 per channel in the order of the channel numbers: the mean of the raw 12-bit readings that
+// went into the row, in 1/16 LSB.
+typedef struct {
+	uint32_t firstIndex;  // index of the first row since the capture started, gaps mean dropped blocks
+	uint32_t periodUs;    // time between rows
+	uint16_t channelMask; // bit n set if ADC channel n is in the block
+	uint16_t count;       // rows in the block
+} IntercoreAdcBlock;
+
+#define INTERCORE_TRACE_REPORT_HEADER_SIZE 12
+#define INTERCORE_TRACE_STATS_SIZE 20
+#define INTERCORE_TRACE_EVENT_SIZE 12
+
+/**
+* @brief Size of a trace report payload with the given number of trace points and events.
+*/
+#define INTERCORE_TRACE_REPORT_SIZE(points, events) \
+	(INTERCORE_TRACE_REPORT_HEADER_SIZE + (points) * INTERCORE_TRACE_STATS_SIZE + (events) * INTERCORE_TRACE_EVENT_SIZE)
+
+// Places the real-time app is instrumented, named by IntercoreMessage_TracePointName
+typedef enum {
+	INTERCORE_TRACE_SAMPLE_LATENCY = 0, // sample timer expiry to its interrupt, in microseconds
+	INTERCORE_TRACE_SAMPLE_TIMER = 1,   // sample timer interrupt
+	INTERCORE_TRACE_SAMPLE_READ = 2,    // LSM6DSO output read, from starting the transfer to its callback
+	INTERCORE_TRACE_READ_DONE = 3,      // I2C callback that adds the sample to the batch
+	INTERCORE_TRACE_ADC_DMA = 4,        // ADC DMA callback
+	INTERCORE_TRACE_ADC_READINGS = 5,   // readings handed over per ADC DMA callback
+	INTERCORE_TRACE_SEND_BATCHES = 6,   // main loop sending the IMU frames
+	INTERCORE_TRACE_SEND_ADC = 7,       // main loop sending the ADC blocks
+	INTERCORE_TRACE_POINT_COUNT
+} IntercoreTracePoint;
+
+typedef enum {
+	INTERCORE_TRACE_SPAN = 0,   // values are durations in trace clock cycles
+	INTERCORE_TRACE_COUNTER = 1 // values are whatever the trace point counts
+} IntercoreTraceKind;
+
+// Profile of the real-time app since the previous report.  The header is followed by pointCount
+// IntercoreTraceStats, then the newest eventCount IntercoreTraceEvents, oldest first.
+typedef struct {
+	uint32_t clockHz;    // trace clock, a free-running timer on the real-time core
+	uint32_t firstEvent; // index of the first event since tracing started, gaps mean events were overwritten
+	uint16_t pointCount;
+	uint16_t eventCount;
+} IntercoreTraceReport;
+
+// Values recorded at one trace point since the previous report
+typedef struct {
+	uint16_t point; // IntercoreTracePoint
+	uint16_t kind;  // IntercoreTraceKind
+	uint32_t count; // 0 if nothing was recorded, the other fields are then 0 too
+	uint32_t min;
+	uint32_t max;
+	uint32_t total;
+} IntercoreTraceStats;
+
+typedef struct {
+	uint32_t timestamp; // trace clock at the start of a span, or when a counter was recorded
+	uint32_t value;
+	uint16_t point;
+	uint16_t kind;
+} IntercoreTraceEvent;
+
+/**
+* @brief Encode a message header.
+*
+* @return INTERCORE_MESSAGE_HEADER_SIZE, or 0 if buf is too small.
+*/
+size_t IntercoreMessage_EncodeHeader(uint8_t* buf, size_t bufSize, const IntercoreMessageHeader* header);
+
+/**
+* @brief Decode the header of a received message.
+*
+* @param buf Received message.
+* @param len Message length in bytes.
+* @param header Decoded header.
+* @return 0 on success, -1 if the message is shorter than its header says.
+*/
+int IntercoreMessage_DecodeHeader(const uint8_t* buf, size_t len, IntercoreMessageHeader* header);
+
+/**
+* @brief Encode the header of an ADC block. The rows are written after it by the caller.
+*
+* @return INTERCORE_ADC_BLOCK_HEADER_SIZE, or 0 if buf is too small.
+*/
+size_t IntercoreMessage_EncodeAdcBlock(uint8_t* buf, size_t bufSize, const IntercoreAdcBlock* block);
+
+/**
+* @brief Decode the header of an ADC block payload.
+*
+* @return 0 on success, -1 if the payload is shorter than its rows.
+*/
+int IntercoreMessage_DecodeAdcBlock(const uint8_t* payload, size_t len, IntercoreAdcBlock* block);
+
+/**
+* @brief Value of one channel in one row of an ADC block validated by IntercoreMessage_DecodeAdcBlock.
+*
+* @param column Position of the channel among the channels of the block, 0 for the lowest channel number.
+*/
+uint16_t IntercoreMessage_AdcValue(const uint8_t* payload, const IntercoreAdcBlock* block, uint16_t row, uint8_t column);
+
+/**
+* @brief Number of channels in a channel mask.
+*/
+uint8_t IntercoreMessage_AdcChannels(uint16_t channelMask);
+
+/**
+* @brief Encode the header of a trace report. The stats and events are written after it by the caller.
+*
+* @return INTERCORE_TRACE_REPORT_HEADER_SIZE, or 0 if buf is too small.
+*/
+size_t IntercoreMessage_EncodeTraceReport(uint8_t* buf, size_t bufSize, const IntercoreTraceReport* report);
+
+/**
+* @brief Encode stats entry index of a trace report.
+*/
+void IntercoreMessage_EncodeTraceStats(uint8_t* payload, uint16_t index, const IntercoreTraceStats* stats);
+
+/**
+* @brief Encode event index of a trace report.
+*/
+void IntercoreMessage_EncodeTraceEvent(uint8_t* payload, const IntercoreTraceReport* report, uint16_t index,
+	const IntercoreTraceEvent* event);
+
+/**
+* @brief Decode the header of a trace report payload.
+*
+* @return 0 on success, -1 if the payload is shorter than its stats and events.
+*/
+int IntercoreMessage_DecodeTraceReport(const uint8_t* payload, size_t len, IntercoreTraceReport* report);
+
+/**
+* @brief Stats entry of a trace report validated by IntercoreMessage_DecodeTraceReport.
+*/
+void IntercoreMessage_DecodeTraceStats(const uint8_t* payload, uint16_t index, IntercoreTraceStats* stats);
+
+/**
+* @brief Event of a trace report validated by IntercoreMessage_DecodeTraceReport.
+*/
+void IntercoreMessage_DecodeTraceEvent(const uint8_t* payload, const IntercoreTraceReport* report, uint16_t index,
+	IntercoreTraceEvent* event);
+
+/**
+* @brief Name of a trace point, for logs.
+*/
+const char* IntercoreMessage_TracePointName(uint16_t point);
+
+/**
+* @brief Number of messages missed between two received sequence numbers, 0 if none.
+*/
+uint32_t IntercoreMessage_Missed(uint32_t previousSequence, uint32_t sequence);
@@ -52,6 +52,8 @@
 #include "azure_iot_utilities.h"
 #include "connection_strings.h"
 #include "build_options.h"
+#include "telemetry_batch.h"
+#include "sensor_bus.h"
 
 #include <applibs/log.h>
 #include <applibs/i2c.h>
@@ -59,13 +61,13 @@
 #include <applibs/wificonfig.h>
 #include <azureiot/iothub_device_client_ll.h>
 
-//#include "mqtt_utilities.h"
+#include "mqtt_utilities.h"
 
 #ifdef M0_INTERCORE_COMMS
 //// ADC connection
-#include <sys/time.h>
 #include <sys/socket.h>
 #include <applibs/application.h>
+#include "intercore_message.h"
 #endif 
 
 // Provide local access to variables in other files
@@ -89,6 +91,12 @@ int wifiLedFd = -1;
 int clickSocket1Relay1Fd = -1;
 int clickSocket1Relay2Fd = -1;
 
+// Ambient light in lux, from the M0 application or from the ADC blocks of the real-time sampler
+float light_sensor;
+
+// Largest direct method payload we will parse
+#define DIRECT_METHOD_MAX_PAYLOAD_SIZE 128
+
 // Azure IoT Hub/Central defines.
 #define SCOPEID_LENGTH 20
 char scopeId[SCOPEID_LENGTH]; // ScopeId for the Azure IoT Central application and DPS set in
@@ -98,14 +106,10 @@ char scopeId[SCOPEID_LENGTH]; // ScopeId for the Azure IoT Central application a
 //// ADC connection
 static const char rtAppComponentId[] = "005180bc-402f-4cb3-a662-72937dbcde47";
 static int sockFd = -1;
-static void SendMessageToRTCore(void);
-static void TimerEventHandler(EventData *eventData);
 static void SocketEventHandler(EventData *eventData);
-static int timerFd = -1;
-uint8_t RTCore_status;
+extern uint8_t RTCore_status;
 
 // event handler data structures. Only the event handler field needs to be populated.
-static EventData timerEventData = { .eventHandler = &TimerEventHandler };
 static EventData socketEventData = { .eventHandler = &SocketEventHandler };
 #endif 
 
@@ -162,7 +166,7 @@ static int DirectMethodCall(const char* methodName, const char* payload, size_t
 
 	int result = 404; // HTTP status code.
 
-	if (payloadSize < 32) {
+	if (payloadSize < DIRECT_METHOD_MAX_PAYLOAD_SIZE) {
 
 		// Declare a char buffer on the stack where we'll operate on a copy of the payload.  
 		char directMethodCallContent[payloadSize + 1];
@@ -207,7 +211,8 @@ static int DirectMethodCall(const char* methodName, const char* payload, size_t
 			Log_Debug("setSensorPollTime() Direct Method called\n");
 			result = 200;
 
-			// The payload should contain a JSON object such as: {"pollTime": 20}
+			// The payload should contain a JSON object such as: {"pollTimeMs": 20}, or the legacy {"pollTime": 1}
+			// in whole seconds, which only fits the FIFO at low ODRs
 			if (directMethodCallContent == NULL) {
 				Log_Debug("ERROR: Could not allocate buffer for direct method request payload.\n");
 				abort();
@@ -230,33 +235,208 @@ static int DirectMethodCall(const char* methodName, const char* payload, size_t
 				goto payloadError;
 			}
 
-			// Pull the Key: value pair from the JSON object, we're looking for {"pollTime": <integer>}
-			// Verify that the new timer is < 0
-			int newPollTime = (int)json_object_get_number(pollTimeJson, "pollTime");
-			if (newPollTime < 1) {
+			// Pull the Key: value pair from the JSON object, we're looking for {"pollTimeMs": <integer>}
+			// or {"pollTime": <integer>}, and convert either to milliseconds
+			int newPollTimeMs = 0;
+			if (json_object_has_value_of_type(pollTimeJson, "pollTimeMs", JSONNumber)) {
+				double value = json_object_get_number(pollTimeJson, "pollTimeMs");
+				newPollTimeMs = (value < 1 || value > 60000) ? 0 : (int)value;
+			}
+			else if (json_object_has_value_of_type(pollTimeJson, "pollTime", JSONNumber)) {
+				double value = json_object_get_number(pollTimeJson, "pollTime");
+				newPollTimeMs = (value < 1 || value > 60) ? 0 : (int)value * 1000;
+			}
+			json_value_free(payloadJson);
+
+			// setSensorConfig rejects periods that would overrun the FIFO
+			SensorConfig sensorConfig;
+			getSensorConfig(&sensorConfig);
+			sensorConfig.pollPeriodNs = (uint64_t)newPollTimeMs * 1000000ULL;
+			if (newPollTimeMs < 1 || setSensorConfig(&sensorConfig) != 0) {
 				goto payloadError;
 			}
 			else {
 
-				Log_Debug("New PollTime %d\n", newPollTime);
+				Log_Debug("New PollTime %d ms\n", newPollTimeMs);
 
 				// Construct the response message.  This will be displayed in the cloud when calling the direct method
 				static const char newPollTimeResponse[] =
-					"{ \"success\" : true, \"message\" : \"New Sensor Poll Time %d seconds\" }";
+					"{ \"success\" : true, \"message\" : \"New Sensor Poll Time %d ms\" }";
 				size_t responseMaxLength = sizeof(newPollTimeResponse) + strlen(payload);
-				*responsePayload = SetupHeapMessage(newPollTimeResponse, responseMaxLength, newPollTime);
+				*responsePayload = SetupHeapMessage(newPollTimeResponse, responseMaxLength, newPollTimeMs);
 				if (*responsePayload == NULL) {
 					Log_Debug("ERROR: Could not allocate buffer for direct method response payload.\n");
 					abort();
 				}
 				*responsePayloadSize = strlen(*responsePayload);
-
-				// Define a new timespec variable for the timer and change the timer period
-				struct timespec newAccelReadPeriod = { .tv_sec = 0,.tv_nsec = newPollTime };
-				SetTimerFdToPeriod(accelTimerFd, &newAccelReadPeriod);
 				return result;
 			}
 		}
+
+		// Check to see if the getTelemetryStats direct method was called.  No payload is needed, other than
+		// a valid Json argument such as {}.
+		else if (strcmp(methodName, "getTelemetryStats") == 0) {
+
+			Log_Debug("getTelemetryStats() Direct Method called\n");
+			result = 200;
+
+			const TelemetryRing *ring = getTelemetryRing();
+			MQTTStats mqtt;
+			MQTTGetStats(&mqtt);
+			// Sensor bus transactions since the end of the startup configuration, all 0 when the
+			// real-time core owns the bus
+			SensorBusStats bus;
+			SensorBus_GetStats(&bus);
+			uint32_t busTransactions = bus.reads.count + bus.writes.count;
+			unsigned busMeanUs = busTransactions == 0 ? 0U
+				: (unsigned)((bus.reads.totalNs + bus.writes.totalNs) / busTransactions / 1000);
+
+			static const char statsResponse[] =
+				"{ \"success\" : true, \"frames\" : %u, \"usedBytes\" : %u, \"capacityBytes\" : %u, "
+				"\"highWaterBytes\" : %u, \"pushedFrames\" : %u, \"droppedFrames\" : %u, "
+				"\"mqttSendBufferBytes\" : %u, \"mqttRecvBufferBytes\" : %u, \"mqttQueueHighWaterBytes\" : %u, "
+				"\"mqttQueueHighWaterMessages\" : %u, \"mqttSendBufferFull\" : %u, \"mqttPublishFailures\" : %u, "
+				"\"mqttSyncFailures\" : %u, \"mqttRecvBufferTooSmall\" : %u, \"mqttConnects\" : %u, "
+				"\"mqttConnectFailures\" : %u, \"mqttResolves\" : %u, \"busSpeedHz\" : %u, \"busReads\" : %u, "
+				"\"busWrites\" : %u, \"busMeanUs\" : %u, \"busMaxReadUs\" : %u, \"busMaxWriteUs\" : %u }";
+			size_t responseMaxLength = sizeof(statsResponse) + 23 * 10;
+			*responsePayload = SetupHeapMessage(statsResponse, responseMaxLength, ring->frames, (unsigned)ring->usedBytes,
+				(unsigned)ring->capacity, (unsigned)ring->highWaterBytes, ring->pushedFrames, ring->droppedFrames,
+				(unsigned)mqtt.sendBufferSize, (unsigned)mqtt.recvBufferSize, (unsigned)mqtt.sendQueueHighWaterBytes,
+				(unsigned)mqtt.sendQueueHighWaterMessages, mqtt.sendBufferFullCount, mqtt.publishFailCount,
+				mqtt.syncFailCount, mqtt.recvBufferTooSmallCount, mqtt.connectCount,
+				mqtt.connectFailCount, mqtt.resolveCount, bus.speedHz, bus.reads.count, bus.writes.count,
+				busMeanUs, bus.reads.maxNs / 1000, bus.writes.maxNs / 1000);
+			if (*responsePayload == NULL) {
+				Log_Debug("ERROR: Could not allocate buffer for direct method response payload.\n");
+				abort();
+			}
+			*responsePayloadSize = strlen(*responsePayload);
+			return result;
+		}
+
+		// Check to see if the setTelemetryBatch direct method was called
+		else if (strcmp(methodName, "setTelemetryBatch") == 0) {
+
+			Log_Debug("setTelemetryBatch() Direct Method called\n");
+			result = 200;
+
+			// The payload should contain a JSON object such as: {"batchSamples": 32, "maxLatencyMs": 100}
+			// Either key can be left out to keep its current value.
+			memcpy(directMethodCallContent, payload, payloadSize);
+			directMethodCallContent[payloadSize] = 0; // Null terminated string.
+
+			JSON_Value* payloadJson = json_parse_string(directMethodCallContent);
+			if (payloadJson == NULL) {
+				goto payloadError;
+			}
+
+			JSON_Object* batchJson = json_value_get_object(payloadJson);
+			if (batchJson == NULL) {
+				json_value_free(payloadJson);
+				goto payloadError;
+			}
+
+			uint16_t batchSamples;
+			uint32_t maxLatencyMs;
+			TelemetryBatch_GetConfig(&batchSamples, &maxLatencyMs);
+
+			if (json_object_has_value_of_type(batchJson, "batchSamples", JSONNumber)) {
+				double value = json_object_get_number(batchJson, "batchSamples");
+				batchSamples = (value < 1 || value > TELEMETRY_BATCH_MAX_SAMPLES) ? 0 : (uint16_t)value;
+			}
+			if (json_object_has_value_of_type(batchJson, "maxLatencyMs", JSONNumber)) {
+				double value = json_object_get_number(batchJson, "maxLatencyMs");
+				maxLatencyMs = (value < 1 || value > 60000) ? 0 : (uint32_t)value;
+			}
+			json_value_free(payloadJson);
+
+			// Out of range values were mapped to 0 above, which TelemetryBatch_Configure rejects
+			if (TelemetryBatch_Configure(batchSamples, maxLatencyMs) != 0) {
+				goto payloadError;
+			}
+
+			// Construct the response message.  This will be displayed in the cloud when calling the direct method
+			static const char newBatchResponse[] =
+				"{ \"success\" : true, \"message\" : \"Telemetry batch %u samples, %u ms max latency\" }";
+			size_t responseMaxLength = sizeof(newBatchResponse) + 2 * 10;
+			*responsePayload = SetupHeapMessage(newBatchResponse, responseMaxLength, batchSamples, maxLatencyMs);
+			if (*responsePayload == NULL) {
+				Log_Debug("ERROR: Could not allocate buffer for direct method response payload.\n");
+				abort();
+			}
+			*responsePayloadSize = strlen(*responsePayload);
+			return result;
+		}
+
+		// Check to see if the setSensorConfig direct method was called
+		else if (strcmp(methodName, "setSensorConfig") == 0) {
+
+			Log_Debug("setSensorConfig() Direct Method called\n");
+			result = 200;
+
+			// The payload should contain a JSON object such as:
+			// {"odrHz": 833, "accelFullScaleG": 8, "gyroFullScaleDps": 1000, "watermarkSamples": 32, "pollPeriodMs": 20}
+			// Any key can be left out to keep its current value.  The settings are applied together or not at all.
+			memcpy(directMethodCallContent, payload, payloadSize);
+			directMethodCallContent[payloadSize] = 0; // Null terminated string.
+
+			JSON_Value* payloadJson = json_parse_string(directMethodCallContent);
+			if (payloadJson == NULL) {
+				goto payloadError;
+			}
+
+			JSON_Object* configJson = json_value_get_object(payloadJson);
+			if (configJson == NULL) {
+				json_value_free(payloadJson);
+				goto payloadError;
+			}
+
+			SensorConfig sensorConfig;
+			getSensorConfig(&sensorConfig);
+
+			// Out of range values are mapped to 0, which setSensorConfig rejects
+			if (json_object_has_value_of_type(configJson, "odrHz", JSONNumber)) {
+				double value = json_object_get_number(configJson, "odrHz");
+				sensorConfig.odrMilliHz = (value < 1 || value > 10000) ? 0 : (uint32_t)(value * 1000 + 0.5);
+			}
+			if (json_object_has_value_of_type(configJson, "accelFullScaleG", JSONNumber)) {
+				double value = json_object_get_number(configJson, "accelFullScaleG");
+				sensorConfig.accelFullScaleG = (value < 1 || value > 16) ? 0 : (uint16_t)value;
+			}
+			if (json_object_has_value_of_type(configJson, "gyroFullScaleDps", JSONNumber)) {
+				double value = json_object_get_number(configJson, "gyroFullScaleDps");
+				sensorConfig.gyroFullScaleDps = (value < 1 || value > 2000) ? 0 : (uint16_t)value;
+			}
+			if (json_object_has_value_of_type(configJson, "watermarkSamples", JSONNumber)) {
+				double value = json_object_get_number(configJson, "watermarkSamples");
+				sensorConfig.watermarkSamples = (value < 1 || value > 1000) ? 0 : (uint16_t)value;
+			}
+			if (json_object_has_value_of_type(configJson, "pollPeriodMs", JSONNumber)) {
+				double value = json_object_get_number(configJson, "pollPeriodMs");
+				sensorConfig.pollPeriodNs = (value < 1 || value > 60000) ? 0 : (uint64_t)value * 1000000ULL;
+			}
+			json_value_free(payloadJson);
+
+			if (setSensorConfig(&sensorConfig) != 0) {
+				goto payloadError;
+			}
+
+			// Construct the response message.  This will be displayed in the cloud when calling the direct method
+			static const char newConfigResponse[] =
+				"{ \"success\" : true, \"odrMilliHz\" : %u, \"accelFullScaleG\" : %u, \"gyroFullScaleDps\" : %u, "
+				"\"watermarkSamples\" : %u, \"pollPeriodMs\" : %u }";
+			size_t responseMaxLength = sizeof(newConfigResponse) + 5 * 10;
+			*responsePayload = SetupHeapMessage(newConfigResponse, responseMaxLength, sensorConfig.odrMilliHz,
+				sensorConfig.accelFullScaleG, sensorConfig.gyroFullScaleDps, sensorConfig.watermarkSamples,
+				(unsigned)(sensorConfig.pollPeriodNs / 1000000ULL));
+			if (*responsePayload == NULL) {
+				Log_Debug("ERROR: Could not allocate buffer for direct method response payload.\n");
+				abort();
+			}
+			*responsePayloadSize = strlen(*responsePayload);
+			return result;
+		}
 		else {
 			result = 404;
 			Log_Debug("INFO: Direct Method called \"%s\" not found.\n", methodName);
@@ -274,7 +454,7 @@ static int DirectMethodCall(const char* methodName, const char* payload, size_t
 
 	}
 	else {
-		Log_Debug("Payload size > 32 bytes, aborting Direct Method execution\n");
+		Log_Debug("Payload size > %d bytes, aborting Direct Method execution\n", DIRECT_METHOD_MAX_PAYLOAD_SIZE);
 		goto payloadError;
 	}
 
@@ -306,75 +486,50 @@ payloadError:
 //// ADC connection
 
 /// <summary>
-///     Handle socket event by reading incoming data from real-time capable application.
+///     Handle socket event by reading the ADC messages the real-time capable application streams.
+///     It rings the doorbell once per batch of messages, so every message that is waiting is read.
 /// </summary>
 static void SocketEventHandler(EventData *eventData)
 {
-	// Read response from real-time capable application.
-	char rxBuf[32];
-	union Analog_data
-	{
-		uint32_t u32;
-		uint8_t u8[4];
-	} analog_data;
-
-	int bytesReceived = recv(sockFd, rxBuf, sizeof(rxBuf), 0);
-
-	if (bytesReceived == -1) {
-		Log_Debug("ERROR: Unable to receive message: %d (%s)\n", errno, strerror(errno));
-		terminationRequired = true;
-	}
-
-	// Copy data from Rx buffer to analog_data union
-	for (int i = 0; i < sizeof(analog_data); i++)
-	{
-		analog_data.u8[i] = rxBuf[i];
-	}
-
-	// get voltage (2.5*adc_reading/4096)
-	// divide by 3650 (3.65 kohm) to get current (A)
-	// multiply by 1000000 to get uA
-	// divide by 0.1428 to get Lux (based on fluorescent light Fig. 1 datasheet)
-	// divide by 0.5 to get Lux (based on incandescent light Fig. 1 datasheet)
-	// We can simplify the factors, but for demostration purpose it's OK
-	light_sensor = (float)(analog_data.u32*2.5/4095)*1000000 / (float)(3650*0.1428);
-
-	Log_Debug("Received %d bytes. ", bytesReceived);
-
-	Log_Debug("\n");	
-}
-
-/// <summary>
-///     Handle send timer event by writing data to the real-time capable application.
-/// </summary>
-static void TimerEventHandler(EventData *eventData)
-{
-	if (ConsumeTimerFdEvent(timerFd) != 0) {
-		terminationRequired = true;
-		return;
-	}
-
-	SendMessageToRTCore();
-}
-
-/// <summary>
-///     Helper function for TimerEventHandler sends message to real-time capable application.
-/// </summary>
-static void SendMessageToRTCore(void)
-{
-	static int iter = 0;
+	static bool hasSequence = false;
+	static uint32_t lastSequence = 0;
+	uint8_t rxBuf[256];
+
+	for (;;) {
+		ssize_t bytesReceived = recv(sockFd, rxBuf, sizeof(rxBuf), MSG_DONTWAIT);
+		if (bytesReceived == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				Log_Debug("ERROR: Unable to receive message: %d (%s)\n", errno, strerror(errno));
+				terminationRequired = true;
+			}
+			return;
+		}
 
-	// Send "Read-ADC-%d" message to real-time capable application.
-	static char txMessage[32];
-	sprintf(txMessage, "Read-ADC-%d", iter++);
-	Log_Debug("Sending: %s\n", txMessage);
+		IntercoreMessageHeader header;
+		if (IntercoreMessage_DecodeHeader(rxBuf, (size_t)bytesReceived, &header) != 0
+			|| header.type != INTERCORE_MESSAGE_ADC || header.payloadSize < sizeof(uint32_t)) {
+			Log_Debug("ERROR: Unexpected message from the real-time core (%d bytes)\n", (int)bytesReceived);
+			continue;
+		}
 
-	int bytesSent = send(sockFd, txMessage, strlen(txMessage), 0);
-	if (bytesSent == -1)
-	{
-		Log_Debug("ERROR: Unable to send message: %d (%s)\n", errno, strerror(errno));
-		terminationRequired = true;
-		return;
+		uint32_t missed = hasSequence ? IntercoreMessage_Missed(lastSequence, header.sequence) : 0;
+		if (missed > 0) {
+			Log_Debug("ERROR: Real-time core dropped %u ADC messages\n", missed);
+		}
+		hasSequence = true;
+		lastSequence = header.sequence;
+
+		// Readings are oldest first, the light level shown is the newest one
+		const uint8_t *newest = &rxBuf[INTERCORE_MESSAGE_HEADER_SIZE + (header.payloadSize / sizeof(uint32_t) - 1) * sizeof(uint32_t)];
+		uint32_t adc = (uint32_t)newest[0] | ((uint32_t)newest[1] << 8) | ((uint32_t)newest[2] << 16) | ((uint32_t)newest[3] << 24);
+
+		// get voltage (2.5*adc_reading/4096)
+		// divide by 3650 (3.65 kohm) to get current (A)
+		// multiply by 1000000 to get uA
+		// divide by 0.1428 to get Lux (based on fluorescent light Fig. 1 datasheet)
+		// divide by 0.5 to get Lux (based on incandescent light Fig. 1 datasheet)
+		// We can simplify the factors, but for demostration purpose it's OK
+		light_sensor = (float)(adc*2.5/4095)*1000000 / (float)(3650*0.1428);
 	}
 }
 
@@ -415,29 +570,13 @@ static int InitPeripheralsAndHandlers(void)
 	{
 		// Communication with RT core success
 		RTCore_status = 0;
-		// Set timeout, to handle case where real-time capable application does not respond.
-		static const struct timeval recvTimeout = { .tv_sec = 5,.tv_usec = 0 };
-		int result = setsockopt(sockFd, SOL_SOCKET, SO_RCVTIMEO, &recvTimeout, sizeof(recvTimeout));
-		if (result == -1)
-		{
-			Log_Debug("ERROR: Unable to set socket timeout: %d (%s)\n", errno, strerror(errno));
-			return -1;
-		}
 
-		// Register handler for incoming messages from real-time capable application.
+		// Register handler for the messages the real-time capable application streams, there is
+		// nothing to request
 		if (RegisterEventHandlerToEpoll(epollFd, sockFd, &socketEventData, EPOLLIN) != 0)
 		{
 			return -1;
 		}
-
-		// Register one second timer to send a message to the real-time core.
-		static const struct timespec sendPeriod = { .tv_sec = 1,.tv_nsec = 0 };
-		timerFd = CreateTimerFdAndAddToEpoll(epollFd, &sendPeriod, &timerEventData, EPOLLIN);
-		if (timerFd < 0)
-		{
-			return -1;
-		}
-		RegisterEventHandlerToEpoll(epollFd, timerFd, &timerEventData, EPOLLIN);
 	}
 
 	//// end ADC Connection
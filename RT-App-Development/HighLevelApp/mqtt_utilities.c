@@ -4,41 +4,125 @@
 //#include "eventloop_timer_utilities.h"
 #include <unistd.h>
 #include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <netdb.h>
 #include "stdbool.h"
 #include <errno.h>
-#include <poll.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include "common.h"
+#include "epoll_timerfd_utilities.h"
+#include "mqtt_utilities.h"
+
+// How often the client is synced when the socket is idle, so keep-alive pings and
+// QoS 1 retransmissions go out on time
+#define MQTT_SYNC_PERIOD_SECONDS 1
+
+// Give up on a DNS lookup or TCP connect after this long and back off
+#define MQTT_RESOLVE_TIMEOUT_MS 10000
+#define MQTT_CONNECT_TIMEOUT_MS 5000
+
+// Look the broker name up again after this many failed attempts in a row, in case its address changed
+#define MQTT_RESOLVE_AFTER_FAILURES 3
+
+// A connection that stayed up this long resets the backoff
+#define MQTT_STABLE_CONNECTION_SECONDS 30
 
 static void emptyCallback(const char* topic, const char* msg) {};
 
-static bool isThreadUp = false;
-static bool killThreadRequest = false;
+/*
+* Connection state machine, driven entirely by epoll events:
+*
+* IDLE -> RESOLVING (name lookup on a worker thread, completion signalled through an eventfd)
+*      -> CONNECTING (non-blocking connect, completion signalled by EPOLLOUT)
+*      -> CONNECTED (MQTT CONNECT queued, client synced on socket events)
+*
+* Any failure closes the socket and moves to BACKOFF, which restarts the sequence when the
+* jittered exponential backoff timer expires.  Only MQTTStop goes back to IDLE.
+*/
+typedef enum {
+	CONN_IDLE,
+	CONN_RESOLVING,
+	CONN_CONNECTING,
+	CONN_CONNECTED,
+	CONN_BACKOFF
+} ConnectionState;
 
-static pthread_mutex_t sockMutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t killMutex = PTHREAD_MUTEX_INITIALIZER;
+static ConnectionState connState = CONN_IDLE;
 
 static int socketFd = -1;
 
 static struct mqtt_client client;
 
-static pthread_t client_daemon;
-
-static uint8_t sendbuf[512];
-static uint8_t recvbuf[512];
+static int mqttEpollFd = -1;
+static int syncTimerFd = -1;
+static uint32_t socketEventMask = 0;
+
+// Backoff delay, connect timeout and resolve timeout, whichever applies to the current state
+static int connectTimerFd = -1;
+static int resolverEventFd = -1;
+
+static char brokerHost[256];
+static char brokerPort[8];
+
+// Last resolved broker address, reused on reconnect so DNS is not queried every time
+static struct sockaddr_in brokerAddr;
+static bool brokerAddrValid = false;
+static bool brokerIsLiteral = false;
+
+static uint32_t backoffMinMs = 500;
+static uint32_t backoffMaxMs = 60000;
+static uint32_t failedAttempts = 0;
+static struct timespec connectedAt;
+
+// Filled by the resolver thread, read by the event loop once resolverEventFd fires
+static pthread_mutex_t resolverMutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int resolverGeneration = 0;
+static struct sockaddr_in resolvedAddr;
+static int resolvedStatus = -1;
+
+// Buffers are allocated on the first MQTTInit, sized by MQTTConfigureBuffers
+static uint8_t* sendbuf = NULL;
+static uint8_t* recvbuf = NULL;
+static size_t sendbufSize = 8192;
+static size_t recvbufSize = 512;
+static size_t sendbufMaxSize = 8192;
+static size_t recvbufMaxSize = 512;
+
+// Set when a buffer turned out too small, the buffer doubles (up to its max) at the next safe point
+static bool growSendbuf = false;
+static bool growRecvbuf = false;
+
+static MQTTStats stats;
+
+// MQTT-C publish flags per message class.  Telemetry skips the PUBACK round trip; the
+// store-and-forward ring already covers outages, a frame is only lost if the link drops mid-send.
+static uint8_t publishFlags[MQTT_CLASS_COUNT] = {
+	[MQTT_CLASS_TELEMETRY] = MQTT_PUBLISH_QOS_0,
+	[MQTT_CLASS_CONTROL] = MQTT_PUBLISH_QOS_1,
+	[MQTT_CLASS_SUMMARY] = MQTT_PUBLISH_QOS_1 | MQTT_PUBLISH_RETAIN
+};
 
 static void(*subCallback)(const char* topic, const char* msg) = emptyCallback;
 
 /* external functions */
+int MQTTAttachToEpoll(int epollFd);
+void MQTTDetachFromEpoll();
+int MQTTConfigureBuffers(size_t sendSize, size_t sendMaxSize, size_t recvSize, size_t recvMaxSize);
+int MQTTConfigureBackoff(uint32_t minMs, uint32_t maxMs);
+void MQTTGetStats(MQTTStats* out);
 int MQTTInit(const char* addr, const char* port, const char* subTopic);
 void MQTTStop();
-void MQTTKillSubthread();
 bool MQTTIsActiveConnection();
+int MQTTSetPublishPolicy(MQTTMessageClass messageClass, uint8_t qos, bool retain);
 int MQTTPublish(const char* topic, const char* msg);
+int MQTTPublishBinary(const char* topic, const void* data, size_t size, MQTTMessageClass messageClass);
+bool MQTTCanPublish(const char* topic, size_t size);
 void MQTTRegisterSubscribeCallback(void(*cb)(const char*topic, const char* msg));
 
 /* helpers */
@@ -51,110 +135,293 @@ void MQTTRegisterSubscribeCallback(void(*cb)(const char*topic, const char* msg))
 static void publish_callback(void** unused, struct mqtt_response_publish* published);
 
 /**
-* @brief Main function of MQTT refresher subthread.
+* @brief Run mqtt_sync when the socket is readable or writable.
+*
+* @param eventData Event data of the socket.
+*/
+static void socket_event_handler(EventData* eventData);
+
+/**
+* @brief Run mqtt_sync periodically for keep-alive and retransmissions.
+*
+* @param eventData Event data of the timer.
+*/
+static void sync_timer_event_handler(EventData* eventData);
+
+/**
+* @brief Sync the client with the broker, then watch the socket for writability only while queued messages are unsent.
+*/
+static void sync_client();
+
+/**
+* @brief Register the socket with epoll with the given event mask, if it differs from the current one.
+*/
+static void update_socket_events(uint32_t mask);
+
+/**
+* @brief Double a buffer size, capped at max.
+*/
+static size_t grown_size(size_t size, size_t max);
+
+/**
+* @brief Allocate the buffers, applying any pending growth. Only called while the client is stopped.
 *
-* @param client Pointer to MQTT client.
+* @return 0 on success, -1 if out of memory.
+*/
+static int allocate_buffers();
+
+/**
+* @brief Move an empty send queue into a larger buffer while the connection stays up.
 */
-static void client_refresher(void* client);
+static void grow_send_queue();
 
 /**
-* @brief Open a non blocking socket.
+* @brief Track the send queue high-water marks.
+*/
+static void update_queue_stats();
+
+/**
+* @brief Start a connection attempt from the cached address, a literal IP address or a new name lookup.
+*/
+static void start_connect();
+
+/**
+* @brief Resolve the broker name on a worker thread, getaddrinfo blocks.
+*/
+static void start_resolve();
+
+/**
+* @brief Worker thread body: resolve the broker name and signal resolverEventFd.
 *
-* @param addr IP address of server to connect.
-* @param port port of said server
-* @return Socket file descriptor or -1 if failed to open.
+* @param arg Resolver generation the lookup belongs to.
+*/
+static void* resolver_thread(void* arg);
+
+/**
+* @brief Pick up the result of the resolver thread.
+*/
+static void resolver_event_handler(EventData* eventData);
+
+/**
+* @brief Open a non-blocking socket and start connecting to the cached broker address.
+*/
+static void open_connection();
+
+/**
+* @brief TCP connection is up: hand the socket to MQTT-C and queue CONNECT.
+*/
+static void on_tcp_connected();
+
+/**
+* @brief Backoff, connect timeout and resolve timeout expiry.
 */
-int open_nb_socket(const char* addr, const char* port);
+static void connect_timer_event_handler(EventData* eventData);
+
+/**
+* @brief Close the socket and schedule the next attempt with jittered exponential backoff.
+*/
+static void connection_failed(const char* reason);
+
+/**
+* @brief Close the socket and remove it from epoll.
+*/
+static void close_socket();
+
+/**
+* @brief Arm connectTimerFd to fire once after ms milliseconds, 0 disarms it.
+*/
+static void arm_connect_timer(uint32_t ms);
+
+static EventData socketEventData = { .eventHandler = &socket_event_handler };
+static EventData syncTimerEventData = { .eventHandler = &sync_timer_event_handler };
+static EventData connectTimerEventData = { .eventHandler = &connect_timer_event_handler };
+static EventData resolverEventData = { .eventHandler = &resolver_event_handler };
 
 /* declarations */
-int MQTTInit(const char* addr, const char* port, const char* subTopic) {
+int MQTTAttachToEpoll(int epollFd) {
+	mqttEpollFd = epollFd;
 
-	pthread_mutex_lock(&sockMutex);
-	socketFd = open_nb_socket(addr, port);
+	struct timespec syncPeriod = { .tv_sec = MQTT_SYNC_PERIOD_SECONDS, .tv_nsec = 0 };
+	syncTimerFd = CreateTimerFdAndAddToEpoll(mqttEpollFd, &syncPeriod, &syncTimerEventData, EPOLLIN);
+	if (syncTimerFd < 0)
+		return -1;
 
-	if (socketFd == -1) {
-		Log_Debug("Failed to open socket.\n");
-		pthread_mutex_unlock(&sockMutex);
-		MQTTStop();
+	struct timespec disarmed = { 0, 0 };
+	connectTimerFd = CreateTimerFdAndAddToEpoll(mqttEpollFd, &disarmed, &connectTimerEventData, EPOLLIN);
+	if (connectTimerFd < 0)
+		return -1;
+
+	resolverEventFd = eventfd(0, EFD_NONBLOCK);
+	if (resolverEventFd < 0 || RegisterEventHandlerToEpoll(mqttEpollFd, resolverEventFd, &resolverEventData, EPOLLIN) != 0) {
+		Log_Debug("ERROR: Could not create resolver eventfd: %s (%d).\n", strerror(errno), errno);
 		return -1;
 	}
-	
-	mqtt_init(&client, socketFd, sendbuf, sizeof(sendbuf), recvbuf, sizeof(recvbuf), publish_callback);
 
-	pthread_mutex_unlock(&sockMutex);
+	// Different devices restarting together should not retry in lockstep
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	srand((unsigned int)(now.tv_nsec ^ getpid()));
 
-	mqtt_connect(&client, NULL, NULL, NULL, 0, NULL, NULL, MQTT_CONNECT_CLEAN_SESSION, 400);
+	return 0;
+}
 
-	if (client.error != MQTT_OK) {
-		Log_Debug("Failed to connect to MQTT broker\n");
-		MQTTStop();
-		return -1;
-	}
+void MQTTDetachFromEpoll() {
+	MQTTStop();
+	CloseFdAndPrintError(syncTimerFd, "mqttSyncTimer");
+	CloseFdAndPrintError(connectTimerFd, "mqttConnectTimer");
+	CloseFdAndPrintError(resolverEventFd, "mqttResolverEvent");
+	syncTimerFd = -1;
+	connectTimerFd = -1;
+	resolverEventFd = -1;
+	mqttEpollFd = -1;
+}
 
-	if (!isThreadUp) {
-		if (pthread_create(&client_daemon, NULL, client_refresher, &client)) {
-			Log_Debug("Failed to start client daemon.\n");
-			MQTTStop();
-			return -1;
-		}
-		isThreadUp = true;
+int MQTTConfigureBuffers(size_t sendSize, size_t sendMaxSize, size_t recvSize, size_t recvMaxSize) {
+	if (sendbuf != NULL || recvbuf != NULL) {
+		Log_Debug("ERROR: MQTT buffers must be configured before MQTTInit\n");
+		return -1;
 	}
+	if (sendSize == 0 || recvSize == 0 || sendMaxSize < sendSize || recvMaxSize < recvSize)
+		return -1;
 
-//	mqtt_subscribe(&client, subTopic, MQTT_PUBLISH_QOS_1);
+	sendbufSize = sendSize;
+	sendbufMaxSize = sendMaxSize;
+	recvbufSize = recvSize;
+	recvbufMaxSize = recvMaxSize;
+	return 0;
+}
 
-	Log_Debug("MQTT client initialized.\n");
+int MQTTConfigureBackoff(uint32_t minMs, uint32_t maxMs) {
+	if (minMs == 0 || maxMs < minMs)
+		return -1;
 
+	backoffMinMs = minMs;
+	backoffMaxMs = maxMs;
 	return 0;
 }
 
-void MQTTStop() {
-	pthread_mutex_lock(&sockMutex);
+void MQTTGetStats(MQTTStats* out) {
+	*out = stats;
+	out->sendBufferSize = sendbufSize;
+	out->recvBufferSize = recvbufSize;
+}
 
-	if (socketFd != -1) {
-		close(socketFd);
-		Log_Debug("MQTT client stopped\n");
+int MQTTInit(const char* addr, const char* port, const char* subTopic) {
+
+	if (mqttEpollFd == -1) {
+		Log_Debug("ERROR: MQTTAttachToEpoll must be called before MQTTInit\n");
+		return -1;
+	}
+
+	if (strlen(addr) >= sizeof(brokerHost) || strlen(port) >= sizeof(brokerPort)) {
+		Log_Debug("ERROR: MQTT broker address too long\n");
+		return -1;
 	}
-	socketFd = -1;
 
-	pthread_mutex_unlock(&sockMutex);
-	
+	// Already connected or working on it, the state machine reconnects by itself
+	if (connState != CONN_IDLE)
+		return 0;
+
+	if (strcmp(addr, brokerHost) != 0 || strcmp(port, brokerPort) != 0) {
+		strcpy(brokerHost, addr);
+		strcpy(brokerPort, port);
+		brokerAddrValid = false;
+	}
+
+//	mqtt_subscribe(&client, subTopic, MQTT_PUBLISH_QOS_1);
+
+	failedAttempts = 0;
+	start_connect();
+
+	return 0;
 }
 
-void MQTTKillSubthread() {
-	pthread_mutex_lock(&killMutex);
+void MQTTStop() {
+	if (connState != CONN_IDLE)
+		Log_Debug("MQTT client stopped\n");
 
-	killThreadRequest = true;
+	close_socket();
+	arm_connect_timer(0);
 
-	pthread_mutex_unlock(&killMutex);
+	// A lookup still running on the resolver thread is ignored when it completes
+	pthread_mutex_lock(&resolverMutex);
+	resolverGeneration++;
+	pthread_mutex_unlock(&resolverMutex);
 
-	pthread_join(client_daemon, NULL);
-	isThreadUp = false;
+	connState = CONN_IDLE;
 }
 
 bool MQTTIsActiveConnection() {
-	pthread_mutex_lock(&sockMutex);
-
-	bool res = (socketFd != -1);
+	return connState == CONN_CONNECTED;
+}
 
-	pthread_mutex_unlock(&sockMutex);
+int MQTTSetPublishPolicy(MQTTMessageClass messageClass, uint8_t qos, bool retain) {
+	if (messageClass >= MQTT_CLASS_COUNT || qos > 2)
+		return -1;
 
-	return res;
+	publishFlags[messageClass] = (uint8_t)((qos << 1) & MQTT_PUBLISH_QOS_MASK) | (retain ? MQTT_PUBLISH_RETAIN : 0);
+	return 0;
 }
 
 int MQTTPublish(const char* topic, const char* msg) {
-	if (!MQTTIsActiveConnection())
+	return MQTTPublishBinary(topic, msg, strlen(msg) + 1, MQTT_CLASS_CONTROL);
+}
+
+int MQTTPublishBinary(const char* topic, const void* data, size_t size, MQTTMessageClass messageClass) {
+	if (!MQTTIsActiveConnection() || messageClass >= MQTT_CLASS_COUNT)
 		return -1;
-	mqtt_publish(&client, topic, msg, strlen(msg) + 1, MQTT_PUBLISH_QOS_1);
+	enum MQTTErrors err = mqtt_publish(&client, topic, data, size, publishFlags[messageClass]);
+
+	if (err == MQTT_ERROR_SEND_BUFFER_IS_FULL) {
+		// Not a connection problem: MQTT-C keeps the error in client.error, which would fail every
+		// later publish, so clear it and let the caller retry once PUBACKs free up the queue
+		MQTT_PAL_MUTEX_LOCK(&client.mutex);
+		client.error = MQTT_OK;
+		MQTT_PAL_MUTEX_UNLOCK(&client.mutex);
+
+		stats.sendBufferFullCount++;
+		growSendbuf = true;
+		return -1;
+	}
 
 	if (client.error != MQTT_OK) {
+		stats.publishFailCount++;
 		Log_Debug("%d\n", client.error);
 		Log_Debug("Failed to publish MQTT message\n");
-		MQTTStop();
+		connection_failed(mqtt_error_str(client.error));
 		return -1;
 	}
+
+	update_queue_stats();
+
+	// Wake up when the socket can take the message instead of waiting for the sync timer
+	update_socket_events(EPOLLIN | EPOLLOUT);
 	return 0;
 }
 
+bool MQTTCanPublish(const char* topic, size_t size) {
+	if (!MQTTIsActiveConnection())
+		return false;
+
+	// PUBLISH fixed header (up to 5 bytes), topic length, topic and packet id
+	size_t needed = size + strlen(topic) + 9;
+
+	MQTT_PAL_MUTEX_LOCK(&client.mutex);
+	if (client.mq.curr_sz < needed) {
+		// Reclaim space held by messages that were already acknowledged
+		mqtt_mq_clean(&client.mq);
+	}
+	bool res = client.mq.curr_sz >= needed;
+	MQTT_PAL_MUTEX_UNLOCK(&client.mutex);
+
+	if (!res) {
+		stats.sendBufferFullCount++;
+		growSendbuf = true;
+	}
+
+	return res;
+}
+
 void MQTTRegisterSubscribeCallback(void(*cb)(const char* topic, const char* msg)) {
 	subCallback = cb;
 }
@@ -179,62 +446,362 @@ static void publish_callback(void** unused, struct mqtt_response_publish* publis
 	return;
 }
 
-static void client_refresher(void* cl)
-{
-	while (1)
-	{
-		if (MQTTIsActiveConnection()) {
-			int err = mqtt_sync((struct mqtt_client*) cl);
-		}
-		waitMs(100);
+static void socket_event_handler(EventData* eventData) {
+	if (connState == CONN_CONNECTING) {
+		// Writable means the non-blocking connect finished, SO_ERROR says whether it worked
+		int error = 0;
+		socklen_t len = sizeof(error);
+		if (getsockopt(socketFd, SOL_SOCKET, SO_ERROR, &error, &len) != 0)
+			error = errno;
 
-		pthread_mutex_lock(&killMutex);
-		if (killThreadRequest) {
-			killThreadRequest = false;
-			pthread_mutex_unlock(&killMutex);
+		if (error != 0) {
+			connection_failed(strerror(error));
 			return;
 		}
-		pthread_mutex_unlock(&killMutex);
+		on_tcp_connected();
+		return;
 	}
-	return;
+
+	sync_client();
 }
 
-int open_nb_socket(const char* addr, const char* port) {
-	struct addrinfo hints = { 0 };
+static void sync_timer_event_handler(EventData* eventData) {
+	if (ConsumeTimerFdEvent(syncTimerFd) != 0)
+		return;
+
+	sync_client();
+}
+
+static void sync_client() {
+	if (!MQTTIsActiveConnection())
+		return;
+
+	enum MQTTErrors err = mqtt_sync(&client);
+	if (err != MQTT_OK) {
+		Log_Debug("MQTT sync failed: %s\n", mqtt_error_str(err));
+		stats.syncFailCount++;
+		if (err == MQTT_ERROR_RECV_BUFFER_TOO_SMALL) {
+			// The receive buffer can only be replaced on reconnect
+			stats.recvBufferTooSmallCount++;
+			growRecvbuf = true;
+		}
+		connection_failed(mqtt_error_str(err));
+		return;
+	}
+
+	if (growSendbuf)
+		grow_send_queue();
+
+	// The socket is almost always writable, only ask for EPOLLOUT while something is waiting to be sent
+	bool unsent = false;
+	MQTT_PAL_MUTEX_LOCK(&client.mutex);
+	for (ssize_t i = 0; i < mqtt_mq_length(&client.mq); i++) {
+		if (mqtt_mq_get(&client.mq, i)->state == MQTT_QUEUED_UNSENT) {
+			unsent = true;
+			break;
+		}
+	}
+	MQTT_PAL_MUTEX_UNLOCK(&client.mutex);
+
+	update_socket_events(unsent ? (EPOLLIN | EPOLLOUT) : EPOLLIN);
+}
+
+static size_t grown_size(size_t size, size_t max) {
+	return (size * 2 > max) ? max : size * 2;
+}
+
+static int allocate_buffers() {
+	if (growSendbuf && sendbufSize < sendbufMaxSize) {
+		free(sendbuf);
+		sendbuf = NULL;
+		sendbufSize = grown_size(sendbufSize, sendbufMaxSize);
+		stats.sendBufferGrowCount++;
+	}
+	if (growRecvbuf && recvbufSize < recvbufMaxSize) {
+		free(recvbuf);
+		recvbuf = NULL;
+		recvbufSize = grown_size(recvbufSize, recvbufMaxSize);
+		stats.recvBufferGrowCount++;
+	}
+	growSendbuf = false;
+	growRecvbuf = false;
+
+	if (sendbuf == NULL)
+		sendbuf = malloc(sendbufSize);
+	if (recvbuf == NULL)
+		recvbuf = malloc(recvbufSize);
+
+	return (sendbuf == NULL || recvbuf == NULL) ? -1 : 0;
+}
+
+static void grow_send_queue() {
+	if (sendbufSize >= sendbufMaxSize) {
+		growSendbuf = false;
+		return;
+	}
+
+	MQTT_PAL_MUTEX_LOCK(&client.mutex);
+	mqtt_mq_clean(&client.mq);
+
+	// Queued messages point into the old buffer, wait until everything was acknowledged
+	if (mqtt_mq_length(&client.mq) == 0) {
+		size_t newSize = grown_size(sendbufSize, sendbufMaxSize);
+		uint8_t* newbuf = malloc(newSize);
+		if (newbuf != NULL) {
+			mqtt_mq_init(&client.mq, newbuf, newSize);
+			free(sendbuf);
+			sendbuf = newbuf;
+			sendbufSize = newSize;
+			stats.sendBufferGrowCount++;
+			Log_Debug("MQTT send buffer grown to %u bytes\n", (unsigned)newSize);
+		}
+		growSendbuf = false;
+	}
+	MQTT_PAL_MUTEX_UNLOCK(&client.mutex);
+}
+
+static void update_queue_stats() {
+	MQTT_PAL_MUTEX_LOCK(&client.mutex);
+	size_t used = sendbufSize - client.mq.curr_sz;
+	size_t messages = (size_t)mqtt_mq_length(&client.mq);
+	MQTT_PAL_MUTEX_UNLOCK(&client.mutex);
+
+	if (used > stats.sendQueueHighWaterBytes)
+		stats.sendQueueHighWaterBytes = used;
+	if (messages > stats.sendQueueHighWaterMessages)
+		stats.sendQueueHighWaterMessages = messages;
+}
+
+static void update_socket_events(uint32_t mask) {
+	if (socketFd == -1 || mask == socketEventMask)
+		return;
+
+	if (RegisterEventHandlerToEpoll(mqttEpollFd, socketFd, &socketEventData, mask) == 0)
+		socketEventMask = mask;
+}
+
+static void start_connect() {
+	if (!brokerAddrValid) {
+		// An IP address needs no lookup
+		memset(&brokerAddr, 0, sizeof(brokerAddr));
+		brokerAddr.sin_family = AF_INET;
+		brokerAddr.sin_port = htons((uint16_t)atoi(brokerPort));
+		brokerIsLiteral = (inet_pton(AF_INET, brokerHost, &brokerAddr.sin_addr) == 1);
+		brokerAddrValid = brokerIsLiteral;
+	}
+
+	if (brokerAddrValid) {
+		open_connection();
+	} else {
+		start_resolve();
+	}
+}
+
+static void start_resolve() {
+	connState = CONN_RESOLVING;
+	stats.resolveCount++;
 
+	pthread_mutex_lock(&resolverMutex);
+	unsigned int generation = ++resolverGeneration;
+	pthread_mutex_unlock(&resolverMutex);
+
+	pthread_t thread;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	int res = pthread_create(&thread, &attr, resolver_thread, (void*)(uintptr_t)generation);
+	pthread_attr_destroy(&attr);
+
+	if (res != 0) {
+		connection_failed("could not start resolver thread");
+		return;
+	}
+
+	arm_connect_timer(MQTT_RESOLVE_TIMEOUT_MS);
+}
+
+static void* resolver_thread(void* arg) {
+	unsigned int generation = (unsigned int)(uintptr_t)arg;
+	char host[sizeof(brokerHost)];
+	char port[sizeof(brokerPort)];
+
+	// The event loop only changes the broker name while no lookup is current
+	pthread_mutex_lock(&resolverMutex);
+	strcpy(host, brokerHost);
+	strcpy(port, brokerPort);
+	pthread_mutex_unlock(&resolverMutex);
+
+	struct addrinfo hints = { 0 };
 	hints.ai_family = AF_INET;
 	hints.ai_socktype = SOCK_STREAM;
-	int sockfd = -1;
-	int rv;
-	struct addrinfo *servinfo;
+	struct addrinfo* servinfo = NULL;
 
-	rv = getaddrinfo(addr, port, &hints, &servinfo);
+	int rv = getaddrinfo(host, port, &hints, &servinfo);
 
-	if (rv == -1) {
-		return -1;
+	pthread_mutex_lock(&resolverMutex);
+	if (generation == resolverGeneration) {
+		if (rv == 0 && servinfo != NULL && servinfo->ai_addrlen <= sizeof(resolvedAddr)) {
+			memcpy(&resolvedAddr, servinfo->ai_addr, servinfo->ai_addrlen);
+			resolvedStatus = 0;
+		} else {
+			resolvedStatus = -1;
+		}
 	}
+	pthread_mutex_unlock(&resolverMutex);
 
-	sockfd = socket(servinfo->ai_family, hints.ai_socktype | SOCK_NONBLOCK, servinfo->ai_protocol);
-	if (sockfd == -1) {
-		return -1;
+	if (servinfo != NULL)
+		freeaddrinfo(servinfo);
+
+	uint64_t one = 1;
+	write(resolverEventFd, &one, sizeof(one));
+	return NULL;
+}
+
+static void resolver_event_handler(EventData* eventData) {
+	uint64_t count;
+	if (read(resolverEventFd, &count, sizeof(count)) != sizeof(count))
+		return;
+
+	// Late results of abandoned lookups were dropped by the generation check
+	if (connState != CONN_RESOLVING)
+		return;
+
+	pthread_mutex_lock(&resolverMutex);
+	int status = resolvedStatus;
+	resolvedStatus = -1;
+	if (status == 0) {
+		brokerAddr = resolvedAddr;
+		brokerAddrValid = true;
 	}
+	pthread_mutex_unlock(&resolverMutex);
 
-	rv = connect(sockfd, servinfo->ai_addr, servinfo->ai_addrlen);
+	if (status != 0) {
+		connection_failed("could not resolve broker address");
+		return;
+	}
 
-	struct pollfd pfd = {
-		.fd = sockfd,
-		.events = 255,
-		.revents = 255
-	};
+	arm_connect_timer(0);
+	open_connection();
+}
 
-	int res = poll(&pfd, 1, 500);// wait for an event from socket
-	if (res <= 0) {
-		Log_Debug("\nNo response from socket\n");
-		close(sockfd);
-		return -1;
+static void open_connection() {
+	socketFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (socketFd == -1) {
+		connection_failed(strerror(errno));
+		return;
+	}
+
+	if (connect(socketFd, (const struct sockaddr*)&brokerAddr, sizeof(brokerAddr)) == 0) {
+		on_tcp_connected();
+		return;
 	}
 
-	freeaddrinfo(servinfo);
+	if (errno != EINPROGRESS) {
+		connection_failed(strerror(errno));
+		return;
+	}
+
+	// Wait for the connect to complete without blocking the event loop
+	connState = CONN_CONNECTING;
+	socketEventMask = 0;
+	update_socket_events(EPOLLOUT);
+	arm_connect_timer(MQTT_CONNECT_TIMEOUT_MS);
+}
+
+static void on_tcp_connected() {
+	arm_connect_timer(0);
 
-	return sockfd;
-}
\ No newline at end of file
+	if (allocate_buffers() != 0) {
+		connection_failed("could not allocate MQTT buffers");
+		return;
+	}
+
+	mqtt_init(&client, socketFd, sendbuf, sendbufSize, recvbuf, recvbufSize, publish_callback);
+	mqtt_connect(&client, NULL, NULL, NULL, 0, NULL, NULL, MQTT_CONNECT_CLEAN_SESSION, 400);
+
+	if (client.error != MQTT_OK) {
+		connection_failed("failed to queue MQTT CONNECT");
+		return;
+	}
+
+	connState = CONN_CONNECTED;
+	stats.connectCount++;
+	clock_gettime(CLOCK_MONOTONIC, &connectedAt);
+
+	// CONNECT is queued, send it as soon as the socket is writable
+	update_socket_events(EPOLLIN | EPOLLOUT);
+
+	Log_Debug("MQTT client initialized.\n");
+}
+
+static void connect_timer_event_handler(EventData* eventData) {
+	if (ConsumeTimerFdEvent(connectTimerFd) != 0)
+		return;
+
+	switch (connState) {
+	case CONN_BACKOFF:
+		start_connect();
+		break;
+	case CONN_RESOLVING:
+		pthread_mutex_lock(&resolverMutex);
+		resolverGeneration++;
+		pthread_mutex_unlock(&resolverMutex);
+		connection_failed("broker address lookup timed out");
+		break;
+	case CONN_CONNECTING:
+		connection_failed("connect timed out");
+		break;
+	default:
+		break;
+	}
+}
+
+static void connection_failed(const char* reason) {
+	bool wasConnected = (connState == CONN_CONNECTED);
+	close_socket();
+
+	if (wasConnected) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec - connectedAt.tv_sec >= MQTT_STABLE_CONNECTION_SECONDS)
+			failedAttempts = 0;
+	} else {
+		stats.connectFailCount++;
+	}
+
+	failedAttempts++;
+	if (failedAttempts >= MQTT_RESOLVE_AFTER_FAILURES && !brokerIsLiteral)
+		brokerAddrValid = false;
+
+	// Exponential backoff with "equal jitter": wait between half and all of the current step
+	uint32_t delay = backoffMinMs;
+	for (uint32_t i = 1; i < failedAttempts && delay < backoffMaxMs; i++)
+		delay *= 2;
+	if (delay > backoffMaxMs)
+		delay = backoffMaxMs;
+	delay = delay / 2 + (uint32_t)rand() % (delay / 2 + 1);
+
+	Log_Debug("MQTT connection failed (%s), retrying in %u ms\n", reason, delay);
+
+	connState = CONN_BACKOFF;
+	arm_connect_timer(delay);
+}
+
+static void close_socket() {
+	if (socketFd != -1) {
+		if (socketEventMask != 0)
+			UnregisterEventHandlerFromEpoll(mqttEpollFd, socketFd);
+		close(socketFd);
+	}
+	socketFd = -1;
+	socketEventMask = 0;
+}
+
+static void arm_connect_timer(uint32_t ms) {
+	if (connectTimerFd == -1)
+		return;
+
+	// A zero expiry disarms the timer
+	struct timespec expiry = { .tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000 };
+	SetTimerFdToSingleExpiry(connectTimerFd, &expiry);
+}
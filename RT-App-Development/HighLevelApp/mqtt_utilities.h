@@ -1,19 +1,92 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 /**
-* @brief Start MQTT client and create subthread if necessary.
+* @brief Buffer sizes, queue occupancy and failure counters of the MQTT client, for sizing memory per deployment.
 */
-int MQTTInit(const char* addr, const char* port, const char* subTopic);
+typedef struct {
+	size_t sendBufferSize;              // current send buffer size in bytes
+	size_t recvBufferSize;              // current receive buffer size in bytes
+	size_t sendQueueHighWaterBytes;     // most send buffer bytes in use at once
+	size_t sendQueueHighWaterMessages;  // most messages queued at once (unsent or waiting for PUBACK)
+	uint32_t sendBufferFullCount;       // times a publish found the send buffer full
+	uint32_t publishFailCount;          // publishes that failed for any other reason
+	uint32_t syncFailCount;             // send/receive errors, each one drops the connection
+	uint32_t recvBufferTooSmallCount;   // incoming messages larger than the receive buffer
+	uint32_t sendBufferGrowCount;       // times the send buffer was grown
+	uint32_t recvBufferGrowCount;       // times the receive buffer was grown
+	uint32_t connectCount;              // connections opened
+	uint32_t connectFailCount;          // connection attempts that failed before the connection was up
+	uint32_t resolveCount;              // DNS lookups of the broker name
+} MQTTStats;
 
 /**
-* @brief Stop MQTT client but keep subthread running.
+* @brief Kinds of messages the application publishes. Each class has its own QoS and retain policy.
 */
-void MQTTStop();
+typedef enum {
+	MQTT_CLASS_TELEMETRY = 0, // high-rate sample frames
+	MQTT_CLASS_CONTROL,       // start markers, commands and responses
+	MQTT_CLASS_SUMMARY,       // low-rate results such as cycle summaries and predictions
+	MQTT_CLASS_COUNT
+} MQTTMessageClass;
+
+/**
+* @brief Drive the MQTT client from the application's epoll loop. Must be called once before MQTTInit.
+*
+* The client socket is synced when it becomes readable (or writable while messages are waiting to be sent)
+* and on a periodic timer for keep-alive pings and retransmissions.
+*
+* @param epollFd Epoll file descriptor.
+* @return 0 on success, -1 on failure.
+*/
+int MQTTAttachToEpoll(int epollFd);
 
 /**
-* @brief Stop MQTT subthread.
+* @brief Stop MQTT client and remove its timer from the epoll loop.
 */
-void MQTTKillSubthread();
+void MQTTDetachFromEpoll();
+
+/**
+* @brief Set the buffer sizes. Must be called before the first MQTTInit, otherwise 8192/512 bytes are used.
+*
+* A buffer found too small at runtime doubles, up to its max size. The send buffer grows as soon as
+* every queued message is acknowledged, the receive buffer on the next reconnect. Pass max == size
+* to disable growth.
+*
+* @return 0 on success, -1 if the sizes are invalid or the client was already started.
+*/
+int MQTTConfigureBuffers(size_t sendSize, size_t sendMaxSize, size_t recvSize, size_t recvMaxSize);
+
+/**
+* @brief Set the delay range between reconnect attempts. The delay doubles with every failed attempt,
+* from minMs up to maxMs, and a random part of it is dropped so devices do not retry in lockstep.
+* Defaults: 500 ms to 60 s.
+*
+* @return 0 on success, -1 if the range is invalid.
+*/
+int MQTTConfigureBackoff(uint32_t minMs, uint32_t maxMs);
+
+/**
+* @brief Read the MQTT client statistics.
+*/
+void MQTTGetStats(MQTTStats* out);
+
+/**
+* @brief Start connecting to the broker. Returns immediately: the name lookup and connect run in the
+* background, driven by the epoll loop, and the connection is re-established automatically with
+* backoff whenever it fails. Check MQTTIsActiveConnection before publishing.
+*
+* @return 0 if the connection was started (or is already up), -1 on invalid arguments.
+*/
+int MQTTInit(const char* addr, const char* port, const char* subTopic);
+
+/**
+* @brief Close the connection and stop reconnecting.
+*/
+void MQTTStop();
 
 /**
 * @brief Check wherhet there is active connection with MQTT broker.
@@ -23,7 +96,19 @@ void MQTTKillSubthread();
 bool MQTTIsActiveConnection();
 
 /**
-* @brief Queue message to be published on given topic.
+* @brief Set the QoS level and retain flag used for a message class.
+*
+* Defaults: telemetry QoS 0, control QoS 1, summary QoS 1 retained.
+*
+* @param messageClass Class to change.
+* @param qos 0, 1 or 2.
+* @param retain Ask the broker to keep the last message for new subscribers.
+* @return 0 on success, -1 if the class or QoS is invalid.
+*/
+int MQTTSetPublishPolicy(MQTTMessageClass messageClass, uint8_t qos, bool retain);
+
+/**
+* @brief Queue control message to be published on given topic.
 *
 * @param topic Topic string.
 * @param msg Message to be published.
@@ -31,6 +116,27 @@ bool MQTTIsActiveConnection();
 */
 int MQTTPublish(const char* topic, const char* msg);
 
+/**
+* @brief Queue binary payload to be published on given topic with the policy of its message class.
+*
+* @param topic Topic string.
+* @param data Payload, copied into the client's send buffer.
+* @param size Payload size in bytes.
+* @param messageClass Selects QoS and retain flag.
+* @return 0 on success, -1 on failute.
+*/
+int MQTTPublishBinary(const char* topic, const void* data, size_t size, MQTTMessageClass messageClass);
+
+/**
+* @brief Check whether a payload of the given size fits in the client's send buffer right now.
+* Lets a caller holding a backlog publish as fast as the buffer allows without overflowing it.
+*
+* @param topic Topic string.
+* @param size Payload size in bytes.
+* @return True if there is an active connection and room for the message.
+*/
+bool MQTTCanPublish(const char* topic, size_t size);
+
 /**
 * @brief Add function that will be called when MQTT client receives message from subscribed topic.
 *
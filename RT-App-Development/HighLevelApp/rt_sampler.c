@@ -0,0 +1,190 @@
+#include "rt_sampler.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include <applibs/application.h>
+#include <applibs/log.h>
+#include "epoll_timerfd_utilities.h"
+#include "sensor_clock.h"
+
+// Largest message the inter-core buffers carry, well above a frame of the real-time batch size
+#define RT_SAMPLER_MAX_MESSAGE_SIZE 1024
+
+static int sockFd = -1;
+static RtSamplerSampleHandler sampleHandler = NULL;
+static RtSamplerAdcHandler adcBlockHandler = NULL;
+static uint32_t clockPeriodNs = 0;
+
+// Sequence number of the last message, to count the ones the real-time core had to drop
+static bool hasSequence = false;
+static uint32_t lastSequence = 0;
+static uint32_t missedMessages = 0;
+
+/* helpers */
+static void SocketEventHandler(EventData* eventData);
+static EventData socketEventData = { .eventHandler = &SocketEventHandler };
+
+static uint64_t MonotonicNs(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/**
+* @brief Map the ticks of one frame to the monotonic clock and hand its samples to the handler.
+*/
+static void ProcessFrame(const uint8_t* frame, size_t frameSize, uint64_t receivedNs) {
+	TelemetryFrameHeader header;
+	if (TelemetryFrame_DecodeHeader(frame, frameSize, &header) != 0 || header.type != TELEMETRY_FRAME_SAMPLES
+		|| header.sampleCount == 0 || header.samplePeriodNs == 0) {
+		Log_Debug("ERROR: Dropped a malformed frame from the real-time core (%zu bytes)\n", frameSize);
+		return;
+	}
+
+	// One tick per sample period; a new period starts the mapping over
+	if (header.samplePeriodNs != clockPeriodNs) {
+		clockPeriodNs = header.samplePeriodNs;
+		SensorClock_Init((double)clockPeriodNs);
+	}
+
+	// The frame is sent as soon as its last sample is read
+	uint32_t lastTick = header.sequence + header.sampleCount - 1;
+	SensorClock_Sync(lastTick, receivedNs);
+
+	for (uint16_t i = 0; i < header.sampleCount; i++) {
+		TelemetrySample sample;
+		TelemetryFrame_DecodeSample(frame, i, &sample);
+		uint32_t tick = header.sequence + i;
+		sampleHandler(&header, &sample, tick, SensorClock_ToNs(tick));
+	}
+}
+
+/**
+* @brief Pass a block of ADC readings on.
+*/
+static void ProcessAdcBlock(const uint8_t* payload, size_t payloadSize) {
+	IntercoreAdcBlock block;
+	if (IntercoreMessage_DecodeAdcBlock(payload, payloadSize, &block) != 0) {
+		Log_Debug("ERROR: Dropped a malformed ADC block from the real-time core (%zu bytes)\n", payloadSize);
+		return;
+	}
+
+	if (adcBlockHandler != NULL)
+		adcBlockHandler(&block, payload);
+}
+
+/**
+* @brief Log a trace report: the stats of every trace point since the previous report and, with
+* ENABLE_SAMPLE_DEBUG, the newest events.
+*/
+static void ProcessTraceReport(const uint8_t* payload, size_t payloadSize) {
+	IntercoreTraceReport report;
+	if (IntercoreMessage_DecodeTraceReport(payload, payloadSize, &report) != 0 || report.clockHz == 0) {
+		Log_Debug("ERROR: Dropped a malformed trace report from the real-time core (%zu bytes)\n", payloadSize);
+		return;
+	}
+
+	for (uint16_t i = 0; i < report.pointCount; i++) {
+		IntercoreTraceStats stats;
+		IntercoreMessage_DecodeTraceStats(payload, i, &stats);
+		if (stats.count == 0)
+			continue;
+
+		const char* name = IntercoreMessage_TracePointName(stats.point);
+		uint32_t mean = stats.total / stats.count;
+		if (stats.kind == INTERCORE_TRACE_SPAN) {
+			Log_Debug("RT trace: %s x%u : min %llu ns, mean %llu ns, max %llu ns\n", name, stats.count,
+				(unsigned long long)stats.min * 1000000000ULL / report.clockHz,
+				(unsigned long long)mean * 1000000000ULL / report.clockHz,
+				(unsigned long long)stats.max * 1000000000ULL / report.clockHz);
+		}
+		else {
+			Log_Debug("RT trace: %s x%u : min %u, mean %u, max %u\n", name, stats.count, stats.min, mean, stats.max);
+		}
+	}
+
+#ifdef ENABLE_SAMPLE_DEBUG
+	for (uint16_t i = 0; i < report.eventCount; i++) {
+		IntercoreTraceEvent event;
+		IntercoreMessage_DecodeTraceEvent(payload, &report, i, &event);
+		Log_Debug("RT trace: #%u at %u : %s %u\n", report.firstEvent + i, event.timestamp,
+			IntercoreMessage_TracePointName(event.point), event.value);
+	}
+#endif
+}
+
+/**
+* @brief Check the sequence number of a message and pass its payload on.
+*/
+static void ProcessMessage(const uint8_t* message, size_t messageSize, uint64_t receivedNs) {
+	IntercoreMessageHeader header;
+	if (IntercoreMessage_DecodeHeader(message, messageSize, &header) != 0) {
+		Log_Debug("ERROR: Dropped a malformed message from the real-time core (%zu bytes)\n", messageSize);
+		return;
+	}
+
+	uint32_t missed = hasSequence ? IntercoreMessage_Missed(lastSequence, header.sequence) : 0;
+	if (missed > 0) {
+		missedMessages += missed;
+		Log_Debug("ERROR: Real-time core dropped %u messages (%u in total)\n", missed, missedMessages);
+	}
+	hasSequence = true;
+	lastSequence = header.sequence;
+
+	const uint8_t* payload = &message[INTERCORE_MESSAGE_HEADER_SIZE];
+	if (header.type == INTERCORE_MESSAGE_TELEMETRY)
+		ProcessFrame(payload, header.payloadSize, receivedNs);
+	else if (header.type == INTERCORE_MESSAGE_ADC_BLOCK)
+		ProcessAdcBlock(payload, header.payloadSize);
+	else if (header.type == INTERCORE_MESSAGE_TRACE)
+		ProcessTraceReport(payload, header.payloadSize);
+}
+
+/**
+* @brief Read every message that is waiting on the socket. The real-time core rings once per batch,
+* so one wakeup usually drains several.
+*/
+static void SocketEventHandler(EventData* eventData) {
+	static uint8_t message[RT_SAMPLER_MAX_MESSAGE_SIZE];
+
+	for (;;) {
+		ssize_t received = recv(sockFd, message, sizeof(message), MSG_DONTWAIT);
+		if (received < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				Log_Debug("ERROR: Unable to receive from the real-time core: %s (%d)\n", strerror(errno), errno);
+			return;
+		}
+
+		ProcessMessage(message, (size_t)received, MonotonicNs());
+	}
+}
+
+/* declarations */
+int RtSampler_Init(int epollFd, const char* componentId, RtSamplerSampleHandler handler, RtSamplerAdcHandler adcHandler) {
+	sampleHandler = handler;
+	adcBlockHandler = adcHandler;
+	clockPeriodNs = 0;
+	hasSequence = false;
+	missedMessages = 0;
+
+	sockFd = Application_Connect(componentId);
+	if (sockFd == -1) {
+		Log_Debug("ERROR: Unable to connect to the real-time sampler: %s (%d)\n", strerror(errno), errno);
+		return -1;
+	}
+
+	if (RegisterEventHandlerToEpoll(epollFd, sockFd, &socketEventData, EPOLLIN) != 0)
+		return -1;
+
+	Log_Debug("Receiving samples from the real-time core\n");
+	return 0;
+}
+
+void RtSampler_Close(void) {
+	CloseFdAndPrintError(sockFd, "rtSampler");
+	sockFd = -1;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include "intercore_message.h"
+#include "telemetry_frame.h"
+
+/*
+* Receives the sample frames of the real-time sampler (Dryer-RT) over the inter-core socket.
+*
+* The real-time core reads the LSM6DSO from a hardware timer and stamps each frame with the timer
+* tick of its first sample.  Ticks are mapped to the device monotonic clock with SensorClock, synced
+* with the time each frame arrives, so the sample times keep the timer's spacing and follow the
+* device clock.
+*/
+
+/**
+* @brief Called with every received sample, in order.
+*
+* @param format Header of the frame the sample came in: sample period and full scale.
+* @param sample Raw sample, gyroscope offset already removed by the real-time core.
+* @param tick Timer tick the sample was read at. Ticks the real-time core missed are skipped.
+* @param timestampNs Device monotonic time the sample was read at.
+*/
+typedef void (*RtSamplerSampleHandler)(const TelemetryFrameHeader* format, const TelemetrySample* sample,
+	uint32_t tick, uint64_t timestampNs);
+
+/**
+* @brief Called with every received block of decimated ADC readings.
+*
+* @param block Block header. Rows missing since the previous block show up as a gap in firstIndex.
+* @param payload Block payload, read the values with IntercoreMessage_AdcValue.
+*/
+typedef void (*RtSamplerAdcHandler)(const IntercoreAdcBlock* block, const uint8_t* payload);
+
+/**
+* @brief Connect to the real-time app and register the socket with the epoll instance.
+*
+* @param epollFd Epoll file descriptor.
+* @param componentId Component ID of the real-time app, listed in AllowedApplicationConnections.
+* @param handler Handler for the received samples.
+* @param adcHandler Handler for the ADC blocks, NULL to ignore them.
+* @return 0 on success, -1 on failure.
+*/
+int RtSampler_Init(int epollFd, const char* componentId, RtSamplerSampleHandler handler, RtSamplerAdcHandler adcHandler);
+
+/**
+* @brief Close the socket.
+*/
+void RtSampler_Close(void);
@@ -0,0 +1,267 @@
+#include "sensor_bus.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <applibs/log.h>
+
+// Register addresses are 8 bits, a write or a batch covers at most all of them
+#define SENSOR_BUS_REGISTERS 256
+
+// Fastest first, SensorBus_Open keeps the first one every device answers at
+static const uint32_t busSpeeds[] = { I2C_BUS_SPEED_FAST_PLUS, I2C_BUS_SPEED_FAST, I2C_BUS_SPEED_STANDARD };
+
+static SensorBusStats stats;
+
+// Writes queued by the open batch, for one device at a time: the last value written to each register
+// and whether it is queued
+static int batchDepth = 0;
+static int batchFd = -1;
+static I2C_DeviceAddress batchAddress = 0;
+static uint8_t queuedValue[SENSOR_BUS_REGISTERS];
+static bool queued[SENSOR_BUS_REGISTERS];
+static uint32_t queuedRegisters = 0;
+static uint32_t queuedWrites = 0; // SensorBus_Write calls since the last flush
+
+// A write transaction is the register address followed by the data, built here rather than on the stack
+static uint8_t writeBuffer[1 + SENSOR_BUS_REGISTERS];
+
+/* helpers */
+static uint64_t MonotonicNs(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static void AddLatency(SensorBusLatency* latency, uint64_t startNs, size_t bytes) {
+	uint64_t elapsed = MonotonicNs() - startNs;
+	uint32_t ns = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+
+	if (latency->count == 0 || ns < latency->minNs)
+		latency->minNs = ns;
+	if (ns > latency->maxNs)
+		latency->maxNs = ns;
+	latency->count++;
+	latency->bytes += (uint32_t)bytes;
+	latency->totalNs += ns;
+}
+
+static int WriteNow(int fd, I2C_DeviceAddress address, uint8_t reg, const uint8_t* data, uint16_t len) {
+	writeBuffer[0] = reg;
+	memcpy(&writeBuffer[1], data, len);
+
+	uint64_t startNs = MonotonicNs();
+	ssize_t written = I2CMaster_Write(fd, address, writeBuffer, (size_t)len + 1);
+	if (written < 0) {
+		Log_Debug("ERROR: SensorBus_Write: errno=%d (%s)\n", errno, strerror(errno));
+		return -1;
+	}
+	AddLatency(&stats.writes, startNs, (size_t)len + 1);
+	return 0;
+}
+
+static int ReadNow(int fd, I2C_DeviceAddress address, uint8_t reg, uint8_t* data, uint16_t len) {
+	uint64_t startNs = MonotonicNs();
+	ssize_t transferred = I2CMaster_WriteThenRead(fd, address, &reg, 1, data, len);
+	if (transferred < 0) {
+		Log_Debug("ERROR: SensorBus_Read: errno=%d (%s)\n", errno, strerror(errno));
+		return -1;
+	}
+	AddLatency(&stats.reads, startNs, (size_t)len + 1);
+	return 0;
+}
+
+/**
+* @brief Check that every device acknowledges a one byte read at the current speed.
+*/
+static bool DevicesAnswer(int fd, const I2C_DeviceAddress* devices, size_t deviceCount) {
+	for (size_t i = 0; i < deviceCount; i++) {
+		uint8_t value;
+		if (I2CMaster_Read(fd, devices[i], &value, 1) != 1)
+			return false;
+	}
+	return true;
+}
+
+/**
+* @brief Twice the time a transaction of the given size takes on the bus, plus a margin.
+*
+* Every byte is 9 bit times with its acknowledge, and a write-then-read adds a repeated start and a
+* second device address.
+*/
+static uint32_t TransferTimeoutMs(uint32_t bytes, uint32_t speedHz, uint32_t marginMs) {
+	uint64_t bits = ((uint64_t)bytes + 2) * 9;
+	uint32_t transferMs = (uint32_t)((bits * 1000 + speedHz - 1) / speedHz);
+	return 2 * transferMs + marginMs;
+}
+
+static void LogLatency(const char* kind, const SensorBusLatency* latency) {
+	if (latency->count == 0)
+		return;
+	Log_Debug("  %u %s, %u bytes, mean %u us, min %u us, max %u us\n", latency->count, kind, latency->bytes,
+		(unsigned)(latency->totalNs / latency->count / 1000), latency->minNs / 1000, latency->maxNs / 1000);
+}
+
+/* declarations */
+int SensorBus_Open(I2C_InterfaceId interfaceId, uint32_t maxSpeedHz, uint32_t maxTransferBytes,
+	uint32_t timeoutMarginMs, const I2C_DeviceAddress* devices, size_t deviceCount) {
+	int fd = I2CMaster_Open(interfaceId);
+	if (fd < 0) {
+		Log_Debug("ERROR: I2CMaster_Open: errno=%d (%s)\n", errno, strerror(errno));
+		return -1;
+	}
+
+	// The probes are single bytes, the margin covers them at any speed
+	if (I2CMaster_SetTimeout(fd, timeoutMarginMs) != 0) {
+		Log_Debug("ERROR: I2CMaster_SetTimeout: errno=%d (%s)\n", errno, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	uint32_t speedHz = 0;
+	for (size_t i = 0; i < sizeof(busSpeeds) / sizeof(busSpeeds[0]) && speedHz == 0; i++) {
+		// Skip the speeds a device can't take, and the ones the interface turns down
+		if (busSpeeds[i] > maxSpeedHz || I2CMaster_SetBusSpeed(fd, busSpeeds[i]) != 0)
+			continue;
+		if (DevicesAnswer(fd, devices, deviceCount))
+			speedHz = busSpeeds[i];
+	}
+
+	if (speedHz == 0) {
+		Log_Debug("WARNING: Not every sensor bus device answered, using standard mode\n");
+		if (I2CMaster_SetBusSpeed(fd, I2C_BUS_SPEED_STANDARD) != 0) {
+			Log_Debug("ERROR: I2CMaster_SetBusSpeed: errno=%d (%s)\n", errno, strerror(errno));
+			close(fd);
+			return -1;
+		}
+		speedHz = I2C_BUS_SPEED_STANDARD;
+	}
+
+	uint32_t timeoutMs = TransferTimeoutMs(maxTransferBytes, speedHz, timeoutMarginMs);
+	if (I2CMaster_SetTimeout(fd, timeoutMs) != 0) {
+		Log_Debug("ERROR: I2CMaster_SetTimeout: errno=%d (%s)\n", errno, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	Log_Debug("Sensor bus at %u kHz, %u ms timeout\n", speedHz / 1000, timeoutMs);
+
+	memset(&stats, 0, sizeof(stats));
+	stats.speedHz = speedHz;
+	stats.timeoutMs = timeoutMs;
+	return fd;
+}
+
+int SensorBus_Write(int fd, I2C_DeviceAddress address, uint8_t reg, const uint8_t* data, uint16_t len) {
+	if (len > SENSOR_BUS_REGISTERS) {
+		Log_Debug("ERROR: SensorBus_Write: %u bytes is more than the device has registers\n", len);
+		return -1;
+	}
+
+	// Outside a batch, and for writes that wrap around the register addresses, anything queued goes
+	// first so the device sees the writes in order
+	if (batchDepth == 0 || (uint32_t)reg + len > SENSOR_BUS_REGISTERS) {
+		if (SensorBus_Flush() != 0)
+			return -1;
+		return WriteNow(fd, address, reg, data, len);
+	}
+
+	// The queue holds one device, a write to another one sends what is queued for the first
+	if (queuedRegisters > 0 && (fd != batchFd || address != batchAddress) && SensorBus_Flush() != 0)
+		return -1;
+	batchFd = fd;
+	batchAddress = address;
+
+	for (uint16_t i = 0; i < len; i++) {
+		if (!queued[reg + i]) {
+			queued[reg + i] = true;
+			queuedRegisters++;
+		}
+		queuedValue[reg + i] = data[i];
+	}
+	queuedWrites++;
+	return 0;
+}
+
+int SensorBus_Read(int fd, I2C_DeviceAddress address, uint8_t reg, uint8_t* data, uint16_t len) {
+	if (queuedRegisters > 0 && fd == batchFd && address == batchAddress && (uint32_t)reg + len <= SENSOR_BUS_REGISTERS) {
+		uint16_t covered = 0;
+		for (uint16_t i = 0; i < len; i++) {
+			if (queued[reg + i])
+				covered++;
+		}
+
+		// All of it queued: the device will hold exactly these values once the batch is written
+		if (covered == len) {
+			memcpy(data, &queuedValue[reg], len);
+			return 0;
+		}
+		// Part of it: the device has to be up to date before the rest is read
+		if (covered > 0 && SensorBus_Flush() != 0)
+			return -1;
+	}
+	return ReadNow(fd, address, reg, data, len);
+}
+
+void SensorBus_BeginBatch(void) {
+	batchDepth++;
+}
+
+int SensorBus_EndBatch(void) {
+	if (batchDepth == 0)
+		return 0;
+	if (--batchDepth > 0)
+		return 0;
+	return SensorBus_Flush();
+}
+
+int SensorBus_Flush(void) {
+	int result = 0;
+	uint32_t transactions = 0;
+
+	// One transaction per run of adjacent queued registers, the device auto-increments the address
+	for (uint32_t reg = 0; reg < SENSOR_BUS_REGISTERS && queuedRegisters > 0;) {
+		if (!queued[reg]) {
+			reg++;
+			continue;
+		}
+
+		uint32_t end = reg;
+		while (end < SENSOR_BUS_REGISTERS && queued[end]) {
+			queued[end] = false;
+			end++;
+		}
+		queuedRegisters -= end - reg;
+
+		if (WriteNow(batchFd, batchAddress, (uint8_t)reg, &queuedValue[reg], (uint16_t)(end - reg)) != 0)
+			result = -1;
+		transactions++;
+		reg = end;
+	}
+
+	if (queuedWrites > transactions)
+		stats.combinedWrites += queuedWrites - transactions;
+	queuedWrites = 0;
+	return result;
+}
+
+void SensorBus_GetStats(SensorBusStats* out) {
+	*out = stats;
+}
+
+void SensorBus_ResetStats(void) {
+	uint32_t speedHz = stats.speedHz;
+	uint32_t timeoutMs = stats.timeoutMs;
+	memset(&stats, 0, sizeof(stats));
+	stats.speedHz = speedHz;
+	stats.timeoutMs = timeoutMs;
+}
+
+void SensorBus_LogStats(const char* label) {
+	Log_Debug("Sensor bus %s at %u kHz, %u register writes combined into other transactions:\n", label,
+		stats.speedHz / 1000, stats.combinedWrites);
+	LogLatency("writes", &stats.writes);
+	LogLatency("reads", &stats.reads);
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <applibs/i2c.h>
+
+/*
+* Register access to the devices on an I2C master interface.
+*
+* The bus runs at the fastest speed every listed device answers at, and the transfer timeout follows
+* from the largest transaction at that speed.  Each transfer is timed on the monotonic clock, the
+* statistics show the per-transaction latency reached at that speed.
+*
+* Between SensorBus_BeginBatch and SensorBus_EndBatch register writes are queued and combined: writes
+* to adjacent registers of the same device go out as one auto-increment transaction when the batch
+* ends, in register order, and a register written twice only reaches the device with its last value.
+* Reads of queued registers return the queued value without a transfer, so read-modify-write
+* sequences need no round trip for the read once the register is queued.  Other reads go to the
+* device straight away, before the queued writes, so batches are for configuration registers only:
+* anything that must take effect before the next read (reset, bank switches, enabling a counter that
+* is read back) needs SensorBus_Flush or a write outside the batch.
+*/
+
+/**
+* @brief Latency of one kind of transaction.
+*/
+typedef struct {
+	uint32_t count;    // transactions
+	uint32_t bytes;    // bytes moved, register addresses included
+	uint64_t totalNs;  // sum of the transaction times, for the mean
+	uint32_t minNs;
+	uint32_t maxNs;
+} SensorBusLatency;
+
+typedef struct {
+	uint32_t speedHz;          // bus speed chosen by SensorBus_Open
+	uint32_t timeoutMs;        // transfer timeout at that speed
+	uint32_t combinedWrites;   // queued register writes that went out as part of another transaction
+	SensorBusLatency writes;
+	SensorBusLatency reads;
+} SensorBusStats;
+
+/**
+* @brief Open the interface and pick its bus speed.
+*
+* Tries fast-mode plus (1 MHz), fast mode (400 kHz) and standard mode (100 kHz), from the fastest not
+* above maxSpeedHz down, and keeps the first one every device answers a one byte read at.  When none
+* of them answers the bus is left at standard mode, so the caller can report the missing device.
+* The transfer timeout is then twice the time maxTransferBytes take at the chosen speed, plus
+* timeoutMarginMs.
+*
+* @param interfaceId I2C master interface, listed in app_manifest.json.
+* @param maxSpeedHz Fastest speed every device on the bus supports, probed or not.
+* @param maxTransferBytes Largest transaction, register address included.
+* @param timeoutMarginMs Added to the transfer time of the largest transaction, also the timeout
+* of the probes.
+* @param devices Addresses of the devices that must answer.
+* @param deviceCount Number of addresses.
+* @return The file descriptor of the interface, or -1 on failure.
+*/
+int SensorBus_Open(I2C_InterfaceId interfaceId, uint32_t maxSpeedHz, uint32_t maxTransferBytes,
+	uint32_t timeoutMarginMs, const I2C_DeviceAddress* devices, size_t deviceCount);
+
+/**
+* @brief Write consecutive registers, starting at reg. Queued when a batch is open.
+*
+* @return 0 on success, -1 on failure.
+*/
+int SensorBus_Write(int fd, I2C_DeviceAddress address, uint8_t reg, const uint8_t* data, uint16_t len);
+
+/**
+* @brief Read consecutive registers, starting at reg, in one combined write-then-read transaction.
+*
+* @return 0 on success, -1 on failure.
+*/
+int SensorBus_Read(int fd, I2C_DeviceAddress address, uint8_t reg, uint8_t* data, uint16_t len);
+
+/**
+* @brief Start queueing register writes. Batches nest, the writes go out when the outermost one ends.
+*/
+void SensorBus_BeginBatch(void);
+
+/**
+* @brief End a batch and, for the outermost one, write everything queued.
+*
+* @return 0 on success, -1 if a queued write failed.
+*/
+int SensorBus_EndBatch(void);
+
+/**
+* @brief Write everything queued so far, the batch stays open.
+*
+* @return 0 on success, -1 if a queued write failed.
+*/
+int SensorBus_Flush(void);
+
+/**
+* @brief Read the statistics since SensorBus_Open or the last SensorBus_ResetStats.
+*/
+void SensorBus_GetStats(SensorBusStats* out);
+
+/**
+* @brief Clear the transaction counters and latencies, the bus speed and timeout are kept.
+*/
+void SensorBus_ResetStats(void);
+
+/**
+* @brief Log the statistics, the label says what the transactions were for.
+*/
+void SensorBus_LogStats(const char* label);
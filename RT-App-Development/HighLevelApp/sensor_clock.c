@@ -0,0 +1,108 @@
+#include "sensor_clock.h"
+
+// Fraction of the offset error removed at every sync point, smooths out I2C read latency
+#define OFFSET_GAIN 0.25
+// Weight of a new period measurement, and the shortest span it is measured over (~1 s)
+#define PERIOD_GAIN 0.5
+#define PERIOD_MIN_SPAN_NS 1000000000ULL
+// The LSM6DSO oscillator is within a few percent; anything beyond is a bad sync point
+#define PERIOD_MAX_DEVIATION 0.05
+// Offset error beyond which the clock is re-anchored instead of slewed (sensor reset, long suspend)
+#define RESYNC_ERROR_NS 50000000LL
+
+static double nominalTickNs = 25000.0;
+static double tickNs = 25000.0;
+static int synced = 0;
+
+// Highest counter value seen, extended to 64 bits
+static uint64_t referenceTicks = 0;
+
+// ns = anchorNs + (ticks - anchorTicks) * tickNs
+static uint64_t anchorTicks = 0;
+static double anchorNs = 0.0;
+
+// Start of the current period measurement
+static uint64_t spanTicks = 0;
+static uint64_t spanNs = 0;
+
+static uint64_t lastOutputNs = 0;
+
+/* helpers */
+/**
+* @brief Extend a 32-bit counter value to 64 bits. Values up to 2^31 ticks behind the newest one
+* seen are placed before it, so FIFO timestamps older than a sync point still convert correctly.
+*/
+static uint64_t extend(uint32_t rawTicks) {
+	uint64_t ticks = referenceTicks + (uint64_t)(int64_t)(int32_t)(rawTicks - (uint32_t)referenceTicks);
+	if ((int64_t)(ticks - referenceTicks) > 0)
+		referenceTicks = ticks;
+	return ticks;
+}
+
+static double toNs(uint64_t ticks) {
+	return anchorNs + (double)(int64_t)(ticks - anchorTicks) * tickNs;
+}
+
+static void anchor(uint64_t ticks, uint64_t monotonicNs) {
+	anchorTicks = ticks;
+	anchorNs = (double)monotonicNs;
+	spanTicks = ticks;
+	spanNs = monotonicNs;
+}
+
+/* declarations */
+void SensorClock_Init(double nominal) {
+	nominalTickNs = nominal;
+	tickNs = nominal;
+	synced = 0;
+	referenceTicks = 0;
+	lastOutputNs = 0;
+}
+
+void SensorClock_Sync(uint32_t rawTicks, uint64_t monotonicNs) {
+	if (!synced) {
+		referenceTicks = rawTicks;
+		anchor(rawTicks, monotonicNs);
+		synced = 1;
+		return;
+	}
+
+	uint64_t ticks = extend(rawTicks);
+	double error = (double)monotonicNs - toNs(ticks);
+	if (error > RESYNC_ERROR_NS || error < -RESYNC_ERROR_NS) {
+		anchor(ticks, monotonicNs);
+		return;
+	}
+
+	// Slew the offset; moving the anchor to this sync point keeps the period estimate local
+	anchorNs = toNs(ticks) + OFFSET_GAIN * error;
+	anchorTicks = ticks;
+
+	if (monotonicNs - spanNs >= PERIOD_MIN_SPAN_NS && ticks > spanTicks) {
+		double measured = (double)(monotonicNs - spanNs) / (double)(ticks - spanTicks);
+		double deviation = measured / nominalTickNs - 1.0;
+		if (deviation < PERIOD_MAX_DEVIATION && deviation > -PERIOD_MAX_DEVIATION)
+			tickNs += PERIOD_GAIN * (measured - tickNs);
+		spanTicks = ticks;
+		spanNs = monotonicNs;
+	}
+}
+
+int SensorClock_IsSynced(void) {
+	return synced;
+}
+
+uint64_t SensorClock_ToNs(uint32_t rawTicks) {
+	double ns = toNs(extend(rawTicks));
+	uint64_t result = ns > 0.0 ? (uint64_t)ns : 0;
+
+	// Slewing can move the mapping back slightly, never let a later sample come out earlier
+	if (result < lastOutputNs)
+		result = lastOutputNs;
+	lastOutputNs = result;
+	return result;
+}
+
+double SensorClock_TickNs(void) {
+	return tickNs;
+}
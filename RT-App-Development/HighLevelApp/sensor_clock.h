@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+* Maps the LSM6DSO 32-bit timestamp counter to the device monotonic clock.
+*
+* The counter is extended to 64 bits across wrap-arounds (every ~30 h at 25 us per tick).  Ticks are
+* converted with a tick period and offset that follow the monotonic clock: each sync point, a counter
+* value read together with the monotonic time, slews the offset and refines the period.  The sensor
+* oscillator may be off by a few percent, so converted sample times drift with the device clock
+* instead of with the sensor.  No applibs headers.
+*/
+
+/**
+* @brief Start over with a nominal tick period. The first sync point anchors the clock.
+*
+* @param tickNs Nominal tick period in ns, 25000 adjusted by INTERNAL_FREQ_FINE.
+*/
+void SensorClock_Init(double tickNs);
+
+/**
+* @brief Add a sync point.
+*
+* @param rawTicks Value of the TIMESTAMP registers.
+* @param monotonicNs Device monotonic time the registers were read at.
+*/
+void SensorClock_Sync(uint32_t rawTicks, uint64_t monotonicNs);
+
+/**
+* @brief Check whether a sync point has been added since SensorClock_Init.
+*/
+int SensorClock_IsSynced(void);
+
+/**
+* @brief Convert a counter value to device monotonic ns. Successive results never decrease.
+*/
+uint64_t SensorClock_ToNs(uint32_t rawTicks);
+
+/**
+* @brief Current estimate of the tick period in ns.
+*/
+double SensorClock_TickNs(void);
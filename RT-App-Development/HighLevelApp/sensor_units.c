@@ -0,0 +1,73 @@
+#include "sensor_units.h"
+
+// LSM6DSO datasheet sensitivities, in the order of increasing full scale
+static const uint16_t accelFullScales[] = { 2, 4, 8, 16 };
+static const int32_t accelUgPerLsb[] = { 61, 122, 244, 488 };
+
+// 4.375 mdps/LSB * 256 = 1120, exact for every step
+static const uint16_t gyroFullScales[] = { 125, 250, 500, 1000, 2000 };
+static const int32_t gyroMdpsPerLsbQ8[] = { 1120, 2240, 4480, 8960, 17920 };
+
+/* helpers */
+static int lookup(const uint16_t* fullScales, size_t count, uint16_t fullScale) {
+	for (size_t i = 0; i < count; i++) {
+		if (fullScales[i] == fullScale)
+			return (int)i;
+	}
+	return -1;
+}
+
+/* declarations */
+int SensorUnits_GetScale(uint16_t accelFullScaleG, uint16_t gyroFullScaleDps, SensorScale* scale) {
+	int accel = lookup(accelFullScales, sizeof(accelFullScales) / sizeof(accelFullScales[0]), accelFullScaleG);
+	int gyro = lookup(gyroFullScales, sizeof(gyroFullScales) / sizeof(gyroFullScales[0]), gyroFullScaleDps);
+	if (accel < 0 || gyro < 0)
+		return -1;
+
+	scale->accelUgPerLsb = accelUgPerLsb[accel];
+	scale->gyroMdpsPerLsbQ8 = gyroMdpsPerLsbQ8[gyro];
+	return 0;
+}
+
+int32_t SensorUnits_AccelToUg(const SensorScale* scale, int16_t raw) {
+	// At most 32768 * 488, well inside 32 bits
+	return (int32_t)raw * scale->accelUgPerLsb;
+}
+
+int32_t SensorUnits_GyroToMdps(const SensorScale* scale, int16_t raw) {
+	// At most 32768 * 17920 before the shift
+	return ((int32_t)raw * scale->gyroMdpsPerLsbQ8) >> 8;
+}
+
+void SensorUnits_Convert(const SensorScale* scale, const int16_t rawAcceleration[3], const int16_t rawAngularRate[3],
+	SensorValues* out) {
+	for (int axis = 0; axis < 3; axis++) {
+		out->accelerationUg[axis] = (int32_t)rawAcceleration[axis] * scale->accelUgPerLsb;
+		out->angularRateMdps[axis] = ((int32_t)rawAngularRate[axis] * scale->gyroMdpsPerLsbQ8) >> 8;
+	}
+}
+
+size_t SensorUnits_FormatMilli(int32_t milli, char* buf) {
+	char digits[11];
+	size_t length = 0;
+	size_t count = 0;
+
+	// Work on the magnitude as unsigned so INT32_MIN does not overflow
+	uint32_t magnitude = milli < 0 ? 0u - (uint32_t)milli : (uint32_t)milli;
+	if (milli < 0)
+		buf[length++] = '-';
+
+	do {
+		digits[count++] = (char)('0' + magnitude % 10);
+		magnitude /= 10;
+	} while (magnitude != 0 || count < 4);
+
+	while (count > 0) {
+		if (count == 3)
+			buf[length++] = '.';
+		buf[length++] = digits[--count];
+	}
+
+	buf[length] = '\0';
+	return length;
+}
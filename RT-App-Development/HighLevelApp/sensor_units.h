@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+* Fixed-point conversion of raw LSM6DSO values to engineering units.  The sensitivities of every full
+* scale setting are exact in integers (61 ug/LSB at 2 g, 4.375 mdps/LSB at 125 dps, doubling with each
+* step), so a conversion is one integer multiply, plus a shift for the gyroscope.  No floats and no
+* applibs headers, for the device and the host consumers alike.
+*/
+
+/**
+* @brief Sensitivity for one full scale setting, resolved once with SensorUnits_GetScale.
+*/
+typedef struct {
+	int32_t accelUgPerLsb;     // accelerometer, ug per LSB
+	int32_t gyroMdpsPerLsbQ8;  // gyroscope, 1/256 mdps per LSB
+} SensorScale;
+
+/**
+* @brief One sample in engineering units.
+*/
+typedef struct {
+	int32_t accelerationUg[3];   // X, Y, Z in ug
+	int32_t angularRateMdps[3];  // X, Y, Z in mdps, rounded towards minus infinity
+} SensorValues;
+
+/**
+* @brief Look up the sensitivities for a full scale setting.
+*
+* @param accelFullScaleG 2, 4, 8 or 16.
+* @param gyroFullScaleDps 125, 250, 500, 1000 or 2000.
+* @return 0 on success, -1 if either full scale is not supported.
+*/
+int SensorUnits_GetScale(uint16_t accelFullScaleG, uint16_t gyroFullScaleDps, SensorScale* scale);
+
+/**
+* @brief Convert a raw accelerometer value to ug.
+*/
+int32_t SensorUnits_AccelToUg(const SensorScale* scale, int16_t raw);
+
+/**
+* @brief Convert a raw gyroscope value to mdps.
+*/
+int32_t SensorUnits_GyroToMdps(const SensorScale* scale, int16_t raw);
+
+/**
+* @brief Convert the three accelerometer and three gyroscope axes of a sample.
+*/
+void SensorUnits_Convert(const SensorScale* scale, const int16_t rawAcceleration[3], const int16_t rawAngularRate[3],
+	SensorValues* out);
+
+/**
+* @brief Format a value given in thousandths with three decimals, e.g. 12345 as "12.345", without printf.
+*
+* @param buf Output, at least 13 bytes. NUL terminated.
+* @return Number of characters written, not counting the NUL.
+*/
+size_t SensorUnits_FormatMilli(int32_t milli, char* buf);
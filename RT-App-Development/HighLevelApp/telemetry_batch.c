@@ -0,0 +1,122 @@
+#include "telemetry_batch.h"
+
+#include <applibs/log.h>
+#include "epoll_timerfd_utilities.h"
+
+static uint8_t frameBuffer[TELEMETRY_FRAME_SIZE(TELEMETRY_BATCH_MAX_SAMPLES)];
+static TelemetryFrameHeader header = { .type = TELEMETRY_FRAME_SAMPLES };
+
+// Period set with TelemetryBatch_SetFormat; frames of two or more samples report the measured one
+static uint32_t nominalPeriodNs = 0;
+static uint64_t lastTimestampNs = 0;
+
+static uint16_t maxSamples = 1;
+static struct timespec maxLatency = { 0, 0 };
+
+static int latencyTimerFd = -1;
+static TelemetryBatchFlushHandler flushHandler = NULL;
+
+/* helpers */
+static void LatencyTimerEventHandler(EventData* eventData);
+static EventData latencyTimerEventData = { .eventHandler = &LatencyTimerEventHandler };
+
+/**
+* @brief Publish a partially filled frame once its oldest sample has waited maxLatency.
+*/
+static void LatencyTimerEventHandler(EventData* eventData) {
+	if (ConsumeTimerFdEvent(latencyTimerFd) != 0)
+		return;
+
+	TelemetryBatch_Flush();
+}
+
+/* declarations */
+int TelemetryBatch_Init(int epollFd, uint16_t batchSamples, uint32_t maxLatencyMs, TelemetryBatchFlushHandler flush) {
+	flushHandler = flush;
+
+	// Created disarmed, armed by the first sample of each frame
+	struct timespec disarmed = { 0, 0 };
+	latencyTimerFd = CreateTimerFdAndAddToEpoll(epollFd, &disarmed, &latencyTimerEventData, EPOLLIN);
+	if (latencyTimerFd < 0)
+		return -1;
+
+	return TelemetryBatch_Configure(batchSamples, maxLatencyMs);
+}
+
+int TelemetryBatch_Configure(uint16_t batchSamples, uint32_t maxLatencyMs) {
+	if (batchSamples < 1 || batchSamples > TELEMETRY_BATCH_MAX_SAMPLES || maxLatencyMs < 1) {
+		Log_Debug("ERROR: Invalid telemetry batch configuration (%u samples, %u ms)\n", batchSamples, maxLatencyMs);
+		return -1;
+	}
+
+	TelemetryBatch_Flush();
+
+	maxSamples = batchSamples;
+	maxLatency.tv_sec = maxLatencyMs / 1000;
+	maxLatency.tv_nsec = (long)(maxLatencyMs % 1000) * 1000000;
+
+	Log_Debug("Telemetry batch set to %u samples, %u ms max latency\n", batchSamples, maxLatencyMs);
+	return 0;
+}
+
+void TelemetryBatch_GetConfig(uint16_t* batchSamples, uint32_t* maxLatencyMs) {
+	*batchSamples = maxSamples;
+	*maxLatencyMs = (uint32_t)maxLatency.tv_sec * 1000 + (uint32_t)(maxLatency.tv_nsec / 1000000);
+}
+
+void TelemetryBatch_SetFormat(uint32_t samplePeriodNs, uint16_t accelFullScaleG, uint16_t gyroFullScaleDps) {
+	if (nominalPeriodNs == samplePeriodNs && header.accelFullScaleG == accelFullScaleG
+		&& header.gyroFullScaleDps == gyroFullScaleDps)
+		return;
+
+	TelemetryBatch_Flush();
+
+	nominalPeriodNs = samplePeriodNs;
+	header.accelFullScaleG = accelFullScaleG;
+	header.gyroFullScaleDps = gyroFullScaleDps;
+}
+
+void TelemetryBatch_AddSample(const TelemetrySample* sample, uint32_t sequence, uint64_t timestampNs) {
+	if (header.sampleCount == 0) {
+		header.sequence = sequence;
+		header.timestampNs = timestampNs;
+		if (maxSamples > 1)
+			SetTimerFdToSingleExpiry(latencyTimerFd, &maxLatency);
+	}
+
+	TelemetryFrame_EncodeSample(frameBuffer, sizeof(frameBuffer), header.sampleCount, sample);
+	header.sampleCount++;
+	lastTimestampNs = timestampNs;
+
+	if (header.sampleCount >= maxSamples)
+		TelemetryBatch_Flush();
+}
+
+void TelemetryBatch_Flush(void) {
+	if (header.sampleCount == 0)
+		return;
+
+	// The mean spacing of the sample times follows the real ODR, which is a few percent off nominal
+	header.samplePeriodNs = nominalPeriodNs;
+	if (header.sampleCount > 1 && lastTimestampNs > header.timestampNs)
+		header.samplePeriodNs = (uint32_t)((lastTimestampNs - header.timestampNs) / (header.sampleCount - 1u));
+
+	// Samples are already in place, only the header is written at flush time
+	TelemetryFrame_EncodeHeader(frameBuffer, sizeof(frameBuffer), &header);
+	size_t frameSize = TELEMETRY_FRAME_SIZE((size_t)header.sampleCount);
+	header.sampleCount = 0;
+
+	if (maxSamples > 1) {
+		struct timespec disarmed = { 0, 0 };
+		SetTimerFdToSingleExpiry(latencyTimerFd, &disarmed);
+	}
+
+	if (flushHandler != NULL)
+		flushHandler(frameBuffer, frameSize);
+}
+
+void TelemetryBatch_Close(void) {
+	TelemetryBatch_Flush();
+	CloseFdAndPrintError(latencyTimerFd, "telemetryBatchTimer");
+	latencyTimerFd = -1;
+}
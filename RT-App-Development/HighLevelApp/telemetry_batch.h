@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "telemetry_frame.h"
+
+// Largest batch that can be configured at runtime.  Sizes the static frame buffer.
+#define TELEMETRY_BATCH_MAX_SAMPLES 64
+
+/**
+* @brief Called with every completed frame. The frame buffer is reused once the handler returns.
+*/
+typedef void (*TelemetryBatchFlushHandler)(const uint8_t* frame, size_t frameSize);
+
+/**
+* @brief Create the latency timer and register it with the epoll instance.
+*
+* @param epollFd Epoll file descriptor.
+* @param batchSamples Number of samples per frame, 1 to TELEMETRY_BATCH_MAX_SAMPLES.
+* @param maxLatencyMs Longest time a sample may wait for its frame to fill up, in ms.
+* @param flush Handler that publishes the completed frames.
+* @return 0 on success, -1 on failure.
+*/
+int TelemetryBatch_Init(int epollFd, uint16_t batchSamples, uint32_t maxLatencyMs, TelemetryBatchFlushHandler flush);
+
+/**
+* @brief Change the batch size and maximum latency. Any pending samples are flushed first.
+*
+* @return 0 on success, -1 if the values are out of range.
+*/
+int TelemetryBatch_Configure(uint16_t batchSamples, uint32_t maxLatencyMs);
+
+/**
+* @brief Read back the current batch size and maximum latency.
+*/
+void TelemetryBatch_GetConfig(uint16_t* batchSamples, uint32_t* maxLatencyMs);
+
+/**
+* @brief Set the sample period and full scale written in the header of the following frames.
+* Pending samples are flushed first so one frame never mixes two formats. Frames of two or more
+* samples carry the mean spacing of their sample timestamps instead of the nominal period.
+*/
+void TelemetryBatch_SetFormat(uint32_t samplePeriodNs, uint16_t accelFullScaleG, uint16_t gyroFullScaleDps);
+
+/**
+* @brief Append a sample to the current frame, flushing it when it is full.
+*
+* @param sample Raw sample.
+* @param sequence Sequence number of the sample.
+* @param timestampNs Device monotonic time the sensor took the sample.
+*/
+void TelemetryBatch_AddSample(const TelemetrySample* sample, uint32_t sequence, uint64_t timestampNs);
+
+/**
+* @brief Publish the pending samples now, even if the frame is not full.
+*/
+void TelemetryBatch_Flush(void);
+
+/**
+* @brief Flush pending samples and close the latency timer.
+*/
+void TelemetryBatch_Close(void);
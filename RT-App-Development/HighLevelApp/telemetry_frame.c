@@ -0,0 +1,211 @@
+#include "telemetry_frame.h"
+
+#include <string.h>
+
+/* helpers */
+static void put_u16(uint8_t* p, uint16_t v) {
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t* p, uint32_t v) {
+	put_u16(p, (uint16_t)v);
+	put_u16(p + 2, (uint16_t)(v >> 16));
+}
+
+static void put_u64(uint8_t* p, uint64_t v) {
+	put_u32(p, (uint32_t)v);
+	put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static void put_f32(uint8_t* p, float v) {
+	uint32_t bits;
+	memcpy(&bits, &v, sizeof(bits));
+	put_u32(p, bits);
+}
+
+static uint16_t get_u16(const uint8_t* p) {
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+	return (uint32_t)get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+static uint64_t get_u64(const uint8_t* p) {
+	return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+static float get_f32(const uint8_t* p) {
+	uint32_t bits = get_u32(p);
+	float v;
+	memcpy(&v, &bits, sizeof(v));
+	return v;
+}
+
+/**
+* @brief Round to a fixed point value in 1/10000 units, saturating to the int16 range.
+*/
+static int16_t to_e4(float v) {
+	float scaled = v * 10000.0f;
+	if (scaled >= 32767.0f)
+		return 32767;
+	if (scaled <= -32768.0f)
+		return -32768;
+	return (int16_t)(scaled < 0 ? scaled - 0.5f : scaled + 0.5f);
+}
+
+/* declarations */
+size_t TelemetryFrame_EncodeHeader(uint8_t* buf, size_t bufSize, const TelemetryFrameHeader* header) {
+	if (bufSize < TELEMETRY_FRAME_HEADER_SIZE)
+		return 0;
+
+	buf[0] = TELEMETRY_FRAME_VERSION;
+	buf[1] = header->type;
+	put_u16(&buf[2], header->sampleCount);
+	put_u32(&buf[4], header->sequence);
+	put_u64(&buf[8], header->timestampNs);
+	put_u32(&buf[16], header->samplePeriodNs);
+	put_u16(&buf[20], header->accelFullScaleG);
+	put_u16(&buf[22], header->gyroFullScaleDps);
+
+	return TELEMETRY_FRAME_HEADER_SIZE;
+}
+
+size_t TelemetryFrame_EncodeSample(uint8_t* buf, size_t bufSize, size_t index, const TelemetrySample* sample) {
+	if (bufSize < TELEMETRY_FRAME_SIZE(index + 1))
+		return 0;
+
+	uint8_t* p = &buf[TELEMETRY_FRAME_SIZE(index)];
+	for (int axis = 0; axis < 3; axis++) {
+		put_u16(&p[2 * axis], (uint16_t)sample->acceleration[axis]);
+		put_u16(&p[6 + 2 * axis], (uint16_t)sample->angularRate[axis]);
+	}
+
+	return TELEMETRY_FRAME_SAMPLE_SIZE;
+}
+
+size_t TelemetryFrame_Encode(uint8_t* buf, size_t bufSize, const TelemetryFrameHeader* header, const TelemetrySample* samples) {
+	if (bufSize < TELEMETRY_FRAME_SIZE(header->sampleCount))
+		return 0;
+
+	TelemetryFrame_EncodeHeader(buf, bufSize, header);
+	for (size_t i = 0; i < header->sampleCount; i++) {
+		TelemetryFrame_EncodeSample(buf, bufSize, i, &samples[i]);
+	}
+
+	return TELEMETRY_FRAME_SIZE(header->sampleCount);
+}
+
+int TelemetryFrame_DecodeHeader(const uint8_t* buf, size_t len, TelemetryFrameHeader* header) {
+	if (len < TELEMETRY_FRAME_HEADER_SIZE || buf[0] != TELEMETRY_FRAME_VERSION)
+		return -1;
+
+	header->version = buf[0];
+	header->type = buf[1];
+	header->sampleCount = get_u16(&buf[2]);
+	header->sequence = get_u32(&buf[4]);
+	header->timestampNs = get_u64(&buf[8]);
+	header->samplePeriodNs = get_u32(&buf[16]);
+	header->accelFullScaleG = get_u16(&buf[20]);
+	header->gyroFullScaleDps = get_u16(&buf[22]);
+
+	if (len < TELEMETRY_FRAME_SIZE((size_t)header->sampleCount))
+		return -1;
+
+	return 0;
+}
+
+void TelemetryFrame_DecodeSample(const uint8_t* buf, size_t index, TelemetrySample* sample) {
+	const uint8_t* p = &buf[TELEMETRY_FRAME_SIZE(index)];
+	for (int axis = 0; axis < 3; axis++) {
+		sample->acceleration[axis] = (int16_t)get_u16(&p[2 * axis]);
+		sample->angularRate[axis] = (int16_t)get_u16(&p[6 + 2 * axis]);
+	}
+}
+
+size_t TelemetryFrame_EncodeDryness(uint8_t* buf, size_t bufSize, const TelemetryFrameHeader* header, const TelemetryDryness* dryness) {
+	if (bufSize < TELEMETRY_FRAME_DRYNESS_SIZE)
+		return 0;
+
+	TelemetryFrameHeader dryHeader = *header;
+	dryHeader.type = TELEMETRY_FRAME_DRYNESS;
+	dryHeader.sampleCount = 0;
+	TelemetryFrame_EncodeHeader(buf, bufSize, &dryHeader);
+
+	uint8_t* p = &buf[TELEMETRY_FRAME_HEADER_SIZE];
+	put_u16(&p[0], (uint16_t)to_e4(dryness->dryness));
+	put_u16(&p[2], (uint16_t)to_e4(dryness->confidence));
+	put_u32(&p[4], dryness->samples);
+
+	return TELEMETRY_FRAME_DRYNESS_SIZE;
+}
+
+int TelemetryFrame_DecodeDryness(const uint8_t* buf, size_t len, TelemetryDryness* dryness) {
+	if (len < TELEMETRY_FRAME_DRYNESS_SIZE || buf[1] != TELEMETRY_FRAME_DRYNESS)
+		return -1;
+
+	const uint8_t* p = &buf[TELEMETRY_FRAME_HEADER_SIZE];
+	dryness->dryness = (float)(int16_t)get_u16(&p[0]) / 10000.0f;
+	dryness->confidence = (float)(int16_t)get_u16(&p[2]) / 10000.0f;
+	dryness->samples = get_u32(&p[4]);
+	return 0;
+}
+
+size_t TelemetryFrame_EncodeFeatures(uint8_t* buf, size_t bufSize, const TelemetryFrameHeader* header, const TelemetryFeatures* features) {
+	if (bufSize < TELEMETRY_FRAME_FEATURES_SIZE)
+		return 0;
+
+	TelemetryFrameHeader featuresHeader = *header;
+	featuresHeader.type = TELEMETRY_FRAME_FEATURES;
+	featuresHeader.sampleCount = 0;
+	TelemetryFrame_EncodeHeader(buf, bufSize, &featuresHeader);
+
+	uint8_t* p = &buf[TELEMETRY_FRAME_HEADER_SIZE];
+	put_u16(&p[0], features->windowSamples);
+	put_u16(&p[2], TELEMETRY_FEATURE_BANDS);
+	p += 4;
+
+	for (int axis = 0; axis < TELEMETRY_FEATURE_AXES; axis++) {
+		put_f32(&p[0], features->rms[axis]);
+		put_f32(&p[4], features->variance[axis]);
+		put_f32(&p[8], features->zeroCrossingRate[axis]);
+		p += 12;
+		for (int band = 0; band < TELEMETRY_FEATURE_BANDS; band++, p += 4)
+			put_f32(p, features->bandEnergy[axis][band]);
+	}
+
+	return TELEMETRY_FRAME_FEATURES_SIZE;
+}
+
+int TelemetryFrame_DecodeFeatures(const uint8_t* buf, size_t len, TelemetryFeatures* features) {
+	if (len < TELEMETRY_FRAME_FEATURES_SIZE || buf[1] != TELEMETRY_FRAME_FEATURES)
+		return -1;
+
+	const uint8_t* p = &buf[TELEMETRY_FRAME_HEADER_SIZE];
+	if (get_u16(&p[2]) != TELEMETRY_FEATURE_BANDS)
+		return -1;
+	features->windowSamples = get_u16(&p[0]);
+	p += 4;
+
+	for (int axis = 0; axis < TELEMETRY_FEATURE_AXES; axis++) {
+		features->rms[axis] = get_f32(&p[0]);
+		features->variance[axis] = get_f32(&p[4]);
+		features->zeroCrossingRate[axis] = get_f32(&p[8]);
+		p += 12;
+		for (int band = 0; band < TELEMETRY_FEATURE_BANDS; band++, p += 4)
+			features->bandEnergy[axis][band] = get_f32(p);
+	}
+
+	return 0;
+}
+
+float TelemetryFrame_AccelToMg(const TelemetryFrameHeader* header, int16_t raw) {
+	// LSM6DSO sensitivity is 0.061 mg/LSB at +-2 g and doubles with each full scale step
+	return (float)raw * 0.0305f * (float)header->accelFullScaleG;
+}
+
+float TelemetryFrame_GyroToDps(const TelemetryFrameHeader* header, int16_t raw) {
+	// LSM6DSO sensitivity is 4.375 mdps/LSB at +-125 dps and doubles with each full scale step
+	return (float)raw * 0.000035f * (float)header->gyroFullScaleDps;
+}
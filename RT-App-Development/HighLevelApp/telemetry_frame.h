@@ -0,0 +1,155 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+* Binary telemetry frame shared by the device and the host consumers.  See MessageFormat.txt.
+*
+* All fields are little-endian and packed byte by byte, so the encoder and decoder do not depend
+* on the compiler's struct layout and can be built for the A7 and for a host PC alike.  This file
+* must not include any applibs headers.
+*/
+
+#define TELEMETRY_FRAME_VERSION 1
+
+#define TELEMETRY_FRAME_HEADER_SIZE 24
+#define TELEMETRY_FRAME_SAMPLE_SIZE 12
+
+/**
+* @brief Number of bytes needed for a frame carrying the given number of samples.
+*/
+#define TELEMETRY_FRAME_SIZE(samples) ((size_t)TELEMETRY_FRAME_HEADER_SIZE + (size_t)(samples) * TELEMETRY_FRAME_SAMPLE_SIZE)
+
+/**
+* @brief Size of a dryness frame: the header followed by a TelemetryDryness.
+*/
+#define TELEMETRY_FRAME_DRYNESS_SIZE ((size_t)TELEMETRY_FRAME_HEADER_SIZE + 8)
+
+// Features are reported for xa, ya, za (mg) and xr, yr, zr (dps), in that order
+#define TELEMETRY_FEATURE_AXES 6
+#define TELEMETRY_FEATURE_BANDS 4
+
+/**
+* @brief Size of a features frame: the header, the window size and band count, then per axis the
+* RMS, variance, zero-crossing rate and band energies as float32.
+*/
+#define TELEMETRY_FRAME_FEATURES_SIZE ((size_t)TELEMETRY_FRAME_HEADER_SIZE + 4 + TELEMETRY_FEATURE_AXES * (3 + TELEMETRY_FEATURE_BANDS) * 4)
+
+typedef enum {
+	TELEMETRY_FRAME_SAMPLES = 0, // raw accel/gyro samples
+	TELEMETRY_FRAME_START = 1,   // start of a collection run, carries no samples
+	TELEMETRY_FRAME_DRYNESS = 2, // on-device dryness estimate, carries a TelemetryDryness instead of samples
+	TELEMETRY_FRAME_FEATURES = 3 // features of one sample window, carries a TelemetryFeatures instead of samples
+} TelemetryFrameType;
+
+typedef struct {
+	uint8_t version;
+	uint8_t type;
+	uint16_t sampleCount;
+	uint32_t sequence;        // sequence number of the first sample in the frame
+	uint64_t timestampNs;     // device monotonic time of the first sample, taken from the sensor's counter
+	uint32_t samplePeriodNs;  // mean time between consecutive samples of the frame, 0 if unknown
+	uint16_t accelFullScaleG; // 2, 4, 8 or 16
+	uint16_t gyroFullScaleDps; // 125, 250, 500, 1000 or 2000
+} TelemetryFrameHeader;
+
+typedef struct {
+	int16_t acceleration[3]; // raw accelerometer X, Y, Z
+	int16_t angularRate[3];  // raw gyroscope X, Y, Z, calibration offset already removed
+} TelemetrySample;
+
+typedef struct {
+	float dryness;     // smoothed 1 - model prediction, sent with 0.0001 resolution in -3.2768..3.2767
+	float confidence;  // 0..1, sent with 0.0001 resolution
+	uint32_t samples;  // samples that went into the estimate since the previous dryness frame
+} TelemetryDryness;
+
+typedef struct {
+	uint16_t windowSamples;                // samples the features were computed over
+	float rms[TELEMETRY_FEATURE_AXES];      // root mean square, gravity included
+	float variance[TELEMETRY_FEATURE_AXES];
+	float zeroCrossingRate[TELEMETRY_FEATURE_AXES]; // crossings of the window mean per sample, 0..1
+	float bandEnergy[TELEMETRY_FEATURE_AXES][TELEMETRY_FEATURE_BANDS]; // power in equal bands from DC to Nyquist, summing to about the variance
+} TelemetryFeatures;
+
+/**
+* @brief Write a frame header at the start of buf.
+*
+* @param buf Destination buffer.
+* @param bufSize Size of buf in bytes.
+* @param header Header to encode. The version field is ignored and TELEMETRY_FRAME_VERSION is written.
+* @return Number of bytes written, or 0 if buf is too small.
+*/
+size_t TelemetryFrame_EncodeHeader(uint8_t* buf, size_t bufSize, const TelemetryFrameHeader* header);
+
+/**
+* @brief Write sample number index of a frame into buf. The header is not touched.
+*
+* @param buf Buffer holding the frame (starting with the header).
+* @param bufSize Size of buf in bytes.
+* @param index Position of the sample in the frame.
+* @param sample Sample to encode.
+* @return Number of bytes written, or 0 if buf is too small.
+*/
+size_t TelemetryFrame_EncodeSample(uint8_t* buf, size_t bufSize, size_t index, const TelemetrySample* sample);
+
+/**
+* @brief Encode a complete frame (header and header->sampleCount samples).
+*
+* @return Total frame size in bytes, or 0 if buf is too small.
+*/
+size_t TelemetryFrame_Encode(uint8_t* buf, size_t bufSize, const TelemetryFrameHeader* header, const TelemetrySample* samples);
+
+/**
+* @brief Decode and validate a frame header.
+*
+* @param buf Received payload.
+* @param len Payload length in bytes.
+* @param header Decoded header.
+* @return 0 on success, -1 if the payload is not a complete frame of a supported version.
+*/
+int TelemetryFrame_DecodeHeader(const uint8_t* buf, size_t len, TelemetryFrameHeader* header);
+
+/**
+* @brief Decode sample number index of a frame whose header was validated by TelemetryFrame_DecodeHeader.
+*/
+void TelemetryFrame_DecodeSample(const uint8_t* buf, size_t index, TelemetrySample* sample);
+
+/**
+* @brief Encode a dryness frame. header->sampleCount is written as 0.
+*
+* @return TELEMETRY_FRAME_DRYNESS_SIZE, or 0 if buf is too small.
+*/
+size_t TelemetryFrame_EncodeDryness(uint8_t* buf, size_t bufSize, const TelemetryFrameHeader* header, const TelemetryDryness* dryness);
+
+/**
+* @brief Decode the estimate of a frame whose header was validated by TelemetryFrame_DecodeHeader.
+*
+* @return 0 on success, -1 if the frame is not a complete dryness frame.
+*/
+int TelemetryFrame_DecodeDryness(const uint8_t* buf, size_t len, TelemetryDryness* dryness);
+
+/**
+* @brief Encode a features frame. header->sampleCount is written as 0.
+*
+* @return TELEMETRY_FRAME_FEATURES_SIZE, or 0 if buf is too small.
+*/
+size_t TelemetryFrame_EncodeFeatures(uint8_t* buf, size_t bufSize, const TelemetryFrameHeader* header, const TelemetryFeatures* features);
+
+/**
+* @brief Decode the features of a frame whose header was validated by TelemetryFrame_DecodeHeader.
+*
+* @return 0 on success, -1 if the frame is not a complete features frame with TELEMETRY_FEATURE_BANDS bands.
+*/
+int TelemetryFrame_DecodeFeatures(const uint8_t* buf, size_t len, TelemetryFeatures* features);
+
+/**
+* @brief Convert a raw accelerometer value to mg using the full scale from the frame header.
+*/
+float TelemetryFrame_AccelToMg(const TelemetryFrameHeader* header, int16_t raw);
+
+/**
+* @brief Convert a raw gyroscope value to dps using the full scale from the frame header.
+*/
+float TelemetryFrame_GyroToDps(const TelemetryFrameHeader* header, int16_t raw);
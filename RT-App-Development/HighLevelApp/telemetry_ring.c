@@ -0,0 +1,201 @@
+#include "telemetry_ring.h"
+
+#include <string.h>
+#include <unistd.h>
+
+// Each stored frame is preceded by its length, little-endian
+#define RING_LENGTH_SIZE 2
+#define RING_MAX_FRAME_SIZE 0xFFFF
+
+// Identifies a file written by TelemetryRing_Save ("TRNG" followed by a format version)
+static const uint8_t saveMagic[5] = { 'T', 'R', 'N', 'G', 1 };
+
+/* helpers */
+static size_t readLength(const uint8_t* p) {
+	return (size_t)(p[0] | (p[1] << 8));
+}
+
+/**
+* @brief Find a contiguous region of len bytes after the newest frame.
+*
+* @return Offset of the region, or -1 if there is no room.
+*/
+static long findRoom(const TelemetryRing* ring, size_t len) {
+	if (ring->wrapped)
+		return (ring->head - ring->tail >= len) ? (long)ring->tail : -1;
+
+	if (ring->capacity - ring->tail >= len)
+		return (long)ring->tail;
+
+	// Not enough room at the end, wrap around to the start of the storage
+	return (ring->head >= len) ? 0 : -1;
+}
+
+/**
+* @brief Account for a frame of len bytes (length field included) that was written at offset.
+*/
+static void commitFrame(TelemetryRing* ring, long offset, size_t len) {
+	if (!ring->wrapped && offset == 0 && ring->frames > 0) {
+		ring->end = ring->tail;
+		ring->wrapped = true;
+	}
+
+	ring->tail = (size_t)offset + len;
+	ring->frames++;
+	ring->usedBytes += len;
+	if (ring->usedBytes > ring->highWaterBytes)
+		ring->highWaterBytes = ring->usedBytes;
+}
+
+static int writeAll(int fd, const void* buf, size_t len) {
+	const uint8_t* p = buf;
+	while (len > 0) {
+		ssize_t written = write(fd, p, len);
+		if (written <= 0)
+			return -1;
+		p += written;
+		len -= (size_t)written;
+	}
+	return 0;
+}
+
+static int readAll(int fd, void* buf, size_t len) {
+	uint8_t* p = buf;
+	while (len > 0) {
+		ssize_t got = read(fd, p, len);
+		if (got <= 0)
+			return -1;
+		p += got;
+		len -= (size_t)got;
+	}
+	return 0;
+}
+
+/* declarations */
+void TelemetryRing_Init(TelemetryRing* ring, uint8_t* storage, size_t capacity, TelemetryRingPolicy policy) {
+	memset(ring, 0, sizeof(*ring));
+	ring->storage = storage;
+	ring->capacity = capacity;
+	ring->policy = policy;
+}
+
+int TelemetryRing_Push(TelemetryRing* ring, const uint8_t* frame, size_t size) {
+	size_t len = RING_LENGTH_SIZE + size;
+
+	if (size > RING_MAX_FRAME_SIZE || len > ring->capacity) {
+		ring->droppedFrames++;
+		return -1;
+	}
+
+	long offset = findRoom(ring, len);
+	while (offset < 0) {
+		if (ring->policy == TELEMETRY_RING_DROP_NEWEST || ring->frames == 0) {
+			ring->droppedFrames++;
+			return -1;
+		}
+		TelemetryRing_Pop(ring);
+		ring->droppedFrames++;
+		offset = findRoom(ring, len);
+	}
+
+	uint8_t* p = &ring->storage[offset];
+	p[0] = (uint8_t)size;
+	p[1] = (uint8_t)(size >> 8);
+	memcpy(&p[RING_LENGTH_SIZE], frame, size);
+
+	commitFrame(ring, offset, len);
+	ring->pushedFrames++;
+
+	return 0;
+}
+
+const uint8_t* TelemetryRing_Peek(const TelemetryRing* ring, size_t* size) {
+	if (ring->frames == 0)
+		return NULL;
+
+	const uint8_t* p = &ring->storage[ring->head];
+	*size = readLength(p);
+	return &p[RING_LENGTH_SIZE];
+}
+
+void TelemetryRing_Pop(TelemetryRing* ring) {
+	if (ring->frames == 0)
+		return;
+
+	size_t len = RING_LENGTH_SIZE + readLength(&ring->storage[ring->head]);
+	ring->head += len;
+	ring->usedBytes -= len;
+	ring->frames--;
+
+	if (ring->wrapped && ring->head == ring->end) {
+		ring->head = 0;
+		ring->wrapped = false;
+	}
+
+	// Start over at the beginning of the storage when empty so the largest region is free
+	if (ring->frames == 0) {
+		ring->head = 0;
+		ring->tail = 0;
+		ring->wrapped = false;
+	}
+}
+
+int TelemetryRing_Save(const TelemetryRing* ring, int fd) {
+	uint8_t count[4] = { (uint8_t)ring->frames, (uint8_t)(ring->frames >> 8),
+		(uint8_t)(ring->frames >> 16), (uint8_t)(ring->frames >> 24) };
+
+	if (writeAll(fd, saveMagic, sizeof(saveMagic)) != 0 || writeAll(fd, count, sizeof(count)) != 0)
+		return -1;
+
+	// Walk the frames oldest first, writing each one with its length field
+	size_t offset = ring->head;
+	bool wrapped = ring->wrapped;
+	for (uint32_t i = 0; i < ring->frames; i++) {
+		size_t len = RING_LENGTH_SIZE + readLength(&ring->storage[offset]);
+		if (writeAll(fd, &ring->storage[offset], len) != 0)
+			return -1;
+
+		offset += len;
+		if (wrapped && offset == ring->end) {
+			offset = 0;
+			wrapped = false;
+		}
+	}
+
+	return 0;
+}
+
+int TelemetryRing_Restore(TelemetryRing* ring, int fd) {
+	uint8_t magic[sizeof(saveMagic)];
+	uint8_t count[4];
+
+	if (readAll(fd, magic, sizeof(magic)) != 0 || memcmp(magic, saveMagic, sizeof(saveMagic)) != 0
+		|| readAll(fd, count, sizeof(count)) != 0)
+		return -1;
+
+	uint32_t frames = (uint32_t)count[0] | ((uint32_t)count[1] << 8) | ((uint32_t)count[2] << 16) | ((uint32_t)count[3] << 24);
+	int restored = 0;
+
+	for (uint32_t i = 0; i < frames; i++) {
+		uint8_t length[RING_LENGTH_SIZE];
+		if (readAll(fd, length, sizeof(length)) != 0)
+			break;
+
+		size_t size = readLength(length);
+		size_t len = RING_LENGTH_SIZE + size;
+		long offset = findRoom(ring, len);
+		if (offset < 0)
+			break;
+
+		// Read straight into the free region, the frame only counts once it was read completely
+		uint8_t* p = &ring->storage[offset];
+		memcpy(p, length, sizeof(length));
+		if (readAll(fd, &p[RING_LENGTH_SIZE], size) != 0)
+			break;
+
+		commitFrame(ring, offset, len);
+		restored++;
+	}
+
+	return restored;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+* Bounded FIFO of encoded telemetry frames, kept between the sampler and the MQTT client so
+* frames survive broker outages.  Frames of any size are stored back to back in caller
+* provided memory, each behind a 2 byte length.  A frame is never split across the end of
+* the storage, so the oldest frame can always be handed to the publisher as one buffer.
+*
+* No applibs dependencies: the contents can be saved to and restored from any file
+* descriptor, e.g. the application's mutable storage file.
+*/
+
+typedef enum {
+	TELEMETRY_RING_DROP_OLDEST = 0, // make room by discarding the oldest frames
+	TELEMETRY_RING_DROP_NEWEST = 1  // keep the backlog, discard the frame being pushed
+} TelemetryRingPolicy;
+
+typedef struct {
+	uint8_t* storage;
+	size_t capacity;
+	TelemetryRingPolicy policy;
+
+	size_t head;  // offset of the oldest frame
+	size_t tail;  // offset where the next frame is written
+	size_t end;   // end of the data before the wrap, valid while wrapped
+	bool wrapped; // data runs from head to end, then from 0 to tail
+
+	uint32_t frames;          // frames currently stored
+	size_t usedBytes;         // bytes currently stored, including the length fields
+	size_t highWaterBytes;    // largest usedBytes seen
+	uint32_t pushedFrames;    // frames accepted
+	uint32_t droppedFrames;   // frames discarded because the ring was full
+} TelemetryRing;
+
+/**
+* @brief Initialize an empty ring over caller provided storage.
+*/
+void TelemetryRing_Init(TelemetryRing* ring, uint8_t* storage, size_t capacity, TelemetryRingPolicy policy);
+
+/**
+* @brief Copy a frame into the ring, dropping frames according to the ring's policy when full.
+*
+* @return 0 if the frame was stored, -1 if it was dropped.
+*/
+int TelemetryRing_Push(TelemetryRing* ring, const uint8_t* frame, size_t size);
+
+/**
+* @brief Get the oldest frame without removing it.
+*
+* @param size Receives the frame size.
+* @return Pointer into the ring storage, valid until the next push or pop, or NULL if the ring is empty.
+*/
+const uint8_t* TelemetryRing_Peek(const TelemetryRing* ring, size_t* size);
+
+/**
+* @brief Remove the oldest frame.
+*/
+void TelemetryRing_Pop(TelemetryRing* ring);
+
+/**
+* @brief Write the stored frames, oldest first, to fd. The ring is not modified.
+*
+* @return 0 on success, -1 on a write error.
+*/
+int TelemetryRing_Save(const TelemetryRing* ring, int fd);
+
+/**
+* @brief Push the frames written by TelemetryRing_Save from fd into the ring.
+*
+* @return Number of frames restored, or -1 if fd does not hold a saved ring.
+*/
+int TelemetryRing_Restore(TelemetryRing* ring, int fd);
@@ -0,0 +1,99 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dryness_model.h"
+#include "dryness_service.h"
+#include "ingest_client.h"
+
+/*
+* Dryness prediction daemon, replaces the MQTT loop of DryerRegression.py: subscribes to the
+* telemetry, applies the linear model exported by DryerRegression.py and publishes 1 - mean
+* prediction on the output topic.
+*
+*   dryness_predictor -m model.txt [-b broker] [-p port] [-t inputTopic] [-O outputTopic] [-i clientId]
+*/
+
+#define MAX_MODEL_FILE 4096
+
+static volatile sig_atomic_t stopRequested = 0;
+
+// Large, so the device table is not on the stack
+static DrynessService service;
+
+static void TerminationHandler(int signalNumber) {
+	(void)signalNumber;
+	stopRequested = 1;
+}
+
+static int loadModel(const char* path, DrynessModel* model) {
+	FILE* f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "ERROR: Could not open %s\n", path);
+		return -1;
+	}
+
+	char text[MAX_MODEL_FILE];
+	size_t length = fread(text, 1, sizeof(text), f);
+	fclose(f);
+
+	if (length == sizeof(text) || DrynessModel_Parse(model, text, length) != 0) {
+		fprintf(stderr, "ERROR: %s does not hold an intercept and %d coefficients\n", path, DRYNESS_MODEL_FEATURES);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	IngestClientConfig clientConfig = {
+		.host = "mqtt-dashboard.com",
+		.port = "1883",
+		.topic = "arf/DryerTelemetry",
+		.clientId = "dryness_predictor",
+		.sendBufferBytes = 64 * 1024
+	};
+	const char* modelPath = NULL;
+	const char* outputTopic = "arf/microsoft/output";
+
+	int opt;
+	while ((opt = getopt(argc, argv, "m:b:p:t:O:i:")) != -1) {
+		switch (opt) {
+		case 'm': modelPath = optarg; break;
+		case 'b': clientConfig.host = optarg; break;
+		case 'p': clientConfig.port = optarg; break;
+		case 't': clientConfig.topic = optarg; break;
+		case 'O': outputTopic = optarg; break;
+		case 'i': clientConfig.clientId = optarg; break;
+		default:
+			modelPath = NULL;
+			break;
+		}
+	}
+
+	if (modelPath == NULL) {
+		fprintf(stderr, "usage: %s -m model.txt [-b broker] [-p port] [-t inputTopic] [-O outputTopic] [-i clientId]\n", argv[0]);
+		return 1;
+	}
+
+	DrynessModel model;
+	if (loadModel(modelPath, &model) != 0)
+		return 1;
+	DrynessService_Init(&service, &model, outputTopic);
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = TerminationHandler;
+	sigaction(SIGTERM, &action, NULL);
+	sigaction(SIGINT, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	int result = IngestClient_Run(&clientConfig, DrynessService_OnMessage, DrynessService_Publish, &service, &stopRequested);
+
+	fprintf(stderr, "%llu messages, %llu samples, %llu skipped, %llu published, %llu publish failures\n",
+		(unsigned long long)service.messages, (unsigned long long)service.samples, (unsigned long long)service.skipped,
+		(unsigned long long)service.published, (unsigned long long)service.publishFailures);
+
+	return result == 0 ? 0 : 1;
+}
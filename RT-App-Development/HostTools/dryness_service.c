@@ -0,0 +1,113 @@
+#include "dryness_service.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <mqtt.h>
+
+/* helpers */
+static uint32_t hashName(const char* name, size_t length) {
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (uint8_t)name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/**
+* @brief Find or add a device in the open addressing table.
+*
+* @return Index of the device, -1 if the table is full.
+*/
+static int findDevice(DrynessService* service, const char* name, size_t length) {
+	uint32_t index = hashName(name, length) % DRYNESS_SERVICE_MAX_DEVICES;
+
+	for (uint32_t probe = 0; probe < DRYNESS_SERVICE_MAX_DEVICES; probe++) {
+		DrynessDevice* device = &service->devices[index];
+		if (!device->used) {
+			memcpy(device->name, name, length);
+			device->name[length] = '\0';
+			device->used = 1;
+			return (int)index;
+		}
+		if (strncmp(device->name, name, length) == 0 && device->name[length] == '\0')
+			return (int)index;
+		index = (index + 1) % DRYNESS_SERVICE_MAX_DEVICES;
+	}
+
+	return -1;
+}
+
+/* declarations */
+void DrynessService_Init(DrynessService* service, const DrynessModel* model, const char* outputTopic) {
+	memset(service, 0, sizeof(*service));
+	service->model = *model;
+	service->outputTopic = outputTopic;
+}
+
+void DrynessService_OnMessage(void* context, const char* device, size_t deviceLength,
+	const uint8_t* payload, size_t payloadLength) {
+	DrynessService* service = context;
+	service->messages++;
+
+	float mean;
+	uint32_t samples;
+	int result;
+
+	// Binary frames start with the format version, text lines with a digit or a sign
+	if (payloadLength > 0 && payload[0] == TELEMETRY_FRAME_VERSION) {
+		result = DrynessModel_FrameMean(&service->model, payload, payloadLength, &mean, &samples);
+	} else {
+		result = DrynessModel_TextMean(&service->model, (const char*)payload, payloadLength, &mean, &samples);
+	}
+
+	if (result != 0) {
+		service->skipped++;
+		return;
+	}
+	service->samples += samples;
+
+	int index = (deviceLength <= DRYNESS_SERVICE_MAX_DEVICE_NAME) ? findDevice(service, device, deviceLength) : -1;
+	if (index < 0) {
+		service->droppedDevices++;
+		return;
+	}
+
+	DrynessDevice* entry = &service->devices[index];
+	entry->dryness = 1.0f - mean;
+	if (!entry->pending) {
+		entry->pending = 1;
+		service->pending[service->pendingCount++] = (uint16_t)index;
+	}
+}
+
+void DrynessService_Publish(void* context, struct mqtt_client* client) {
+	DrynessService* service = context;
+	char topic[256];
+	char message[32];
+
+	for (uint32_t i = 0; i < service->pendingCount; i++) {
+		DrynessDevice* entry = &service->devices[service->pending[i]];
+		entry->pending = 0;
+
+		if (strcmp(entry->name, "default") == 0) {
+			snprintf(topic, sizeof(topic), "%s", service->outputTopic);
+		} else {
+			snprintf(topic, sizeof(topic), "%s/%s", service->outputTopic, entry->name);
+		}
+		int length = snprintf(message, sizeof(message), "%f", entry->dryness);
+
+		if (mqtt_publish(client, topic, message, (size_t)length, MQTT_PUBLISH_QOS_0) != MQTT_OK) {
+			// A full send buffer is not a connection error, keep the client usable
+			if (client->error == MQTT_ERROR_SEND_BUFFER_IS_FULL)
+				client->error = MQTT_OK;
+			service->publishFailures++;
+			continue;
+		}
+		service->published++;
+	}
+
+	service->pendingCount = 0;
+}
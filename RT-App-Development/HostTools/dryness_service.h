@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dryness_model.h"
+
+struct mqtt_client;
+
+/*
+* Streaming dryness prediction, the work DryerRegression.py did per message.  Runs entirely on the
+* MQTT receive thread: every frame (binary, or legacy text lines) is reduced to its mean prediction
+* without allocating, and the latest dryness of each device is published once per receive burst.
+* A slow device therefore gets one result per frame, as before, while a burst of frames from the
+* same device is not answered with a burst of stale results.
+*/
+
+#define DRYNESS_SERVICE_MAX_DEVICES 4096
+#define DRYNESS_SERVICE_MAX_DEVICE_NAME 64
+
+typedef struct {
+	char name[DRYNESS_SERVICE_MAX_DEVICE_NAME + 1];
+	float dryness;
+	uint8_t used;
+	uint8_t pending;
+} DrynessDevice;
+
+typedef struct {
+	DrynessModel model;
+	const char* outputTopic;
+
+	DrynessDevice devices[DRYNESS_SERVICE_MAX_DEVICES];
+	uint16_t pending[DRYNESS_SERVICE_MAX_DEVICES]; // indices of devices with an unpublished result
+	uint32_t pendingCount;
+
+	uint64_t messages;        // payloads received
+	uint64_t samples;         // samples predicted
+	uint64_t skipped;         // start markers and payloads without samples
+	uint64_t published;       // results queued for publishing
+	uint64_t publishFailures; // results dropped because the send buffer was full
+	uint64_t droppedDevices;  // messages from devices beyond DRYNESS_SERVICE_MAX_DEVICES
+} DrynessService;
+
+/**
+* @brief Reset the service and set the model and the output topic. Results of the device "default"
+* go to outputTopic, those of other devices to outputTopic/<device>.
+*/
+void DrynessService_Init(DrynessService* service, const DrynessModel* model, const char* outputTopic);
+
+/**
+* @brief IngestMessageHandler: predict one payload and remember the result for its device.
+*/
+void DrynessService_OnMessage(void* service, const char* device, size_t deviceLength,
+	const uint8_t* payload, size_t payloadLength);
+
+/**
+* @brief IngestSyncHandler: publish the results collected since the last call.
+*/
+void DrynessService_Publish(void* service, struct mqtt_client* client);
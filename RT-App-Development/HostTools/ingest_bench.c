@@ -0,0 +1,405 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dryness_service.h"
+#include "ingest_client.h"
+#include "ingest_pipeline.h"
+#include "telemetry_frame.h"
+
+/*
+* Throughput benchmark for the ingestion daemon.  A stand-in broker on the loopback interface
+* accepts the daemon's connection and subscription, then publishes synthetic frames for a number
+* of devices as fast as the socket takes them.  The time until every sample was written to the
+* device files is reported, and the line count of the files is checked.
+*
+* With -P the dryness predictor is measured instead: the time until every frame was predicted, and
+* the number of results published back to the broker.
+*
+*   ingest_bench [-m messages] [-d devices] [-s samplesPerFrame] [-j decodeThreads] [-o outputDir] [-P model.txt]
+*/
+
+#define BENCH_TOPIC "DryerTelemetry"
+#define SEND_CHUNK_BYTES (256 * 1024)
+
+// Largest frame the device sends (TELEMETRY_BATCH_MAX_SAMPLES)
+#define BENCH_MAX_SAMPLES 64
+
+typedef struct {
+	int listenFd;
+	unsigned int messages;
+	unsigned int devices;
+	unsigned int samplesPerFrame;
+	struct timespec started;
+	volatile int ready;
+	uint64_t publishesReceived; // published by the client
+	pthread_t thread;
+} Broker;
+
+typedef struct {
+	IngestClientConfig* config;
+	IngestMessageHandler onMessage;
+	IngestSyncHandler afterSync;
+	void* context;
+} ClientArgs;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+/* helpers */
+static double secondsSince(const struct timespec* start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int readAll(int fd, uint8_t* buf, size_t len) {
+	while (len > 0) {
+		ssize_t got = read(fd, buf, len);
+		if (got <= 0)
+			return -1;
+		buf += got;
+		len -= (size_t)got;
+	}
+	return 0;
+}
+
+static int writeAll(int fd, const uint8_t* buf, size_t len) {
+	while (len > 0) {
+		ssize_t written = write(fd, buf, len);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return -1;
+		buf += written;
+		len -= (size_t)written;
+	}
+	return 0;
+}
+
+/**
+* @brief Read one MQTT packet from the client.
+*
+* @return Control packet type, or -1 when the connection closed.
+*/
+static int readPacket(int fd, uint8_t* body, size_t bodySize, size_t* length) {
+	uint8_t header;
+	if (readAll(fd, &header, 1) != 0)
+		return -1;
+
+	size_t remaining = 0;
+	for (int shift = 0; shift < 28; shift += 7) {
+		uint8_t digit;
+		if (readAll(fd, &digit, 1) != 0)
+			return -1;
+		remaining |= (size_t)(digit & 0x7F) << shift;
+		if ((digit & 0x80) == 0)
+			break;
+	}
+
+	if (remaining > bodySize || readAll(fd, body, remaining) != 0)
+		return -1;
+
+	*length = remaining;
+	return header >> 4;
+}
+
+static size_t encodePublish(uint8_t* out, const char* topic, const uint8_t* payload, size_t payloadLength) {
+	size_t topicLength = strlen(topic);
+	size_t remaining = 2 + topicLength + payloadLength;
+	uint8_t* p = out;
+
+	*p++ = 0x30; // PUBLISH, QoS 0
+	do {
+		uint8_t digit = remaining & 0x7F;
+		remaining >>= 7;
+		*p++ = remaining ? (digit | 0x80) : digit;
+	} while (remaining);
+
+	*p++ = (uint8_t)(topicLength >> 8);
+	*p++ = (uint8_t)topicLength;
+	memcpy(p, topic, topicLength);
+	p += topicLength;
+	memcpy(p, payload, payloadLength);
+	return (size_t)(p - out) + payloadLength;
+}
+
+static void* brokerThread(void* arg) {
+	Broker* broker = arg;
+
+	int fd = accept(broker->listenFd, NULL, NULL);
+	if (fd < 0)
+		return NULL;
+
+	int sndbuf = 4 * 1024 * 1024;
+	setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+	// CONNECT -> CONNACK, SUBSCRIBE -> SUBACK
+	uint8_t body[1024];
+	size_t length;
+	int type;
+	while ((type = readPacket(fd, body, sizeof(body), &length)) >= 0) {
+		if (type == 1) {
+			static const uint8_t connack[] = { 0x20, 0x02, 0x00, 0x00 };
+			writeAll(fd, connack, sizeof(connack));
+		} else if (type == 8) {
+			uint8_t suback[] = { 0x90, 0x03, body[0], body[1], 0x00 };
+			writeAll(fd, suback, sizeof(suback));
+			break;
+		}
+	}
+
+	uint8_t* chunk = malloc(SEND_CHUNK_BYTES);
+	uint8_t frame[TELEMETRY_FRAME_SIZE(BENCH_MAX_SAMPLES)];
+	TelemetrySample samples[BENCH_MAX_SAMPLES];
+	uint32_t* sequences = calloc(broker->devices, sizeof(uint32_t));
+	char topic[64];
+	size_t used = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &broker->started);
+	broker->ready = 1;
+
+	for (unsigned int m = 0; m < broker->messages && chunk != NULL && sequences != NULL; m++) {
+		unsigned int device = m % broker->devices;
+
+		for (unsigned int i = 0; i < broker->samplesPerFrame; i++) {
+			for (int axis = 0; axis < 3; axis++) {
+				samples[i].acceleration[axis] = (int16_t)((m * 31 + i * 7 + axis) & 0x7FFF) - 0x4000;
+				samples[i].angularRate[axis] = (int16_t)((m * 17 + i * 3 + axis) & 0x0FFF) - 0x0800;
+			}
+		}
+
+		TelemetryFrameHeader header = {
+			.type = TELEMETRY_FRAME_SAMPLES,
+			.sampleCount = (uint16_t)broker->samplesPerFrame,
+			.sequence = sequences[device],
+			.timestampNs = (uint64_t)m * 1000000,
+			.samplePeriodNs = 1000000000 / 104,
+			.accelFullScaleG = 4,
+			.gyroFullScaleDps = 2000
+		};
+		sequences[device] += broker->samplesPerFrame;
+
+		size_t frameSize = TelemetryFrame_Encode(frame, sizeof(frame), &header, samples);
+		snprintf(topic, sizeof(topic), BENCH_TOPIC "/dryer-%03u", device);
+
+		if (used + frameSize + 128 > SEND_CHUNK_BYTES) {
+			if (writeAll(fd, chunk, used) != 0)
+				break;
+			used = 0;
+		}
+		used += encodePublish(&chunk[used], topic, frame, frameSize);
+	}
+	if (used > 0)
+		writeAll(fd, chunk, used);
+
+	free(chunk);
+	free(sequences);
+
+	// Count what the client publishes and answer keep-alive pings until it disconnects
+	while ((type = readPacket(fd, body, sizeof(body), &length)) >= 0 && type != 14) {
+		if (type == 3) {
+			broker->publishesReceived++;
+		} else if (type == 12) {
+			static const uint8_t pingresp[] = { 0xD0, 0x00 };
+			writeAll(fd, pingresp, sizeof(pingresp));
+		}
+	}
+
+	close(fd);
+	return NULL;
+}
+
+static void* clientThread(void* arg) {
+	ClientArgs* args = arg;
+	IngestClient_Run(args->config, args->onMessage, args->afterSync, args->context, &stopRequested);
+	return NULL;
+}
+
+static void SubmitMessage(void* context, const char* device, size_t deviceLength, const uint8_t* payload, size_t payloadLength) {
+	IngestPipeline_Submit(context, device, deviceLength, payload, payloadLength);
+}
+
+static uint64_t countLines(const char* dir, unsigned int devices, uint64_t* bytes) {
+	uint64_t lines = 0;
+	*bytes = 0;
+	char path[512];
+	static char buf[1 << 16];
+
+	for (unsigned int d = 0; d < devices; d++) {
+		snprintf(path, sizeof(path), "%s/dryer-%03u.csv", dir, d);
+		FILE* f = fopen(path, "r");
+		if (f == NULL)
+			continue;
+
+		size_t got;
+		while ((got = fread(buf, 1, sizeof(buf), f)) > 0) {
+			*bytes += got;
+			for (size_t i = 0; i < got; i++)
+				lines += (buf[i] == '\n');
+		}
+		fclose(f);
+	}
+	return lines;
+}
+
+static void stopClient(Broker* broker, pthread_t clientTid) {
+	stopRequested = 1;
+	pthread_join(clientTid, NULL);
+	pthread_join(broker->thread, NULL);
+	close(broker->listenFd);
+}
+
+static int runIngest(Broker* broker, IngestClientConfig* clientConfig, IngestPipelineConfig* pipelineConfig) {
+	// Start from empty files, the daemon appends
+	mkdir(pipelineConfig->outputDir, 0755);
+	for (unsigned int d = 0; d < broker->devices; d++) {
+		char path[512];
+		snprintf(path, sizeof(path), "%s/dryer-%03u.csv", pipelineConfig->outputDir, d);
+		unlink(path);
+	}
+
+	IngestPipeline* pipeline = IngestPipeline_Create(pipelineConfig);
+	if (pipeline == NULL) {
+		fprintf(stderr, "ERROR: Could not start the decode threads\n");
+		return 1;
+	}
+
+	pthread_t clientTid;
+	ClientArgs clientArgs = { clientConfig, SubmitMessage, NULL, pipeline };
+	pthread_create(&broker->thread, NULL, brokerThread, broker);
+	pthread_create(&clientTid, NULL, clientThread, &clientArgs);
+
+	while (!broker->ready)
+		usleep(1000);
+
+	IngestPipelineStats stats;
+	do {
+		usleep(1000);
+		IngestPipeline_GetStats(pipeline, &stats);
+	} while (stats.messagesDecoded < broker->messages && secondsSince(&broker->started) < 120);
+
+	double decodeSeconds = secondsSince(&broker->started);
+
+	stopClient(broker, clientTid);
+	IngestPipeline_Destroy(pipeline);
+
+	double totalSeconds = secondsSince(&broker->started);
+	uint64_t expectedLines = (uint64_t)broker->messages * broker->samplesPerFrame;
+	uint64_t bytes;
+	uint64_t lines = countLines(pipelineConfig->outputDir, broker->devices, &bytes);
+
+	printf("%u messages, %u devices, %u samples per frame, %u decode threads\n",
+		broker->messages, broker->devices, broker->samplesPerFrame, pipelineConfig->workerCount);
+	printf("decoded in %.3f s, on disk after %.3f s\n", decodeSeconds, totalSeconds);
+	printf("%.0f messages/s, %.0f samples/s, %.1f MB/s written\n",
+		broker->messages / totalSeconds, (double)expectedLines / totalSeconds, (double)bytes / totalSeconds / 1e6);
+	printf("%llu write calls, %llu submit stalls\n", (unsigned long long)stats.fileWrites, (unsigned long long)stats.submitStalls);
+	printf("%llu lines written, %llu expected: %s\n", (unsigned long long)lines, (unsigned long long)expectedLines,
+		lines == expectedLines ? "OK" : "MISMATCH");
+
+	return lines == expectedLines ? 0 : 1;
+}
+
+static int runPredictor(Broker* broker, IngestClientConfig* clientConfig, const char* modelPath) {
+	static DrynessService service;
+	static char text[4096];
+
+	FILE* f = fopen(modelPath, "r");
+	size_t length = f ? fread(text, 1, sizeof(text), f) : 0;
+	if (f)
+		fclose(f);
+
+	DrynessModel model;
+	if (DrynessModel_Parse(&model, text, length) != 0) {
+		fprintf(stderr, "ERROR: Could not load the model from %s\n", modelPath);
+		return 1;
+	}
+	DrynessService_Init(&service, &model, "arf/microsoft/output");
+	clientConfig->sendBufferBytes = 64 * 1024;
+
+	pthread_t clientTid;
+	ClientArgs clientArgs = { clientConfig, DrynessService_OnMessage, DrynessService_Publish, &service };
+	pthread_create(&broker->thread, NULL, brokerThread, broker);
+	pthread_create(&clientTid, NULL, clientThread, &clientArgs);
+
+	while (!broker->ready)
+		usleep(1000);
+
+	// The counters are only advanced by the client thread, a stale read just waits one more round
+	while (*(volatile uint64_t*)&service.messages < broker->messages && secondsSince(&broker->started) < 120)
+		usleep(1000);
+
+	double seconds = secondsSince(&broker->started);
+
+	// Results go out once the receive burst is drained
+	while (*(volatile uint32_t*)&service.pendingCount != 0 && secondsSince(&broker->started) < 120)
+		usleep(1000);
+	double publishSeconds = secondsSince(&broker->started);
+	stopClient(broker, clientTid);
+
+	uint64_t expectedSamples = (uint64_t)broker->messages * broker->samplesPerFrame;
+	printf("%u messages, %u devices, %u samples per frame, predictor on the receive thread\n",
+		broker->messages, broker->devices, broker->samplesPerFrame);
+	printf("predicted in %.3f s: %.0f messages/s, %.0f samples/s\n", seconds,
+		broker->messages / seconds, (double)expectedSamples / seconds);
+	printf("%llu results published after %.3f s, %llu received by the broker, %llu publish failures\n",
+		(unsigned long long)service.published, publishSeconds, (unsigned long long)broker->publishesReceived,
+		(unsigned long long)service.publishFailures);
+	printf("%llu samples predicted, %llu expected: %s\n", (unsigned long long)service.samples,
+		(unsigned long long)expectedSamples, service.samples == expectedSamples ? "OK" : "MISMATCH");
+
+	return service.samples == expectedSamples ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+	Broker broker = { .messages = 200000, .devices = 16, .samplesPerFrame = 32 };
+	IngestPipelineConfig pipelineConfig = { .outputDir = "ingest_bench_out", .workerCount = 4 };
+	const char* modelPath = NULL;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "m:d:s:j:o:P:")) != -1) {
+		switch (opt) {
+		case 'm': broker.messages = (unsigned int)atoi(optarg); break;
+		case 'd': broker.devices = (unsigned int)atoi(optarg); break;
+		case 's': broker.samplesPerFrame = (unsigned int)atoi(optarg); break;
+		case 'j': pipelineConfig.workerCount = (unsigned int)atoi(optarg); break;
+		case 'o': pipelineConfig.outputDir = optarg; break;
+		case 'P': modelPath = optarg; break;
+		default:
+			fprintf(stderr, "usage: %s [-m messages] [-d devices] [-s samplesPerFrame] [-j decodeThreads] [-o outputDir] [-P model.txt]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (broker.devices < 1 || broker.devices > 1000 || broker.samplesPerFrame < 1
+		|| broker.samplesPerFrame > BENCH_MAX_SAMPLES) {
+		fprintf(stderr, "ERROR: 1-1000 devices and 1-%d samples per frame\n", BENCH_MAX_SAMPLES);
+		return 1;
+	}
+
+	broker.listenFd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	socklen_t addrLength = sizeof(addr);
+	if (bind(broker.listenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(broker.listenFd, 1) != 0
+		|| getsockname(broker.listenFd, (struct sockaddr*)&addr, &addrLength) != 0) {
+		fprintf(stderr, "ERROR: Could not start the stand-in broker: %s\n", strerror(errno));
+		return 1;
+	}
+
+	char port[8];
+	snprintf(port, sizeof(port), "%u", ntohs(addr.sin_port));
+	IngestClientConfig clientConfig = { .host = "127.0.0.1", .port = port, .topic = BENCH_TOPIC, .clientId = "ingest_bench" };
+
+	if (modelPath != NULL)
+		return runPredictor(&broker, &clientConfig, modelPath);
+	return runIngest(&broker, &clientConfig, &pipelineConfig);
+}
@@ -0,0 +1,172 @@
+#include "ingest_client.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mqtt.h>
+
+// MQTT-C moves the unread remainder of the receive buffer down after every message, so a larger
+// buffer costs more per message.  Frames are under 1 KiB; the kernel socket buffer absorbs bursts.
+#define DEFAULT_RECV_BUFFER_BYTES (16 * 1024)
+#define DEFAULT_SEND_BUFFER_BYTES 4096
+#define KEEP_ALIVE_SECONDS 60
+#define POLL_TIMEOUT_MS 100
+#define RECONNECT_MIN_MS 500
+#define RECONNECT_MAX_MS 30000
+
+// Devices publishing on the bare topic, without their name
+#define DEFAULT_DEVICE "default"
+
+typedef struct {
+	IngestMessageHandler onMessage;
+	void* context;
+	size_t topicLength;
+} ClientContext;
+
+/* helpers */
+static void sleepMs(unsigned int ms, volatile sig_atomic_t* stop) {
+	// Short steps so a stop request is seen quickly
+	while (ms > 0 && !*stop) {
+		unsigned int step = ms < 100 ? ms : 100;
+		struct timespec ts = { 0, (long)step * 1000000 };
+		nanosleep(&ts, NULL);
+		ms -= step;
+	}
+}
+
+static int openSocket(const char* host, const char* port) {
+	struct addrinfo hints = { 0 };
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo* servinfo = NULL;
+
+	int rv = getaddrinfo(host, port, &hints, &servinfo);
+	if (rv != 0) {
+		fprintf(stderr, "ERROR: Could not resolve %s: %s\n", host, gai_strerror(rv));
+		return -1;
+	}
+
+	int fd = -1;
+	for (struct addrinfo* p = servinfo; p != NULL; p = p->ai_next) {
+		fd = socket(p->ai_family, p->ai_socktype | SOCK_CLOEXEC, p->ai_protocol);
+		if (fd == -1)
+			continue;
+		if (connect(fd, p->ai_addr, p->ai_addrlen) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(servinfo);
+
+	if (fd == -1) {
+		fprintf(stderr, "ERROR: Could not connect to %s:%s: %s\n", host, port, strerror(errno));
+		return -1;
+	}
+
+	// Large kernel buffer so bursts from many devices are absorbed while the client is busy
+	int rcvbuf = 4 * 1024 * 1024;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return fd;
+}
+
+/**
+* @brief Called by MQTT-C for every message: find the device name in the topic and pass the payload on.
+*/
+static void publishCallback(void** state, struct mqtt_response_publish* publish) {
+	ClientContext* context = *state;
+	const char* topic = publish->topic_name;
+	size_t topicLength = publish->topic_name_size;
+
+	const char* device = DEFAULT_DEVICE;
+	size_t deviceLength = sizeof(DEFAULT_DEVICE) - 1;
+
+	if (topicLength > context->topicLength + 1 && topic[context->topicLength] == '/') {
+		device = topic + context->topicLength + 1;
+		deviceLength = topicLength - context->topicLength - 1;
+	}
+
+	context->onMessage(context->context, device, deviceLength,
+		publish->application_message, publish->application_message_size);
+}
+
+/* declarations */
+int IngestClient_Run(const IngestClientConfig* config, IngestMessageHandler onMessage, IngestSyncHandler afterSync,
+	void* context, volatile sig_atomic_t* stop) {
+	size_t recvBufferBytes = config->recvBufferBytes ? config->recvBufferBytes : DEFAULT_RECV_BUFFER_BYTES;
+	size_t sendBufferBytes = config->sendBufferBytes ? config->sendBufferBytes : DEFAULT_SEND_BUFFER_BYTES;
+	uint8_t* sendbuf = malloc(sendBufferBytes);
+	uint8_t* recvbuf = malloc(recvBufferBytes);
+
+	char subscription[256];
+	if (snprintf(subscription, sizeof(subscription), "%s/#", config->topic) >= (int)sizeof(subscription)
+		|| sendbuf == NULL || recvbuf == NULL) {
+		free(sendbuf);
+		free(recvbuf);
+		return -1;
+	}
+
+	ClientContext clientContext = { .onMessage = onMessage, .context = context, .topicLength = strlen(config->topic) };
+	unsigned int backoffMs = RECONNECT_MIN_MS;
+
+	while (!*stop) {
+		int fd = openSocket(config->host, config->port);
+		if (fd == -1) {
+			sleepMs(backoffMs, stop);
+			backoffMs = backoffMs * 2 > RECONNECT_MAX_MS ? RECONNECT_MAX_MS : backoffMs * 2;
+			continue;
+		}
+
+		struct mqtt_client client;
+		mqtt_init(&client, fd, sendbuf, sendBufferBytes, recvbuf, recvBufferBytes, publishCallback);
+		client.publish_response_callback_state = &clientContext;
+
+		// "<topic>/#" also matches the bare topic
+		mqtt_connect(&client, config->clientId, NULL, NULL, 0, NULL, NULL, MQTT_CONNECT_CLEAN_SESSION, KEEP_ALIVE_SECONDS);
+		mqtt_subscribe(&client, subscription, 0);
+		fprintf(stderr, "Connected to %s:%s, subscribed to %s\n", config->host, config->port, subscription);
+
+		while (!*stop) {
+			if (mqtt_sync(&client) != MQTT_OK) {
+				fprintf(stderr, "ERROR: MQTT connection lost: %s\n", mqtt_error_str(client.error));
+				break;
+			}
+			backoffMs = RECONNECT_MIN_MS;
+
+			// Send what the handler published right away instead of after the next poll
+			if (afterSync != NULL) {
+				afterSync(context, &client);
+				if (mqtt_sync(&client) != MQTT_OK) {
+					fprintf(stderr, "ERROR: MQTT connection lost: %s\n", mqtt_error_str(client.error));
+					break;
+				}
+			}
+
+			struct pollfd pfd = { .fd = fd, .events = POLLIN };
+			poll(&pfd, 1, POLL_TIMEOUT_MS);
+		}
+
+		if (*stop)
+			mqtt_disconnect(&client);
+		mqtt_sync(&client);
+		close(fd);
+
+		if (!*stop) {
+			sleepMs(backoffMs, stop);
+			backoffMs = backoffMs * 2 > RECONNECT_MAX_MS ? RECONNECT_MAX_MS : backoffMs * 2;
+		}
+	}
+
+	free(sendbuf);
+	free(recvbuf);
+	return 0;
+}
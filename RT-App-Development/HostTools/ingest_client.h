@@ -0,0 +1,41 @@
+#pragma once
+
+#include <signal.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct mqtt_client;
+
+/**
+* @brief Called for every message received on the subscribed topic.
+*/
+typedef void (*IngestMessageHandler)(void* context, const char* device, size_t deviceLength,
+	const uint8_t* payload, size_t payloadLength);
+
+/**
+* @brief Called after every receive burst, outside MQTT-C's lock, so the handler may publish on client.
+*/
+typedef void (*IngestSyncHandler)(void* context, struct mqtt_client* client);
+
+typedef struct {
+	const char* host;
+	const char* port;
+	const char* topic;     // base topic, the daemon subscribes to <topic>/#
+	const char* clientId;
+	size_t recvBufferBytes; // MQTT-C receive buffer, 0 for the default
+	size_t sendBufferBytes; // MQTT-C send buffer, 0 for the default
+} IngestClientConfig;
+
+/**
+* @brief Subscribe to the telemetry topic and pass every message to onMessage until *stop is set.
+* Reconnects with backoff when the broker goes away.
+*
+* Messages on <topic>/<device> are stored under <device>, messages on the bare topic (devices that
+* do not add their name) under "default".
+*
+* @param afterSync Optional, NULL if the caller does not publish.
+* @return 0 when stopped, -1 if the client could not be set up.
+*/
+int IngestClient_Run(const IngestClientConfig* config, IngestMessageHandler onMessage, IngestSyncHandler afterSync,
+	void* context, volatile sig_atomic_t* stop);
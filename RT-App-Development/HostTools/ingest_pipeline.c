@@ -0,0 +1,479 @@
+#include "ingest_pipeline.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "telemetry_frame.h"
+
+#define DEFAULT_MAX_PENDING_BYTES (8 * 1024 * 1024)
+#define DEFAULT_FILE_BUFFER_BYTES (64 * 1024)
+#define DEFAULT_FLUSH_INTERVAL_MS 1000
+
+#define MAX_DEVICE_NAME 64
+#define MAX_PAYLOAD_SIZE 0xFFFFFF
+#define DEVICE_BUCKETS 256
+
+// Longest text line: "-4294967295," plus six "-9999999.999999," values and a newline
+#define MAX_LINE_LENGTH 128
+
+// Same conversion as telemetry_frame.py, in double precision so the output matches mqttWrite.py
+#define MG_PER_LSB_PER_G 0.0305
+#define DPS_PER_LSB_PER_DPS 0.000035
+
+// Each queued payload: [u8 device length][u32 payload length][device][payload]
+#define RECORD_HEADER_SIZE 5
+
+typedef struct {
+	uint8_t* data;
+	size_t size;
+	size_t capacity;
+} ByteBuffer;
+
+typedef struct DeviceFile {
+	struct DeviceFile* next;
+	char name[MAX_DEVICE_NAME + 1];
+	int fd;
+	char* buf;
+	size_t used;
+} DeviceFile;
+
+typedef struct {
+	IngestPipeline* pipeline;
+	pthread_t thread;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t ready;    // pending has data or the pipeline is stopping
+	pthread_cond_t drained;  // pending was taken by the worker
+	ByteBuffer pending;      // appended to by Submit
+	bool stopping;
+
+	// Owned by the worker thread
+	ByteBuffer working;
+	DeviceFile* devices[DEVICE_BUCKETS];
+	struct timespec lastFlush;
+
+	atomic_uint_fast64_t messagesReceived;
+	atomic_uint_fast64_t messagesDecoded;
+	atomic_uint_fast64_t invalidFrames;
+	atomic_uint_fast64_t samplesWritten;
+	atomic_uint_fast64_t bytesWritten;
+	atomic_uint_fast64_t fileWrites;
+	atomic_uint_fast64_t writeErrors;
+	atomic_uint_fast64_t submitStalls;
+	atomic_uint devicesOpen;
+} Worker;
+
+struct IngestPipeline {
+	char outputDir[256];
+	size_t maxPendingBytes;
+	size_t fileBufferBytes;
+	unsigned int flushIntervalMs;
+	unsigned int workerCount;
+	Worker* workers;
+};
+
+/* helpers */
+static uint32_t hashName(const char* name, size_t length) {
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (uint8_t)name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static int reserve(ByteBuffer* buffer, size_t extra) {
+	if (buffer->size + extra <= buffer->capacity)
+		return 0;
+
+	size_t capacity = buffer->capacity ? buffer->capacity : 64 * 1024;
+	while (capacity < buffer->size + extra)
+		capacity *= 2;
+
+	uint8_t* data = realloc(buffer->data, capacity);
+	if (data == NULL)
+		return -1;
+
+	buffer->data = data;
+	buffer->capacity = capacity;
+	return 0;
+}
+
+static long msSince(const struct timespec* then) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - then->tv_sec) * 1000 + (now.tv_nsec - then->tv_nsec) / 1000000;
+}
+
+static char* formatUnsigned(char* p, uint64_t value) {
+	char digits[20];
+	int n = 0;
+	do {
+		digits[n++] = (char)('0' + value % 10);
+		value /= 10;
+	} while (value != 0);
+
+	while (n > 0)
+		*p++ = digits[--n];
+	return p;
+}
+
+/**
+* @brief Equivalent of printf("%f"), six decimals, without the cost of the locale-aware printf machinery.
+*/
+static char* formatFixed6(char* p, double value) {
+	int64_t scaled = llround(value * 1e6);
+	if (scaled < 0) {
+		*p++ = '-';
+		scaled = -scaled;
+	}
+
+	p = formatUnsigned(p, (uint64_t)scaled / 1000000);
+	*p++ = '.';
+
+	uint32_t fraction = (uint32_t)((uint64_t)scaled % 1000000);
+	for (int i = 5; i >= 0; i--) {
+		p[i] = (char)('0' + fraction % 10);
+		fraction /= 10;
+	}
+	return p + 6;
+}
+
+static void flushDevice(Worker* worker, DeviceFile* device) {
+	if (device->used == 0)
+		return;
+
+	size_t offset = 0;
+	while (offset < device->used) {
+		ssize_t written = write(device->fd, device->buf + offset, device->used - offset);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0) {
+			atomic_fetch_add_explicit(&worker->writeErrors, 1, memory_order_relaxed);
+			break;
+		}
+		offset += (size_t)written;
+		atomic_fetch_add_explicit(&worker->fileWrites, 1, memory_order_relaxed);
+	}
+
+	atomic_fetch_add_explicit(&worker->bytesWritten, offset, memory_order_relaxed);
+	device->used = 0;
+}
+
+static void flushAllDevices(Worker* worker) {
+	for (int i = 0; i < DEVICE_BUCKETS; i++) {
+		for (DeviceFile* device = worker->devices[i]; device != NULL; device = device->next)
+			flushDevice(worker, device);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &worker->lastFlush);
+}
+
+static DeviceFile* findDevice(Worker* worker, const char* name, size_t length) {
+	uint32_t bucket = hashName(name, length) % DEVICE_BUCKETS;
+
+	for (DeviceFile* device = worker->devices[bucket]; device != NULL; device = device->next) {
+		if (strncmp(device->name, name, length) == 0 && device->name[length] == '\0')
+			return device;
+	}
+
+	DeviceFile* device = calloc(1, sizeof(DeviceFile));
+	if (device == NULL)
+		return NULL;
+
+	memcpy(device->name, name, length);
+	device->name[length] = '\0';
+	device->buf = malloc(worker->pipeline->fileBufferBytes);
+
+	char path[sizeof(worker->pipeline->outputDir) + MAX_DEVICE_NAME + 8];
+	snprintf(path, sizeof(path), "%s/%s.csv", worker->pipeline->outputDir, device->name);
+	device->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+	if (device->fd < 0 || device->buf == NULL) {
+		fprintf(stderr, "ERROR: Could not open %s: %s\n", path, strerror(errno));
+		if (device->fd >= 0)
+			close(device->fd);
+		free(device->buf);
+		free(device);
+		atomic_fetch_add_explicit(&worker->writeErrors, 1, memory_order_relaxed);
+		return NULL;
+	}
+
+	device->next = worker->devices[bucket];
+	worker->devices[bucket] = device;
+	atomic_fetch_add_explicit(&worker->devicesOpen, 1, memory_order_relaxed);
+	return device;
+}
+
+static void appendLine(Worker* worker, DeviceFile* device, const char* line, size_t length) {
+	if (device->used + length > worker->pipeline->fileBufferBytes)
+		flushDevice(worker, device);
+
+	memcpy(device->buf + device->used, line, length);
+	device->used += length;
+}
+
+/**
+* @brief Convert one payload to text lines: "sequence,xa,ya,za,xr,yr,zr" per sample in mg and dps,
+* or all -1 for a start frame, like telemetry_frame.toCSVLines.
+*/
+static void processPayload(Worker* worker, DeviceFile* device, const uint8_t* payload, size_t length) {
+	TelemetryFrameHeader header;
+	if (TelemetryFrame_DecodeHeader(payload, length, &header) != 0) {
+		atomic_fetch_add_explicit(&worker->invalidFrames, 1, memory_order_relaxed);
+		return;
+	}
+
+	if (header.type == TELEMETRY_FRAME_START) {
+		static const char startLine[] = "-1,-1,-1,-1,-1,-1,-1\n";
+		appendLine(worker, device, startLine, sizeof(startLine) - 1);
+		return;
+	}
+
+	if (header.type != TELEMETRY_FRAME_SAMPLES)
+		return;
+
+	double mgPerLsb = MG_PER_LSB_PER_G * header.accelFullScaleG;
+	double dpsPerLsb = DPS_PER_LSB_PER_DPS * header.gyroFullScaleDps;
+	char line[MAX_LINE_LENGTH];
+
+	for (uint16_t i = 0; i < header.sampleCount; i++) {
+		TelemetrySample sample;
+		TelemetryFrame_DecodeSample(payload, i, &sample);
+
+		char* p = formatUnsigned(line, (uint64_t)header.sequence + i);
+		for (int axis = 0; axis < 3; axis++) {
+			*p++ = ',';
+			p = formatFixed6(p, sample.acceleration[axis] * mgPerLsb);
+		}
+		for (int axis = 0; axis < 3; axis++) {
+			*p++ = ',';
+			p = formatFixed6(p, sample.angularRate[axis] * dpsPerLsb);
+		}
+		*p++ = '\n';
+
+		appendLine(worker, device, line, (size_t)(p - line));
+	}
+
+	atomic_fetch_add_explicit(&worker->samplesWritten, header.sampleCount, memory_order_relaxed);
+}
+
+static void processRecords(Worker* worker) {
+	const uint8_t* p = worker->working.data;
+	const uint8_t* end = p + worker->working.size;
+
+	while (p < end) {
+		size_t deviceLength = p[0];
+		size_t payloadLength = (size_t)p[1] | ((size_t)p[2] << 8) | ((size_t)p[3] << 16) | ((size_t)p[4] << 24);
+		const char* name = (const char*)&p[RECORD_HEADER_SIZE];
+		const uint8_t* payload = &p[RECORD_HEADER_SIZE + deviceLength];
+
+		DeviceFile* device = findDevice(worker, name, deviceLength);
+		if (device != NULL)
+			processPayload(worker, device, payload, payloadLength);
+
+		atomic_fetch_add_explicit(&worker->messagesDecoded, 1, memory_order_relaxed);
+		p = payload + payloadLength;
+	}
+
+	worker->working.size = 0;
+}
+
+static void* workerThread(void* arg) {
+	Worker* worker = arg;
+	unsigned int flushIntervalMs = worker->pipeline->flushIntervalMs;
+
+	for (;;) {
+		pthread_mutex_lock(&worker->mutex);
+		while (worker->pending.size == 0 && !worker->stopping) {
+			// Wake up for the periodic flush even when nothing arrives
+			struct timespec deadline;
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += flushIntervalMs / 1000;
+			deadline.tv_nsec += (long)(flushIntervalMs % 1000) * 1000000;
+			if (deadline.tv_nsec >= 1000000000) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000;
+			}
+
+			if (pthread_cond_timedwait(&worker->ready, &worker->mutex, &deadline) == ETIMEDOUT)
+				break;
+		}
+
+		bool stopping = worker->stopping && worker->pending.size == 0;
+
+		// Take the whole backlog in one go, Submit continues in the other buffer
+		ByteBuffer taken = worker->pending;
+		worker->pending = worker->working;
+		worker->working = taken;
+		pthread_cond_broadcast(&worker->drained);
+		pthread_mutex_unlock(&worker->mutex);
+
+		processRecords(worker);
+
+		if (stopping || msSince(&worker->lastFlush) >= (long)flushIntervalMs)
+			flushAllDevices(worker);
+
+		if (stopping)
+			break;
+	}
+
+	return NULL;
+}
+
+/* declarations */
+IngestPipeline* IngestPipeline_Create(const IngestPipelineConfig* config) {
+	if (config->workerCount < 1 || strlen(config->outputDir) >= sizeof(((IngestPipeline*)0)->outputDir))
+		return NULL;
+
+	IngestPipeline* pipeline = calloc(1, sizeof(IngestPipeline));
+	if (pipeline == NULL)
+		return NULL;
+
+	strcpy(pipeline->outputDir, config->outputDir);
+	pipeline->maxPendingBytes = config->maxPendingBytes ? config->maxPendingBytes : DEFAULT_MAX_PENDING_BYTES;
+	pipeline->fileBufferBytes = config->fileBufferBytes ? config->fileBufferBytes : DEFAULT_FILE_BUFFER_BYTES;
+	pipeline->flushIntervalMs = config->flushIntervalMs ? config->flushIntervalMs : DEFAULT_FLUSH_INTERVAL_MS;
+	if (pipeline->fileBufferBytes < MAX_LINE_LENGTH)
+		pipeline->fileBufferBytes = MAX_LINE_LENGTH;
+
+	pipeline->workers = calloc(config->workerCount, sizeof(Worker));
+	if (pipeline->workers == NULL) {
+		free(pipeline);
+		return NULL;
+	}
+
+	for (unsigned int i = 0; i < config->workerCount; i++) {
+		Worker* worker = &pipeline->workers[i];
+		worker->pipeline = pipeline;
+		pthread_mutex_init(&worker->mutex, NULL);
+		pthread_cond_init(&worker->ready, NULL);
+		pthread_cond_init(&worker->drained, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &worker->lastFlush);
+
+		if (pthread_create(&worker->thread, NULL, workerThread, worker) != 0) {
+			fprintf(stderr, "ERROR: Could not start decode thread: %s\n", strerror(errno));
+			pipeline->workerCount = i;
+			IngestPipeline_Destroy(pipeline);
+			return NULL;
+		}
+		pipeline->workerCount = i + 1;
+	}
+
+	return pipeline;
+}
+
+int IngestPipeline_Submit(IngestPipeline* pipeline, const char* device, size_t deviceLength,
+	const uint8_t* payload, size_t payloadLength) {
+	// Keep only characters that are safe in a file name
+	char name[MAX_DEVICE_NAME];
+	size_t nameLength = 0;
+	for (size_t i = 0; i < deviceLength && nameLength < sizeof(name); i++) {
+		char c = device[i];
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_'
+			|| (c == '.' && nameLength > 0))
+			name[nameLength++] = c;
+	}
+
+	if (nameLength == 0 || deviceLength > MAX_DEVICE_NAME || payloadLength > MAX_PAYLOAD_SIZE)
+		return -1;
+
+	Worker* worker = &pipeline->workers[hashName(name, nameLength) % pipeline->workerCount];
+	size_t recordSize = RECORD_HEADER_SIZE + nameLength + payloadLength;
+
+	pthread_mutex_lock(&worker->mutex);
+
+	if (worker->pending.size >= pipeline->maxPendingBytes) {
+		atomic_fetch_add_explicit(&worker->submitStalls, 1, memory_order_relaxed);
+		while (worker->pending.size >= pipeline->maxPendingBytes)
+			pthread_cond_wait(&worker->drained, &worker->mutex);
+	}
+
+	if (reserve(&worker->pending, recordSize) != 0) {
+		pthread_mutex_unlock(&worker->mutex);
+		return -1;
+	}
+
+	uint8_t* p = &worker->pending.data[worker->pending.size];
+	p[0] = (uint8_t)nameLength;
+	p[1] = (uint8_t)payloadLength;
+	p[2] = (uint8_t)(payloadLength >> 8);
+	p[3] = (uint8_t)(payloadLength >> 16);
+	p[4] = (uint8_t)(payloadLength >> 24);
+	memcpy(&p[RECORD_HEADER_SIZE], name, nameLength);
+	memcpy(&p[RECORD_HEADER_SIZE + nameLength], payload, payloadLength);
+
+	bool wasEmpty = (worker->pending.size == 0);
+	worker->pending.size += recordSize;
+	if (wasEmpty)
+		pthread_cond_signal(&worker->ready);
+
+	pthread_mutex_unlock(&worker->mutex);
+
+	atomic_fetch_add_explicit(&worker->messagesReceived, 1, memory_order_relaxed);
+	return 0;
+}
+
+void IngestPipeline_GetStats(IngestPipeline* pipeline, IngestPipelineStats* stats) {
+	memset(stats, 0, sizeof(*stats));
+
+	for (unsigned int i = 0; i < pipeline->workerCount; i++) {
+		Worker* worker = &pipeline->workers[i];
+		stats->messagesReceived += atomic_load_explicit(&worker->messagesReceived, memory_order_relaxed);
+		stats->messagesDecoded += atomic_load_explicit(&worker->messagesDecoded, memory_order_relaxed);
+		stats->invalidFrames += atomic_load_explicit(&worker->invalidFrames, memory_order_relaxed);
+		stats->samplesWritten += atomic_load_explicit(&worker->samplesWritten, memory_order_relaxed);
+		stats->bytesWritten += atomic_load_explicit(&worker->bytesWritten, memory_order_relaxed);
+		stats->fileWrites += atomic_load_explicit(&worker->fileWrites, memory_order_relaxed);
+		stats->writeErrors += atomic_load_explicit(&worker->writeErrors, memory_order_relaxed);
+		stats->submitStalls += atomic_load_explicit(&worker->submitStalls, memory_order_relaxed);
+		stats->devices += atomic_load_explicit(&worker->devicesOpen, memory_order_relaxed);
+	}
+}
+
+void IngestPipeline_Destroy(IngestPipeline* pipeline) {
+	if (pipeline == NULL)
+		return;
+
+	for (unsigned int i = 0; i < pipeline->workerCount; i++) {
+		Worker* worker = &pipeline->workers[i];
+		pthread_mutex_lock(&worker->mutex);
+		worker->stopping = true;
+		pthread_cond_signal(&worker->ready);
+		pthread_mutex_unlock(&worker->mutex);
+	}
+
+	for (unsigned int i = 0; i < pipeline->workerCount; i++) {
+		Worker* worker = &pipeline->workers[i];
+		pthread_join(worker->thread, NULL);
+
+		for (int b = 0; b < DEVICE_BUCKETS; b++) {
+			DeviceFile* device = worker->devices[b];
+			while (device != NULL) {
+				DeviceFile* next = device->next;
+				close(device->fd);
+				free(device->buf);
+				free(device);
+				device = next;
+			}
+		}
+
+		free(worker->pending.data);
+		free(worker->working.data);
+		pthread_mutex_destroy(&worker->mutex);
+		pthread_cond_destroy(&worker->ready);
+		pthread_cond_destroy(&worker->drained);
+	}
+
+	free(pipeline->workers);
+	free(pipeline);
+}
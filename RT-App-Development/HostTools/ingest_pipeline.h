@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+* Decode and storage stage of the telemetry ingestion daemon.
+*
+* The MQTT receive thread hands every payload to IngestPipeline_Submit.  Devices are sharded
+* over a fixed set of worker threads by a hash of their name, so each device is decoded and
+* written by one thread only: frames of a device stay in order and its file needs no lock.
+* Workers take their whole backlog at once by swapping buffers, convert the frames to the
+* text format of mqttWrite.py and append them to <outputDir>/<device>.csv through a per-device
+* buffer that is written out when full and at least once per flush interval.
+*/
+
+typedef struct IngestPipeline IngestPipeline;
+
+typedef struct {
+	const char* outputDir;
+	unsigned int workerCount;      // decode threads, at least 1
+	size_t maxPendingBytes;        // backlog per worker before Submit blocks, 0 for the default
+	size_t fileBufferBytes;        // write buffer per device, 0 for the default
+	unsigned int flushIntervalMs;  // longest time data sits in a write buffer, 0 for the default
+} IngestPipelineConfig;
+
+typedef struct {
+	uint64_t messagesReceived;  // payloads submitted
+	uint64_t messagesDecoded;   // payloads fully processed, including invalid ones
+	uint64_t invalidFrames;     // payloads that were not a valid frame
+	uint64_t samplesWritten;    // sample lines produced
+	uint64_t bytesWritten;      // bytes written to the device files
+	uint64_t fileWrites;        // write calls issued
+	uint64_t writeErrors;       // failed writes or opens, the data is dropped
+	uint64_t submitStalls;      // times Submit waited for a worker to catch up
+	uint32_t devices;           // device files open
+} IngestPipelineStats;
+
+/**
+* @brief Start the worker threads.
+*
+* @return The pipeline, or NULL on failure.
+*/
+IngestPipeline* IngestPipeline_Create(const IngestPipelineConfig* config);
+
+/**
+* @brief Queue a payload received for a device. The payload is copied. Blocks while the
+* device's worker is more than maxPendingBytes behind, which pushes back on the socket.
+*
+* @param device Device name, only [A-Za-z0-9_-.] are kept for the file name.
+* @return 0 on success, -1 if the device name or payload is too long.
+*/
+int IngestPipeline_Submit(IngestPipeline* pipeline, const char* device, size_t deviceLength,
+	const uint8_t* payload, size_t payloadLength);
+
+/**
+* @brief Read the counters. Safe to call from any thread.
+*/
+void IngestPipeline_GetStats(IngestPipeline* pipeline, IngestPipelineStats* stats);
+
+/**
+* @brief Process everything queued, flush and close all files and stop the workers.
+*/
+void IngestPipeline_Destroy(IngestPipeline* pipeline);
@@ -0,0 +1,94 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ingest_client.h"
+#include "ingest_pipeline.h"
+
+/*
+* Telemetry ingestion daemon: subscribes to the frames published by the dryers and appends them,
+* in the text format of mqttWrite.py, to one file per device.
+*
+*   telemetry_ingest [-b broker] [-p port] [-t topic] [-o outputDir] [-j decodeThreads] [-i clientId]
+*/
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static unsigned long long rejectedMessages = 0;
+
+static void TerminationHandler(int signalNumber) {
+	(void)signalNumber;
+	stopRequested = 1;
+}
+
+/**
+* @brief Queue every received payload on the decode threads.
+*/
+static void SubmitMessage(void* context, const char* device, size_t deviceLength, const uint8_t* payload, size_t payloadLength) {
+	if (IngestPipeline_Submit(context, device, deviceLength, payload, payloadLength) != 0)
+		rejectedMessages++;
+}
+
+static void usage(const char* name) {
+	fprintf(stderr, "usage: %s [-b broker] [-p port] [-t topic] [-o outputDir] [-j decodeThreads] [-i clientId]\n", name);
+}
+
+int main(int argc, char* argv[]) {
+	IngestClientConfig clientConfig = {
+		.host = "ece1894.eastus.cloudapp.azure.com",
+		.port = "1883",
+		.topic = "DryerTelemetry",
+		.clientId = "telemetry_ingest"
+	};
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	IngestPipelineConfig pipelineConfig = {
+		.outputDir = ".",
+		.workerCount = cpus > 1 ? (unsigned int)(cpus - 1) : 1
+	};
+
+	int opt;
+	while ((opt = getopt(argc, argv, "b:p:t:o:j:i:")) != -1) {
+		switch (opt) {
+		case 'b': clientConfig.host = optarg; break;
+		case 'p': clientConfig.port = optarg; break;
+		case 't': clientConfig.topic = optarg; break;
+		case 'o': pipelineConfig.outputDir = optarg; break;
+		case 'j': pipelineConfig.workerCount = (unsigned int)atoi(optarg); break;
+		case 'i': clientConfig.clientId = optarg; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	mkdir(pipelineConfig.outputDir, 0755);
+
+	IngestPipeline* pipeline = IngestPipeline_Create(&pipelineConfig);
+	if (pipeline == NULL) {
+		fprintf(stderr, "ERROR: Could not start the decode threads\n");
+		return 1;
+	}
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = TerminationHandler;
+	sigaction(SIGTERM, &action, NULL);
+	sigaction(SIGINT, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	int result = IngestClient_Run(&clientConfig, SubmitMessage, NULL, pipeline, &stopRequested);
+
+	IngestPipelineStats stats;
+	IngestPipeline_GetStats(pipeline, &stats);
+	IngestPipeline_Destroy(pipeline);
+
+	fprintf(stderr, "%llu messages, %llu samples, %llu invalid, %llu rejected, %u devices, %llu write errors\n",
+		(unsigned long long)stats.messagesReceived, (unsigned long long)stats.samplesWritten,
+		(unsigned long long)stats.invalidFrames, rejectedMessages, stats.devices, (unsigned long long)stats.writeErrors);
+
+	return result == 0 ? 0 : 1;
+}
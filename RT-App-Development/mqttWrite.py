@@ -1,6 +1,7 @@
 import paho.mqtt.client as mqtt
 import socket
 from csv import writer
+import telemetry_frame
 
 # Define the MQTT broker's IP address and port
 broker_address = socket.gethostbyname('ece1894.eastus.cloudapp.azure.com')
@@ -13,7 +14,7 @@ def on_connect(client, userdata, flags, rc):
     client.subscribe("DryerTelemetry")
 
 def on_message(client, userdata, msg):
-    print(msg.topic+" "+str(msg.payload))
+    print(msg.topic+" "+str(telemetry_frame.decode(msg.payload)))
     appendToText(msg)
 
 def appendToCSV():
@@ -34,7 +35,9 @@ def appendToCSV():
 def appendToText(msg):
     # Append-adds at last
     file1 = open("myfile.txt", "a")  # append mode
-    file1.write(msg.payload.decode("utf-8")+"\n")
+    # Frames are binary, store them in the original text format
+    for line in telemetry_frame.toCSVLines(msg.payload):
+        file1.write(line+"\n")
     file1.close()
 
 def createList():
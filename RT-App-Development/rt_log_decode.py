@@ -0,0 +1,107 @@
+# Decoder for the binary log Dryer-RT writes on the real-time core's debug UART (Dryer-RT/int/uart_log.h).
+# The texts are read from Dryer-RT/int/uart_log_formats.h, so the decoder always matches the firmware it sits next to.
+#
+#   python rt_log_decode.py COM5            read from a serial port (needs pyserial)
+#   python rt_log_decode.py capture.bin     decode a raw capture, '-' for stdin
+import os
+import re
+import struct
+import sys
+
+SYNC = 0xA5
+HEADER_SIZE = 4
+MAX_ARGS = 4
+BAUD = 115200
+
+FORMATS_FILE = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'Dryer-RT', 'int', 'uart_log_formats.h')
+ENTRY = re.compile(r'X\(\s*(\w+)\s*,\s*"((?:[^"\\]|\\.)*)"\s*\)')
+CONVERSION = re.compile(r'%[-+ #0]*\d*(?:\.\d+)?[hlL]*([diuxXc%])')
+
+
+def loadFormats(path=FORMATS_FILE):
+    """Returns the list of (name, text) in format ID order."""
+    with open(path) as f:
+        return [(name, bytes(text, 'utf-8').decode('unicode_escape')) for name, text in ENTRY.findall(f.read())]
+
+
+def formatRecord(text, args):
+    """Fills in the raw uint32 arguments, signed for %d and %i."""
+    values = []
+    for conversion in CONVERSION.findall(text):
+        if conversion == '%':
+            continue
+        value = args[len(values)] if len(values) < len(args) else 0
+        if conversion in 'di' and value >= 0x80000000:
+            value -= 0x100000000
+        values.append(value)
+    return text % tuple(values)
+
+
+class Decoder:
+    """Turns the byte stream into text lines, resynchronising on the sync byte after line errors."""
+
+    def __init__(self, formats):
+        self.formats = formats
+        self.buffer = bytearray()
+        self.nextSequence = None
+
+    def feed(self, data):
+        """Returns the lines of every record completed by data."""
+        self.buffer += data
+        lines = []
+        while True:
+            start = self.buffer.find(SYNC)
+            if start < 0:
+                start = len(self.buffer)
+            if start > 0:
+                lines.append('<skipped %d bytes>' % start)
+                del self.buffer[:start]
+            if len(self.buffer) < HEADER_SIZE:
+                return lines
+
+            _, formatId, argCount, sequence = self.buffer[:HEADER_SIZE]
+            if formatId >= len(self.formats) or argCount > MAX_ARGS:
+                # Not a record after all, look for the next sync byte
+                del self.buffer[:1]
+                continue
+            size = HEADER_SIZE + 4 * argCount
+            if len(self.buffer) < size:
+                return lines
+
+            if self.nextSequence is not None and sequence != self.nextSequence:
+                lines.append('<lost %d records>' % ((sequence - self.nextSequence) & 0xFF))
+            self.nextSequence = (sequence + 1) & 0xFF
+
+            args = struct.unpack_from('<%dI' % argCount, self.buffer, HEADER_SIZE)
+            name, text = self.formats[formatId]
+            lines.append(formatRecord(text, args))
+            del self.buffer[:size]
+
+
+def openInput(source):
+    if source == '-':
+        return sys.stdin.buffer
+    if os.path.isfile(source):
+        return open(source, 'rb')
+    import serial
+    return serial.Serial(source, BAUD, timeout=0.1)
+
+
+def main(argv):
+    if len(argv) != 2:
+        print('usage: rt_log_decode.py <serial port | capture file | ->')
+        return 1
+    decoder = Decoder(loadFormats())
+    stream = openInput(argv[1])
+    while True:
+        data = stream.read(256)
+        if not data:
+            if os.path.isfile(argv[1]) or argv[1] == '-':
+                return 0
+            continue
+        for line in decoder.feed(data):
+            print(line, flush=True)
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
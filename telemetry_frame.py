@@ -0,0 +1,85 @@
+# Decoder for the binary telemetry frames published on DryerTelemetry.
+# Layout is documented in MessageFormat.txt and must match HighLevelApp/telemetry_frame.h.
+import struct
+
+VERSION = 1
+FRAME_SAMPLES = 0
+FRAME_START = 1
+FRAME_DRYNESS = 2
+FRAME_FEATURES = 3
+
+HEADER = struct.Struct('<BBHIQIHH')
+SAMPLE = struct.Struct('<6h')
+DRYNESS = struct.Struct('<hhI')
+FEATURES = struct.Struct('<HH')
+FEATURE_AXES = ('xa', 'ya', 'za', 'xr', 'yr', 'zr')
+
+
+def decode(payload):
+    """Returns (header dict, list of raw (xa, ya, za, xr, yr, zr) tuples), or None if payload is not a frame."""
+    if len(payload) < HEADER.size or payload[0] != VERSION:
+        return None
+    version, frameType, count, sequence, timestampNs, periodNs, accelFs, gyroFs = HEADER.unpack_from(payload)
+    if len(payload) < HEADER.size + count * SAMPLE.size:
+        return None
+    header = {'type': frameType, 'count': count, 'sequence': sequence, 'timestamp_ns': timestampNs,
+              'period_ns': periodNs, 'accel_fs_g': accelFs, 'gyro_fs_dps': gyroFs}
+    samples = [SAMPLE.unpack_from(payload, HEADER.size + i * SAMPLE.size) for i in range(count)]
+    return header, samples
+
+
+def decodeDryness(payload):
+    """Returns {'dryness', 'confidence', 'samples'} of an on-device dryness frame, or None for any other payload."""
+    frame = decode(payload)
+    if frame is None or frame[0]['type'] != FRAME_DRYNESS or len(payload) < HEADER.size + DRYNESS.size:
+        return None
+    dryness, confidence, samples = DRYNESS.unpack_from(payload, HEADER.size)
+    return {'dryness': dryness / 10000.0, 'confidence': confidence / 10000.0, 'samples': samples}
+
+
+def decodeFeatures(payload):
+    """Returns {'window', 'rms', 'variance', 'zcr', 'bands'} of a features frame, each per-axis value a dict
+    keyed by FEATURE_AXES, or None for any other payload."""
+    frame = decode(payload)
+    if frame is None or frame[0]['type'] != FRAME_FEATURES or len(payload) < HEADER.size + FEATURES.size:
+        return None
+    window, bands = FEATURES.unpack_from(payload, HEADER.size)
+    axis = struct.Struct('<%df' % (3 + bands))
+    if len(payload) < HEADER.size + FEATURES.size + len(FEATURE_AXES) * axis.size:
+        return None
+    features = {'window': window, 'rms': {}, 'variance': {}, 'zcr': {}, 'bands': {}}
+    for i, name in enumerate(FEATURE_AXES):
+        values = axis.unpack_from(payload, HEADER.size + FEATURES.size + i * axis.size)
+        features['rms'][name], features['variance'][name], features['zcr'][name] = values[0:3]
+        features['bands'][name] = list(values[3:])
+    return features
+
+
+def sampleTimes(header):
+    """Returns the device monotonic time of every sample of a frame in ns. The header carries the sensor
+    timestamp of the first sample and the measured spacing, so frames can be resampled onto a common grid."""
+    return [header['timestamp_ns'] + i * header['period_ns'] for i in range(header['count'])]
+
+
+def toEngineering(header, sample):
+    """Converts a raw sample to [xa, ya, za] in mg and [xr, yr, zr] in dps, as one flat list."""
+    mgPerLsb = 0.0305 * header['accel_fs_g']
+    dpsPerLsb = 0.000035 * header['gyro_fs_dps']
+    return [v * mgPerLsb for v in sample[0:3]] + [v * dpsPerLsb for v in sample[3:6]]
+
+
+def toCSVLines(payload):
+    """Converts a frame to the legacy text format: 'sequence,xa,ya,za,xr,yr,zr' per sample, all -1 for a start frame."""
+    frame = decode(payload)
+    if frame is None:
+        return []
+    header, samples = frame
+    if header['type'] == FRAME_START:
+        return ['-1,-1,-1,-1,-1,-1,-1']
+    if header['type'] != FRAME_SAMPLES:
+        return []
+    lines = []
+    for i, sample in enumerate(samples):
+        values = toEngineering(header, sample)
+        lines.append(','.join([str(header['sequence'] + i)] + ['%f' % v for v in values]))
+    return lines